@@ -2206,6 +2206,112 @@ TrainPosition(CONST int anBoard[2][25], float arDesired[], float a,
 }
 
 
+extern int
+TrainingInputs(CONST int anBoard[2][25], float arDesired[], float arInput[])
+{
+  int pc = ClassifyPosition(anBoard);
+
+  if( ! nets[pc].net ) {
+    pc = alternate[pc];
+    
+    if( pc < 0 || ! nets[pc].net ) {
+      errno = EDOM;
+      return -1;
+    }
+  }
+
+  if( arDesired ) {
+    SanityCheck(anBoard, arDesired);
+  }
+  
+  if( arInput ) {
+    nets[pc].netInputs->func(anBoard, arInput);
+  }
+  
+  return pc;
+}
+
+extern int
+TrainNetInputs(int pc, unsigned int n, float* aarInput[], float* aarDesired[],
+	       float a, float rMomentum, CONST int* tList)
+{
+  neuralnet* nn = (0 <= pc && pc < N_CLASSES) ? nets[pc].net : 0;
+  
+  if( ! nn ) {
+    errno = EDOM;
+    return -1;
+  }
+  
+  if( a < 0 ) {
+    a = 2.0 / pow( 100.0 + nn->nTrained, 0.25 );
+  }
+
+  if( n == 1 && rMomentum <= 0 ) {
+    float arOutput[NUM_OUTPUTS];
+    
+    if( ! tList ) {
+      NeuralNetTrain(nn, aarInput[0], arOutput, aarDesired[0], a);
+    } else {
+      NeuralNetTrainS(nn, aarInput[0], arOutput, aarDesired[0], a, tList);
+    }
+    return 0;
+  }
+  
+  return NeuralNetTrainBatch(nn, n, aarInput, aarDesired, a, rMomentum, tList);
+}
+
+extern int
+TrainPositions(CONST int aanBoard[][2][25], float* aarDesired[], unsigned int n,
+	       float a, float rMomentum, CONST int* tList)
+{
+  float* arInputs = malloc(n * MAX_NUM_INPUTS * sizeof(float));
+  float** aarInput = malloc(n * sizeof(float*));
+  float** aarBatchDesired = malloc(n * sizeof(float*));
+  int* anClass = malloc(n * sizeof(int));
+  int pc, result = 0;
+  unsigned int k;
+
+  if( ! (arInputs && aarInput && aarBatchDesired && anClass) ) {
+    free(arInputs); free(aarInput); free(aarBatchDesired); free(anClass);
+    errno = ENOMEM;
+    return -1;
+  }
+  
+  for(k = 0; k < n; ++k) {
+    anClass[k] = TrainingInputs(aanBoard[k], aarDesired[k],
+				arInputs + k * MAX_NUM_INPUTS);
+    if( anClass[k] < 0 ) {
+      result = -1;
+    }
+  }
+
+  /* one batch per net */
+  
+  for(pc = 0; pc < N_CLASSES; ++pc) {
+    int m = 0;
+    
+    for(k = 0; k < n; ++k) {
+      if( anClass[k] == pc ) {
+	aarInput[m] = arInputs + k * MAX_NUM_INPUTS;
+	aarBatchDesired[m] = aarDesired[k];
+	++m;
+      }
+    }
+
+    if( m && TrainNetInputs(pc, m, aarInput, aarBatchDesired, a,
+			    rMomentum, tList) < 0 ) {
+      result = -1;
+    }
+  }
+
+  free(arInputs);
+  free(aarInput);
+  free(aarBatchDesired);
+  free(anClass);
+  
+  return result;
+}
+
 extern int
 PruneTrainPosition(CONST int anBoard[2][25], float arDesired[], float a)
 {
@@ -3009,6 +3115,20 @@ inputNameByClass(positionclass pc, unsigned int k)
   return inputNameFromFunc(nets[pc].netInputs, k);
 }
 
+CONST char*
+inputFuncByClass(positionclass pc, unsigned int* nInputs)
+{
+  if( ! (nets[pc].net && nets[pc].netInputs) ) {
+    return 0;
+  }
+
+  if( nInputs ) {
+    *nInputs = nets[pc].netInputs->nInputs;
+  }
+  
+  return nets[pc].netInputs->name;
+}
+
 CONST char*
 inputNameByFunc(CONST char* inpFunc, unsigned int k)
 {
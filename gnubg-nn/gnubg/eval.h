@@ -191,6 +191,21 @@ TrainPosition(CONST int anBoard[2][25], float arDesired[], float alpha,
 extern int
 PruneTrainPosition(CONST int anBoard[2][25], float arDesired[], float alpha);
 
+/* Train n positions in mini-batches, one per net (see NeuralNetTrainBatch) */
+extern int
+TrainPositions(CONST int aanBoard[][2][25], float* aarDesired[], unsigned int n,
+	       float alpha, float momentum, CONST int* k);
+
+/* Class of the net TrainPosition trains on anBoard (-1 if none). Fixes
+   arDesired and computes the net inputs into arInput, when not 0. */
+extern int
+TrainingInputs(CONST int anBoard[2][25], float arDesired[], float arInput[]);
+
+/* Train the net of class pc on n positions with inputs from TrainingInputs */
+extern int
+TrainNetInputs(int pc, unsigned int n, float* aarInput[], float* aarDesired[],
+	       float alpha, float momentum, CONST int* k);
+
 /* extern int DumpPosition( int anBoard[ 2 ][ 25 ], char *szOutput, int nPlies );
  */
 
@@ -245,6 +260,9 @@ inputNameByClass(positionclass pc, unsigned int k);
 extern CONST char*
 inputNameByFunc(CONST char* inpFunc, unsigned int k);
 
+extern CONST char*
+inputFuncByClass(positionclass pc, unsigned int* nInputs);
+
 #include "lib/sse.h"
 
 #endif
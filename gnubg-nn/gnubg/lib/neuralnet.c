@@ -525,6 +525,7 @@ NeuralNetCreate(neuralnet* pnn, int cInput, int cHidden,
 
   pnn->savedBase = malloc(cHidden * sizeof( Intermediate ) );
   pnn->savedIBase = malloc(cInput * sizeof( float ) );
+  pnn->arMomentum = 0;
   
   for( i = cHidden * cInput, pf = pnn->arHiddenWeight; i; i-- )
     *pf++ = ( ( random() & 0xFFFF ) - 0x8000 ) / 131072.0;
@@ -549,6 +550,7 @@ NeuralNetInit(neuralnet* pnn)
   pnn->arHiddenThreshold = 0;
   pnn->arOutputThreshold = 0;
   pnn->savedBase = 0;   pnn->savedIBase = 0;
+  pnn->arMomentum = 0;
 
   pnn->nEvals = 0;
 }
@@ -565,6 +567,7 @@ NeuralNetDestroy(neuralnet* pnn)
 
   free(pnn->savedBase); pnn->savedBase = 0;
   free(pnn->savedIBase); pnn->savedIBase = 0;
+  free(pnn->arMomentum); pnn->arMomentum = 0;
   
 /*    free( pnn->arHiddenWeightt ); */
     
@@ -898,6 +901,161 @@ NeuralNetTrainS(neuralnet* pnn, float arInput[], float arOutput[],
   return 0;
 }
 
+/* Train on n positions at once. The outputs and errors of all positions
+ * are computed with the weights as they are, then the weights move by the
+ * sum of the changes NeuralNetTrain would make for each position. A batch
+ * of one without momentum is NeuralNetTrain.
+ *
+ * With rMomentum > 0, rMomentum times the previous change is added to
+ * the change.
+ *
+ * With tList, only the hidden weights of the inputs in tList (and the hidden
+ * thresholds) are trained, as in NeuralNetTrainS.
+ */
+
+extern int
+NeuralNetTrainBatch(neuralnet* pnn, int n, float* aarInput[],
+		    float* aarDesired[], float rAlpha, float rMomentum,
+		    CONST int* tList)
+{
+  int const cInput = pnn->cInput, cHidden = pnn->cHidden,
+    cOutput = pnn->cOutput;
+  /* rows of the hidden values are aligned for the SSE forward pass */
+  int const cStride = (cHidden + 3) & ~3;
+  int const cWeights = cInput * cHidden + cOutput * cHidden + cHidden + cOutput;
+  int i, j, s;
+  
+  float arOutput[ cOutput ];
+  float *arHidden, *arHiddenError, *arOutputError;
+
+  /* where the changes go: the weights, or the momentum */
+  float *prHiddenWeight, *prOutputWeight, *prHiddenThreshold,
+    *prOutputThreshold;
+
+  if( n <= 0 ) {
+    return 0;
+  }
+  
+  arHidden = sse_malloc( n * cStride * sizeof( float ) );
+  arHiddenError = sse_malloc( n * cStride * sizeof( float ) );
+  arOutputError = malloc( n * cOutput * sizeof( float ) );
+
+  if( rMomentum > 0 && ! pnn->arMomentum ) {
+    pnn->arMomentum = calloc( cWeights, sizeof( float ) );
+  }
+  
+  if( ! arHidden || ! arHiddenError || ! arOutputError ||
+      ( rMomentum > 0 && ! pnn->arMomentum ) ) {
+    if( arHidden ) sse_free( arHidden );
+    if( arHiddenError ) sse_free( arHiddenError );
+    free( arOutputError );
+    errno = ENOMEM;
+    return -1;
+  }
+  
+  /* Forward pass and errors at output and hidden nodes */
+  
+  for( s = 0; s < n; ++s ) {
+    float* ar = arHidden + s * cStride;
+    float* arHE = arHiddenError + s * cStride;
+    float* arOE = arOutputError + s * cOutput;
+    
+    if( fuseSSE ) {
+      NeuralNetForwardSSE(pnn, aarInput[s], ar, arOutput);
+    } else {
+      Evaluate(pnn, aarInput[s], ar, arOutput, 0);
+    }
+
+    for( i = 0; i < cOutput; ++i ) {
+      arOE[i] = ( aarDesired[s][i] - arOutput[i] ) *
+	pnn->rBetaOutput * arOutput[i] * ( 1 - arOutput[i] );
+    }
+    
+    for( j = 0; j < cHidden; ++j ) {
+      arHE[j] = 0.0;
+    }
+
+    for( i = 0; i < cOutput; ++i ) {
+      sse_axpy(arHE, arOE[i], pnn->arOutputWeight + i * cHidden, cHidden);
+    }
+    
+    for( j = 0; j < cHidden; ++j ) {
+      arHE[j] *= pnn->rBetaHidden * ar[j] * ( 1 - ar[j] );
+    }
+  }
+
+  if( rMomentum > 0 ) {
+    float* pr = pnn->arMomentum;
+    
+    for( i = cWeights; i; i-- ) {
+      *pr++ *= rMomentum;
+    }
+    
+    prHiddenWeight = pnn->arMomentum;
+    prOutputWeight = prHiddenWeight + cInput * cHidden;
+    prHiddenThreshold = prOutputWeight + cOutput * cHidden;
+    prOutputThreshold = prHiddenThreshold + cHidden;
+  } else {
+    prHiddenWeight = pnn->arHiddenWeight;
+    prOutputWeight = pnn->arOutputWeight;
+    prHiddenThreshold = pnn->arHiddenThreshold;
+    prOutputThreshold = pnn->arOutputThreshold;
+  }
+
+  /* Sum the changes */
+  
+  for( s = 0; s < n; ++s ) {
+    float* ar = arHidden + s * cStride;
+    float* arHE = arHiddenError + s * cStride;
+    float* arOE = arOutputError + s * cOutput;
+    float* arInput = aarInput[s];
+
+    if( ! tList ) {
+      for( i = 0; i < cOutput; ++i ) {
+	sse_axpy(prOutputWeight + i * cHidden, rAlpha * arOE[i], ar, cHidden);
+	prOutputThreshold[i] += rAlpha * arOE[i];
+      }
+    
+      for( i = 0; i < cInput; ++i ) {
+	if( arInput[i] ) {
+	  sse_axpy(prHiddenWeight + i * cHidden, rAlpha * arInput[i], arHE,
+		   cHidden);
+	}
+      }
+    } else {
+      int k;
+      for( k = 0; tList[k] >= 0; ++k ) {
+	i = tList[k];
+	{                                 assert( 0 <= i && i < cInput ); }
+	if( arInput[i] ) {
+	  sse_axpy(prHiddenWeight + i * cHidden, rAlpha * arInput[i], arHE,
+		   cHidden);
+	}
+      }
+    }
+
+    sse_axpy(prHiddenThreshold, rAlpha, arHE, cHidden);
+  }
+
+  if( rMomentum > 0 ) {
+    /* apply them */
+    sse_axpy(pnn->arHiddenWeight, 1.0, prHiddenWeight, cInput * cHidden);
+    sse_axpy(pnn->arHiddenThreshold, 1.0, prHiddenThreshold, cHidden);
+    if( ! tList ) {
+      sse_axpy(pnn->arOutputWeight, 1.0, prOutputWeight, cOutput * cHidden);
+      sse_axpy(pnn->arOutputThreshold, 1.0, prOutputThreshold, cOutput);
+    }
+  }
+  
+  pnn->nTrained += n;
+
+  sse_free( arHidden );
+  sse_free( arHiddenError );
+  free( arOutputError );
+  
+  return 0;
+}
+
 extern int
 NeuralNetResize(neuralnet* pnn, int cInput, int cHidden, int cOutput)
 {
@@ -967,6 +1125,9 @@ NeuralNetResize(neuralnet* pnn, int cInput, int cHidden, int cOutput)
   pnn->cInput = cInput;
   pnn->cHidden = cHidden;
   pnn->cOutput = cOutput;
+
+  /* does not fit the new sizes */
+  free(pnn->arMomentum); pnn->arMomentum = 0;
     
   return 0;
 }
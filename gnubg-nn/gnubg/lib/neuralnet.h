@@ -40,6 +40,10 @@ typedef struct _neuralnet {
   Intermediate* savedBase;
   float* 	savedIBase;
 
+  /* Last weight update of NeuralNetTrainBatch with momentum: hidden and
+     output weights, hidden and output thresholds. Allocated on first use. */
+  float*	arMomentum;
+
     
   unsigned long		nEvals;
 
@@ -73,6 +77,11 @@ extern int
 NeuralNetTrainS(neuralnet* pnn, float arInput[], float arOutput[],
 		float arDesired[], float rAlpha, CONST int* tList);
 
+extern int
+NeuralNetTrainBatch(neuralnet* pnn, int n, float* aarInput[],
+		    float* aarDesired[], float rAlpha, float rMomentum,
+		    CONST int* tList);
+
 extern int NeuralNetResize( neuralnet *pnn, int cInput, int cHidden,
 			    int cOutput );
 
@@ -4,6 +4,8 @@
 #include "sse.h"
 #include "neuralnet.h"
 
+extern int fuseSSE;
+
 #if USE_SSE_VECTORIZE
 
 #if defined(DISABLE_SSE_TEST)
@@ -394,15 +396,54 @@ NeuralNetEvaluateSSE(const neuralnet *pnn, float arInput[], float arOutput[])
   return 0;
 }
 
+extern int
+NeuralNetForwardSSE(const neuralnet *pnn, const float arInput[], float arHidden[], float arOutput[])
+{
+#if DEBUG_SSE
+  assert(sse_aligned(arHidden));
+#endif
+
+  EvaluateSSE(pnn, arInput, arHidden, arOutput);
+  return 0;
+}
+
+void
+sse_axpy(float* y, float const a, const float* x, int n)
+{
+  if( fuseSSE ) {
+    __m128 const scalevec = _mm_set1_ps(a);
+    
+    for( ; n >= 4; n -= 4, x += 4, y += 4 ) {
+      __m128 vec = _mm_mul_ps(_mm_loadu_ps(x), scalevec);
+      _mm_storeu_ps(y, _mm_add_ps(_mm_loadu_ps(y), vec));
+    }
+  }
+  
+  for( ; n; --n ) {
+    *y++ += a * *x++;
+  }
+}
+
 #else
 
 int NeuralNetEvaluateSSE(const neuralnet *pnn __attribute__((unused)), float arInput[] __attribute__((unused)), float arOutput[] __attribute__((unused))) {
   assert(0);
 }
 
+int NeuralNetForwardSSE(const neuralnet *pnn __attribute__((unused)), const float arInput[] __attribute__((unused)), float arHidden[] __attribute__((unused)), float arOutput[] __attribute__((unused))) {
+  assert(0);
+}
+
+void
+sse_axpy(float* y, float const a, const float* x, int n)
+{
+  for( ; n; --n ) {
+    *y++ += a * *x++;
+  }
+}
+
 #endif
 
-extern int fuseSSE;
 
 int
 useSSE(int use) {
@@ -51,4 +51,10 @@ extern int useSSE(int useSSENet);
 struct _neuralnet;
 extern int NeuralNetEvaluateSSE(const struct _neuralnet *pnn, float arInput[], float arOutput[]);
 
+// As NeuralNetEvaluateSSE, keeping the hidden node values (arHidden aligned)
+extern int NeuralNetForwardSSE(const struct _neuralnet *pnn, const float arInput[], float arHidden[], float arOutput[]);
+
+// y[0..n) += a * x[0..n), using SSE when SSE evaluation is on
+extern void sse_axpy(float* y, float a, const float* x, int n);
+
 #endif
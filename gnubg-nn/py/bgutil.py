@@ -165,6 +165,13 @@ def readData(name) :
     print >> sys.stderr, "failed to read",name
     sys.exit(1)
 
+def isTrainingSet(name) :
+  """True if file is a binary training set (see trainer.save)"""
+  try :
+    return file(name, 'rb').read(8) == "gnubgts\n"
+  except:
+    return 0
+
 def readPly(name) :
   try :
     return int(name)
@@ -28,6 +28,25 @@ extern "C" {
 #include <eval.h>
 }
 
+#if HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
 #include "pytrainer.h"
 #include "defs.h"
 
@@ -70,6 +89,20 @@ eqErr(const float* const p1, const float* const p2)
 	  + (p1[2] - p2[2]) + (p1[3] - p2[3]) + (p1[4] - p2[4]));
 }
 
+#if HAVE_PTHREAD_H
+// The bearoff databases (and the race evaluation, which uses them) keep
+// static buffers and caches. Positions of those classes are evaluated one
+// at a time, positions evaluated by the nets alone in parallel.
+
+pthread_mutex_t dbLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+inline bool
+usesDatabase(const int board[2][25])
+{
+  return ClassifyPosition(board) <= CLASS_RACE;
+}
+
 }
 
 struct DataPosition {
@@ -78,10 +111,68 @@ struct DataPosition {
   float		probs[5];
 };
 
+typedef int Board[2][25];
+
+// Binary training set, written by trainer.save() and mapped by
+// gnubg.trainer(file-name). Numbers are in native byte order.
+//
+// At offset dataOffset follow nPositions records of recordSize bytes: a
+// DataRecord, padded to 4 bytes, followed by nInputs floats when the set
+// was saved with net inputs. Those are the inputs of the net of class
+// netClass, and the targets are the ones TrainPosition would train on.
+// They are used only while the nets have the input functions recorded in
+// the header.
+
+namespace {
+char const tsMagic[8] = {'g', 'n', 'u', 'b', 'g', 't', 's', '\n'};
+
+uint32_t const tsVersion = 1;
+
+enum {
+  tsMaxClasses = 8,
+  tsNameLength = 32,
+  tsDataOffset = 512
+};
+
+struct TrainingSetHeader {
+  char		magic[8];
+  uint32_t	version;
+  uint32_t	nPositions;
+  uint32_t	recordSize;
+  uint32_t	nInputs;
+  uint32_t	dataOffset;
+  uint32_t	reserved;
+  
+  // Input function of the net of each class ("" for none)
+  char		inputFuncs[tsMaxClasses][tsNameLength];
+};
+
+struct DataRecord {
+  unsigned char	auch[10];
+  
+  // Class of the trained net, noNetClass if there is none
+  unsigned char	netClass;
+  unsigned char	unused;
+
+  // Probabilities times 65535
+  uint16_t	probs[5];
+};
+
+unsigned char const noNetClass = 0xff;
+
+uint const tsInputsOffset = (sizeof(DataRecord) + 3) & ~3U;
+
+static_assert(N_CLASSES <= tsMaxClasses, "too many position classes");
+static_assert(sizeof(TrainingSetHeader) <= tsDataOffset, "header too long");
+}
+
 class Trainer {
 public:
   Trainer(uint n);
   
+  // Map the binary training set in file 'name'. Check 'error' after.
+  Trainer(const char* name, const char*& error);
+  
   ~Trainer();
 
   struct Errors {
@@ -124,6 +215,16 @@ public:
     double	noBGerror;
     double	maxNoBGerror;
 
+    void merge(Errors const& e) {
+      equityError += e.equityError;
+      absEquityError += e.absEquityError;
+      noBGerror += e.noBGerror;
+      
+      maxEquityError = std::max(maxEquityError, e.maxEquityError);
+      maxAbsEquityError = std::max(maxAbsEquityError, e.maxAbsEquityError);
+      maxNoBGerror = std::max(maxNoBGerror, e.maxNoBGerror);
+    }
+    
     void adjust(uint const n) {
       equityError = sqrt(equityError / n);
       absEquityError = sqrt(absEquityError / n);
@@ -133,79 +234,548 @@ public:
   
   void	errors(Errors& e) const;
   
-  void	train(double a, const int* order) const;
+  // With more than one thread, each thread trains a part of the positions
+  // and all of them update the net at the same time, without locking
+  // (Hogwild). The partition is fixed, but not the interleaving of the
+  // updates, so results are reproducible only with one thread.
+  //
+  // With batch > 1 the net is updated once per 'batch' positions (see
+  // TrainPositions). Momentum is kept in the net, so training with
+  // momentum uses one thread.
+  
+  void	train(double a, const int* order, uint batch, double momentum) const;
+
+  // Errors / training on positions [from, to) of the current thread
+  
+  void	errors(Errors& e, uint from, uint to) const;
+  
+  void	train(double a, const int* order, uint batch, double momentum,
+		  uint from, uint to) const;
+
+  // Training from the net inputs of a binary training set
+  
+  void	trainInputs(double a, const int* order, uint batch, double momentum,
+		    uint from, uint to) const;
+
+  // Save as a binary training set, with the net inputs when 'inputs'
+  
+  bool	save(const char* name, bool inputs) const;
+
+  // Position k of either kind of training set
+  
+  const unsigned char*	key(uint k) const;
+
+  void			targets(uint k, float p[5]) const;
+
+  // Targets to train position k on. The targets of a text training set
+  // are fixed in place by training; otherwise they are copied to p.
+  
+  float*		trainTargets(uint k, float p[5]) const;
+
+  // Saved net inputs of position k and the class of their net (0 if none)
+  
+  const float*		inputs(uint k, int& pc) const;
+
+  // True if the saved net inputs are those of the current nets
+  
+  bool			inputsMatchNets(void) const;
   
   uint			nPositions;
   DataPosition*		positions;
 
+  // Binary training set (positions is 0)
+  
+  void*			data;
+  size_t		dataSize;
+  bool			mapped;
+  const unsigned char*	records;
+  uint			recordSize;
+  uint			nInputs;
+  char			inputFuncs[tsMaxClasses][tsNameLength];
+
   bool			ignoreBGs;
   bool			pruneNet;
   int*			tList;
+
+  uint			nThreads;
 };
 
 Trainer::Trainer(uint const n) :
   nPositions(n),
   positions(new DataPosition [nPositions]),
+  data(0),
+  dataSize(0),
+  mapped(false),
+  records(0),
+  recordSize(0),
+  nInputs(0),
   ignoreBGs(false),
   pruneNet(false),
-  tList(0)
+  tList(0),
+  nThreads(1)
 {}
 
+Trainer::Trainer(const char* const name, const char*& error) :
+  nPositions(0),
+  positions(0),
+  data(0),
+  dataSize(0),
+  mapped(false),
+  records(0),
+  recordSize(0),
+  nInputs(0),
+  ignoreBGs(false),
+  pruneNet(false),
+  tList(0),
+  nThreads(1)
+{
+  error = 0;
+  
+  int const fd = open(name, O_RDONLY);
+  if( fd < 0 ) {
+    error = strerror(errno);
+    return;
+  }
+
+  TrainingSetHeader h;
+  struct stat st;
+  
+  if( fstat(fd, &st) < 0 || read(fd, &h, sizeof(h)) != sizeof(h) ||
+      memcmp(h.magic, tsMagic, sizeof(tsMagic)) != 0 ) {
+    error = "not a training set";
+  } else if( h.version != tsVersion ) {
+    error = "unsupported training set version";
+  } else if( h.recordSize != tsInputsOffset + h.nInputs * sizeof(float) ||
+	     h.dataOffset < sizeof(h) || h.dataOffset % 4 != 0 ||
+	     size_t(st.st_size) < (h.dataOffset +
+				   size_t(h.nPositions) * h.recordSize) ) {
+    error = "truncated or corrupt training set";
+  }
+
+  if( ! error ) {
+    size_t const size = h.dataOffset + size_t(h.nPositions) * h.recordSize;
+    void* p = 0;
+    
+#if HAVE_MMAP
+    p = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    mapped = p != MAP_FAILED;
+    if( ! mapped ) {
+      p = 0;
+    }
+#endif
+
+    // no mmap, read it all
+    
+    if( ! p ) {
+      p = malloc(size);
+      if( ! p ) {
+	error = "out of memory";
+      } else if( lseek(fd, 0, SEEK_SET) != 0 ||
+		 read(fd, p, size) != ssize_t(size) ) {
+	error = "failed to read training set";
+	free(p);
+	p = 0;
+      }
+    }
+
+    if( p ) {
+      data = p;
+      dataSize = size;
+      records = static_cast<const unsigned char*>(p) + h.dataOffset;
+      nPositions = h.nPositions;
+      recordSize = h.recordSize;
+      nInputs = h.nInputs;
+      memcpy(inputFuncs, h.inputFuncs, sizeof(inputFuncs));
+      for(uint c = 0; c < tsMaxClasses; ++c) {
+	inputFuncs[c][tsNameLength - 1] = 0;
+      }
+    }
+  }
+  
+  close(fd);
+}
+
 Trainer::~Trainer()
 {
+  if( data ) {
+#if HAVE_MMAP
+    if( mapped ) {
+      munmap(data, dataSize);
+    } else
+#endif
+      free(data);
+  }
+  
   delete [] positions;
   delete [] tList;
 }
 
-typedef int Board[2][25];
+inline const unsigned char*
+Trainer::key(uint const k) const
+{
+  if( positions ) {
+    return positions[k].auch;
+  }
+  return reinterpret_cast<const DataRecord*>(records + size_t(k) * recordSize)
+    ->auch;
+}
+
+inline void
+Trainer::targets(uint const k, float p[5]) const
+{
+  if( positions ) {
+    std::copy(positions[k].probs, positions[k].probs + 5, p);
+  } else {
+    const DataRecord* const r =
+      reinterpret_cast<const DataRecord*>(records + size_t(k) * recordSize);
+    
+    for(uint i = 0; i < 5; ++i) {
+      p[i] = r->probs[i] / 65535.0;
+    }
+  }
+}
+
+inline float*
+Trainer::trainTargets(uint const k, float p[5]) const
+{
+  if( positions && ! ignoreBGs ) {
+    return const_cast<float*>(positions[k].probs);
+  }
+  
+  targets(k, p);
+  if( ignoreBGs ) {
+    p[2] = p[4] = 0.0;
+  }
+  return p;
+}
+
+inline const float*
+Trainer::inputs(uint const k, int& pc) const
+{
+  const unsigned char* const r = records + size_t(k) * recordSize;
+  
+  pc = reinterpret_cast<const DataRecord*>(r)->netClass;
+  if( pc == noNetClass ) {
+    pc = -1;
+    return 0;
+  }
+  return reinterpret_cast<const float*>(r + tsInputsOffset);
+}
+
+bool
+Trainer::inputsMatchNets(void) const
+{
+  if( ! (records && nInputs) ) {
+    return false;
+  }
+
+  for(uint c = 0; c < tsMaxClasses; ++c) {
+    const char* const f =
+      c < N_CLASSES ? inputFuncByClass(positionclass(c), 0) : 0;
+    
+    if( strcmp(inputFuncs[c], f ? f : "") != 0 ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool
+Trainer::save(const char* const name, bool const withInputs) const
+{
+  TrainingSetHeader h;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, tsMagic, sizeof(tsMagic));
+  h.version = tsVersion;
+  h.nPositions = nPositions;
+  h.dataOffset = tsDataOffset;
+
+  if( withInputs ) {
+    for(uint c = 0; c < N_CLASSES; ++c) {
+      unsigned int n;
+      if( const char* const f = inputFuncByClass(positionclass(c), &n) ) {
+	strncpy(h.inputFuncs[c], f, tsNameLength - 1);
+	h.nInputs = std::max(h.nInputs, uint32_t(n));
+      }
+    }
+  }
+  h.recordSize = tsInputsOffset + h.nInputs * sizeof(float);
+
+  FILE* const f = fopen(name, "wb");
+  if( ! f ) {
+    return false;
+  }
+
+  bool ok = (fwrite(&h, sizeof(h), 1, f) == 1 &&
+	     fseek(f, h.dataOffset, SEEK_SET) == 0);
+
+  std::vector<unsigned char> record(h.recordSize);
+  DataRecord& r = *reinterpret_cast<DataRecord*>(&record[0]);
+  float* const in = reinterpret_cast<float*>(&record[tsInputsOffset]);
+  
+  for(uint k = 0; ok && k < nPositions; ++k) {
+    float p[5];
+    
+    memcpy(r.auch, key(k), sizeof(r.auch));
+    targets(k, p);
+
+    // Save the targets as fixed by training, so that errors() gives the
+    // same results for both kinds of training sets
+    
+    Board board;
+    PositionFromKey(board, r.auch);
+
+    std::fill(in, in + h.nInputs, 0.0f);
+    int const pc = TrainingInputs(board, p, withInputs ? in : 0);
+    
+    r.netClass = (withInputs && pc >= 0) ? pc : noNetClass;
+
+    for(uint i = 0; i < 5; ++i) {
+      float const x = std::min(std::max(p[i], 0.0f), 1.0f);
+      r.probs[i] = uint16_t(x * 65535 + 0.5);
+    }
+    
+    ok = fwrite(&record[0], h.recordSize, 1, f) == 1;
+  }
+
+  return (fclose(f) == 0) && ok;
+}
+
+namespace {
+struct Job {
+  const Trainer*	trainer;
+  uint			from;
+  uint			to;
+  
+  bool			train;
+  double		a;
+  const int*		order;
+  uint			batch;
+  double		momentum;
+
+  Trainer::Errors	errors;
+};
+
+void*
+runJob(void* const p)
+{
+  Job& j = *static_cast<Job*>(p);
+
+  if( j.train ) {
+    j.trainer->train(j.a, j.order, j.batch, j.momentum, j.from, j.to);
+  } else {
+    j.trainer->errors(j.errors, j.from, j.to);
+  }
+  return 0;
+}
+
+// Run jobs[0 .. n-1], in parallel when possible
+
+void
+runJobs(Job* const jobs, uint const n)
+{
+#if HAVE_PTHREAD_H
+  std::vector<pthread_t> threads(n);
+  std::vector<bool> started(n);
+  
+  for(uint k = 1; k < n; ++k) {
+    started[k] = pthread_create(&threads[k], 0, runJob, &jobs[k]) == 0;
+    if( ! started[k] ) {
+      runJob(&jobs[k]);
+    }
+  }
+
+  runJob(&jobs[0]);
+
+  for(uint k = 1; k < n; ++k) {
+    if( started[k] ) {
+      pthread_join(threads[k], 0);
+    }
+  }
+#else
+  for(uint k = 0; k < n; ++k) {
+    runJob(&jobs[k]);
+  }
+#endif
+}
+
+// Split [0, nPositions) in n contiguous parts, the same for a given n
+
+void
+splitJobs(Job* const jobs, uint const n, const Trainer* const t)
+{
+  for(uint k = 0; k < n; ++k) {
+    jobs[k].trainer = t;
+    jobs[k].from = (unsigned long long)t->nPositions * k / n;
+    jobs[k].to = (unsigned long long)t->nPositions * (k + 1) / n;
+  }
+}
+}
 
 void
 Trainer::errors(Errors& e) const
+{
+  uint const n = std::max(1U, std::min(nThreads, nPositions));
+  std::vector<Job> jobs(n);
+
+  splitJobs(&jobs[0], n, this);
+  for(uint k = 0; k < n; ++k) {
+    jobs[k].train = false;
+  }
+
+  runJobs(&jobs[0], n);
+
+  // merge in a fixed order, so that the result does not depend on timing
+  for(uint k = 0; k < n; ++k) {
+    e.merge(jobs[k].errors);
+  }
+
+  e.adjust(nPositions);
+}
+
+void
+Trainer::errors(Errors& e, uint const from, uint const to) const
 {
   Board board;
-  float p[5];
+  float p[5], probs[5];
 
-  for(uint k = 0; k < nPositions; ++k) {
-    DataPosition const& t = positions[k];
-    
-    PositionFromKey(board, const_cast<unsigned char*>(t.auch));
+  for(uint k = from; k < to; ++k) {
+    PositionFromKey(board, const_cast<unsigned char*>(key(k)));
+    targets(k, probs);
 
+#if HAVE_PTHREAD_H
+    bool const lock = nThreads > 1 && usesDatabase(board);
+    if( lock ) {
+      pthread_mutex_lock(&dbLock);
+    }
+#endif
+    
     if( pruneNet ) {
       evalPrune(board, p);
     } else {
       EvaluatePositionFast(board, p);
     }
 
-    e.add_eq(eqErr(p, t.probs));
-    e.add_aeq(eqAbsErr(p, t.probs));
-    e.add_mnbg(noBGErr(p, t.probs));
+#if HAVE_PTHREAD_H
+    if( lock ) {
+      pthread_mutex_unlock(&dbLock);
+    }
+#endif
+    
+    e.add_eq(eqErr(p, probs));
+    e.add_aeq(eqAbsErr(p, probs));
+    e.add_mnbg(noBGErr(p, probs));
+  }
+}
+
+void
+Trainer::train(double const a, const int* const order,
+	       uint const batch, double const momentum) const
+{
+  uint const n = momentum > 0 ? 1U : std::max(1U, std::min(nThreads, nPositions));
+  std::vector<Job> jobs(n);
+
+  splitJobs(&jobs[0], n, this);
+  for(uint k = 0; k < n; ++k) {
+    jobs[k].train = true;
+    jobs[k].a = a;
+    jobs[k].order = order;
+    jobs[k].batch = batch;
+    jobs[k].momentum = momentum;
   }
 
-  e.adjust(nPositions);
+  runJobs(&jobs[0], n);
 }
 
 void
-Trainer::train(double const a, const int* const order) const
+Trainer::train(double const a, const int* const order,
+	       uint const batch, double const momentum,
+	       uint const from, uint const to) const
 {
+  if( ! pruneNet && inputsMatchNets() ) {
+    trainInputs(a, order, std::max(batch, 1U), momentum, from, to);
+    return;
+  }
+  
   Board board;
+  float p[5];
 
-  for(uint k = 0; k < nPositions; ++k) {
-    DataPosition const& t = positions[order ? order[k] : k];
+  if( (batch > 1 || momentum > 0) && ! pruneNet ) {
+    uint const m = std::max(batch, 1U);
+    Board* const boards = new Board [m];
+    float (*const probs)[5] = new float [m][5];
+    float** const desired = new float* [m];
     
-    PositionFromKey(board, const_cast<unsigned char*>(t.auch));
-
-    if( ignoreBGs ) {
-      float p[5] = {t.probs[0], t.probs[1], 0.0, t.probs[3], 0.0};
-      if( pruneNet ) {
-	PruneTrainPosition(board, p, a);
-      } else {
-	TrainPosition(board, p, a, tList);
+    for(uint k = from; k < to; k += m) {
+      uint const l = std::min(m, to - k);
+      
+      for(uint i = 0; i < l; ++i) {
+	uint const j = order ? order[k + i] : k + i;
+	
+	PositionFromKey(boards[i], const_cast<unsigned char*>(key(j)));
+
+	desired[i] = trainTargets(j, probs[i]);
       }
+
+      TrainPositions(boards, desired, l, a, momentum, tList);
+    }
+
+    delete [] desired;
+    delete [] probs;
+    delete [] boards;
+    return;
+  }
+
+  for(uint k = from; k < to; ++k) {
+    uint const j = order ? order[k] : k;
+    
+    PositionFromKey(board, const_cast<unsigned char*>(key(j)));
+
+    float* const d = trainTargets(j, p);
+    
+    if( pruneNet ) {
+      PruneTrainPosition(board, d, a);
     } else {
-      if( pruneNet ) {
-	PruneTrainPosition(board, const_cast<float*>(t.probs), a);
-      } else {
-	TrainPosition(board, const_cast<float*>(t.probs), a, tList);
+      TrainPosition(board, d, a, tList);
+    }
+  }
+}
+
+void
+Trainer::trainInputs(double const a, const int* const order,
+		     uint const batch, double const momentum,
+		     uint const from, uint const to) const
+{
+  std::vector<float> probs(5 * batch);
+  std::vector<int> classes(batch);
+  std::vector<float*> in(batch), desired(batch);
+  std::vector<float*> netIn(batch), netDesired(batch);
+  
+  for(uint k = from; k < to; k += batch) {
+    uint const l = std::min(batch, to - k);
+      
+    for(uint i = 0; i < l; ++i) {
+      uint const j = order ? order[k + i] : k + i;
+      desired[i] = trainTargets(j, &probs[5 * i]);
+      in[i] = const_cast<float*>(inputs(j, classes[i]));
+    }
+
+    // one batch per net
+    
+    for(int pc = 0; pc < N_CLASSES; ++pc) {
+      uint n = 0;
+      
+      for(uint i = 0; i < l; ++i) {
+	if( classes[i] == pc ) {
+	  netIn[n] = in[i];
+	  netDesired[n] = desired[i];
+	  ++n;
+	}
+      }
+      
+      if( n ) {
+	TrainNetInputs(pc, n, &netIn[0], &netDesired[0], a, momentum, tList);
       }
     }
   }
@@ -230,13 +800,35 @@ trainer_errors(PyObject* self, PyObject*);
 static PyObject*
 trainer_train(PyObject* self, PyObject* args);
 
+static PyObject*
+trainer_threads(PyObject* self, PyObject* args);
+
+static PyObject*
+trainer_save(PyObject* self, PyObject* args);
+
+static PyObject*
+trainer_size(PyObject* self, PyObject*);
+
 
 static PyMethodDef trainer_methods[] = {
   {"errors",	trainer_errors, METH_NOARGS,
    ""},
 
   {"train",	trainer_train, METH_VARARGS,
-   ""},
+   "train(alpha[,order[,seed[,batch[,momentum]]]]) - train the positions "
+   "once, updating the net every 'batch' positions."},
+
+  {"threads",	trainer_threads, METH_VARARGS,
+   "threads([n]) - set the number of threads for errors and train. "
+   "Returns the previous number."},
+
+  {"save",	trainer_save, METH_VARARGS,
+   "save(file[,inputs]) - save as a binary training set, which "
+   "gnubg.trainer(file) maps. With inputs, also save the inputs of the "
+   "current nets, so that training does not compute them."},
+
+  {"size",	trainer_size, METH_NOARGS,
+   "Number of positions."},
   
   {0,0,0,0}		/* sentinel */
 };
@@ -312,7 +904,10 @@ trainer_errors(PyObject* self, PyObject*)
   Trainer& t = *static_cast<TrainerObject*>(self)->trainer;
 
   Trainer::Errors e;
+
+  Py_BEGIN_ALLOW_THREADS
   t.errors(e);
+  Py_END_ALLOW_THREADS
 
   return Py_BuildValue("dddddd",
 		       e.absEquityError, e.maxAbsEquityError,
@@ -329,13 +924,20 @@ trainer_train(PyObject* self, PyObject* args)
   
   double a;
   PyObject* porder = 0;
+  PyObject* pseed = 0;
+  int batch = 1;
+  double momentum = 0.0;
   
-  if( !PyArg_ParseTuple(args, "d|O", &a, &porder) ) {
+  if( !PyArg_ParseTuple(args, "d|OOid", &a, &porder, &pseed, &batch,
+			&momentum) ) {
     PyErr_SetString(PyExc_ValueError, "wrong args.") ;
     return 0;
   }
 
-
+  if( porder == Py_None ) {
+    porder = 0;
+  }
+  
   int* order = 0;
   if( porder ) {
     if( !(PySequence_Check(porder) &&
@@ -352,8 +954,33 @@ trainer_train(PyObject* self, PyObject* args)
       order[k] = PyInt_AsLong(i);
     }
   }
+
+  // Shuffle the order (or the positions) with a generator of our own, so
+  // that the same seed always gives the same order.
+  
+  if( pseed && pseed != Py_None ) {
+    unsigned long const seed = PyInt_AsUnsignedLongMask(pseed);
+    if( PyErr_Occurred() ) {
+      delete [] order;
+      return 0;
+    }
+    
+    if( ! order ) {
+      order = new int [t.nPositions];
+      for(uint k = 0; k < t.nPositions; ++k) {
+	order[k] = k;
+      }
+    }
+
+    std::mt19937 gen(seed);
+    for(uint k = t.nPositions; k > 1; --k) {
+      std::swap(order[k - 1], order[gen() % k]);
+    }
+  }
   
-  t.train(a, order);
+  Py_BEGIN_ALLOW_THREADS
+  t.train(a, order, std::max(batch, 1), momentum);
+  Py_END_ALLOW_THREADS
 
   delete [] order;
   
@@ -362,6 +989,66 @@ trainer_train(PyObject* self, PyObject* args)
 }
 
 
+static PyObject*
+trainer_threads(PyObject* self, PyObject* args)
+{
+  {                                 assert( self->ob_type == &Trainer_Type ); }
+
+  Trainer& t = *static_cast<TrainerObject*>(self)->trainer;
+  
+  int n = 0;
+  
+  if( !PyArg_ParseTuple(args, "|i", &n) ) {
+    return 0;
+  }
+
+  uint const prev = t.nThreads;
+  
+  if( n > 0 ) {
+    t.nThreads = n;
+  }
+  
+  return PyInt_FromLong(prev);
+}
+
+static PyObject*
+trainer_save(PyObject* self, PyObject* args)
+{
+  {                                 assert( self->ob_type == &Trainer_Type ); }
+
+  Trainer& t = *static_cast<TrainerObject*>(self)->trainer;
+  
+  const char* name;
+  int inputs = 0;
+  
+  if( !PyArg_ParseTuple(args, "s|i", &name, &inputs) ) {
+    return 0;
+  }
+
+  bool ok;
+  
+  Py_BEGIN_ALLOW_THREADS
+  ok = t.save(name, inputs);
+  Py_END_ALLOW_THREADS
+
+  if( ! ok ) {
+    PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(name));
+    return 0;
+  }
+  
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
+static PyObject*
+trainer_size(PyObject* self, PyObject*)
+{
+  {                                 assert( self->ob_type == &Trainer_Type ); }
+
+  return PyInt_FromLong(static_cast<TrainerObject*>(self)->trainer->nPositions);
+}
+
+
 PyObject*
 newTrainer(PyObject* const args)
 {
@@ -369,20 +1056,37 @@ newTrainer(PyObject* const args)
   int flag = 0;
   int prune = 0;
   PyObject* tList = 0;
+  int nThreads = 1;
   
-  if( !PyArg_ParseTuple(args, "O|iiO", &data, &flag, &prune, &tList)) {
+  if( !PyArg_ParseTuple(args, "O|iiOi", &data, &flag, &prune, &tList,
+			&nThreads)) {
     return 0;
   }
 
-  if( ! PySequence_Check(data) ) {
-    return 0;
+  Trainer* pt;
+  
+  if( PyString_Check(data) ) {
+    const char* const name = PyString_AS_STRING(data);
+    const char* error;
+    
+    pt = new Trainer(name, error);
+    if( error ) {
+      PyErr_Format(PyExc_IOError, "%s: %s", name, error);
+      delete pt;
+      return 0;
+    }
+  } else {
+    if( ! PySequence_Check(data) ) {
+      return 0;
+    }
+    pt = new Trainer(PySequence_Size(data));
   }
   
-  uint const nTrain = PySequence_Size(data);
-  Trainer& t = *(new Trainer(nTrain));
+  Trainer& t = *pt;
 
   t.ignoreBGs = flag;
   t.pruneNet = prune;
+  t.nThreads = std::max(nThreads, 1);
 
   if( tList ) {
     if( ! PySequence_Check(tList) ) {
@@ -400,7 +1104,7 @@ newTrainer(PyObject* const args)
     }
   }
   
-  for(uint k = 0; k < nTrain; ++k) {
+  for(uint k = 0; t.positions && k < t.nPositions; ++k) {
     DataPosition& p = t.positions[k];
 
     PyObject* const pl = PySequence_Fast_GET_ITEM(data, k);
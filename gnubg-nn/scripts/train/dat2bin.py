@@ -0,0 +1,29 @@
+#!/usr/bin/env pygnubg 
+""" dat2bin [-i] dat-file bin-file
+
+Convert a training data file to a binary training set, which train.py maps
+instead of reading. With -i also save the inputs of the current nets, so
+that training does not compute them (they are used only while the nets
+keep the same input functions)."""
+
+import sys, getopt
+
+from bgutil import *
+
+optlist, args = getopt.getopt(sys.argv[1:], "i")
+
+saveInputs = 0
+
+for o, a in optlist:
+  if o == '-i':
+    saveInputs = 1
+
+try: 
+  dataFileName,binFileName = args[0:2]
+except :
+  print >> sys.stderr, "Usage:", sys.argv[0],"[-i] dat-file bin-file"
+  sys.exit(1)
+
+trainer = gnubg.trainer(readData(dataFileName))
+
+trainer.save(binFileName, saveInputs)
@@ -1,5 +1,5 @@
 #!/usr/bin/env pygnubg 
-""" train [-a alpha -l low-alpha -b benchnark -v -n] dat-file net-base-name"""
+""" train [-a alpha -l low-alpha -b benchnark -v -n -t threads -B batch -m momentum] dat/bin-file net-base-name"""
 
 import sys, string, os, time, glob, getopt
 
@@ -30,8 +30,11 @@ targetClass = gnubg.c_contact
 benchmarkFile = None
 iTrain = list()
 ignoreBG = 0
+nThreads = 1
+batch = 1
+momentum = 0.0
 
-optlist, args = getopt.getopt(sys.argv[1:], "a:l:nvb:i:", \
+optlist, args = getopt.getopt(sys.argv[1:], "a:l:nvb:i:t:B:m:", \
                               ["class=", "ignorebg"])
 
 for o, a in optlist:
@@ -51,32 +54,45 @@ for o, a in optlist:
     ignoreBG = 1
   elif o == '-i':
     iTrain = [int(x) for x in a.split()]
+  elif o == '-t':
+    nThreads = int(a)
+  elif o == '-B':
+    batch = int(a)
+  elif o == '-m':
+    momentum = float(a)
     
 
 
 try: 
   dataFileName,baseName = args[0:2]
 except :
-  print >> sys.stderr, "Usage:", sys.argv[0],"dat-file net-base-name"
+  print >> sys.stderr, "Usage:", sys.argv[0],"dat/bin-file net-base-name"
   sys.exit(1)
   
-if verbose:
-  print "reading training data file"
+# A binary training set (see dat2bin.py) is mapped, not read
+if isTrainingSet(dataFileName) :
+  data = dataFileName
+else :
+  if verbose:
+    print "reading training data file"
   
-data = readData(dataFileName)
-
-nPos = len(data)
+  data = readData(dataFileName)
 
 # Should training ignore backgammons?
 ignoreBGs = ignoreBG or targetClass == gnubg.c_race
 
 # Third argument is true if you want to train the small pruning nets.
 # iTrain is a list of input positions to train. Part of my experiments (JH)
+# With more than one thread, training updates the net from all threads at once.
+# With -B the net is updated once per batch of positions (-m adds momentum,
+# and trains on one thread).
 #
-trainer = gnubg.trainer(data, ignoreBGs, 0, iTrain)
+trainer = gnubg.trainer(data, ignoreBGs, 0, iTrain, nThreads)
   
 del data
 
+nPos = trainer.size()
+
 alpha = alphaStart
 
 prever = 100
@@ -211,7 +227,7 @@ while 1 :
 
       cstart = time.time()
     
-    trainer.train(alpha, order)
+    trainer.train(alpha, order, None, batch, momentum)
     
     if verbose :
       nsec = time.time() - cstart
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -32,12 +33,14 @@
 #endif
 #include "positionid.h"
 #include "analysis.h"
+#include "relational.h"
 #include "sound.h"
 #include "matchequity.h"
 #include "formatgs.h"
 #include "progress.h"
 #include "multithread.h"
 #include "format.h"
+#include "glib-ext.h"
 #include "lib/simd.h"
 
 const char *aszRating[N_RATINGS] = {
@@ -89,87 +92,33 @@ LuckFirst(const TanBoard anBoard, const int n0, const int n1, cubeinfo * pci, co
 
     TanBoard anBoardTemp;
     int i, j;
-    float aar[6][6], ar[NUM_ROLLOUT_OUTPUTS], rMean = 0.0f;
+    float aar[6][6], aarOpp[6][6], rMean = 0.0f;
     cubeinfo ciOpp;
-    movelist ml;
 
     /* first with player pci->fMove on roll */
 
-    memcpy(&ciOpp, pci, sizeof(cubeinfo));
-    ciOpp.fMove = !pci->fMove;
-
-    for (i = 0; i < 6; i++)
-        for (j = 0; j < i; j++) {
-            memcpy(&anBoardTemp[0][0], &anBoard[0][0], 2 * 25 * sizeof(int));
-
-            /* Find the best move for each roll at ply 0 only. */
-            if (FindnSaveBestMoves(&ml, i + 1, j + 1, (ConstTanBoard) anBoardTemp, NULL, 0.0f,
-                                   pci, pec, defaultFilters) < 0) {
-                g_free(ml.amMoves);
-                return ERR_VAL;
-            }
-
-            if (!ml.cMoves) {
-
-                SwapSides(anBoardTemp);
-
-                if (GeneralEvaluationE(ar, (ConstTanBoard) anBoardTemp, &ciOpp, pec) < 0)
-                    return ERR_VAL;
-
-                if (pec->fCubeful) {
-                    if (pci->nMatchTo)
-                        aar[i][j] = -mwc2eq(ar[OUTPUT_CUBEFUL_EQUITY], &ciOpp);
-                    else
-                        aar[i][j] = -ar[OUTPUT_CUBEFUL_EQUITY];
-                } else
-                    aar[i][j] = -ar[OUTPUT_EQUITY];
-
-            } else {
-                aar[i][j] = ml.amMoves[0].rScore;
-                g_free(ml.amMoves);
-            }
-
-            rMean += aar[i][j];
-
-        }
+    if (ScoreRolls(aar, anBoard, pci, pec, FALSE) < 0)
+        return ERR_VAL;
 
     /* with other player on roll */
 
-    for (i = 0; i < 6; i++)
-        for (j = i + 1; j < 6; j++) {
-            memcpy(&anBoardTemp[0][0], &anBoard[0][0], 2 * 25 * sizeof(int));
-            SwapSides(anBoardTemp);
-
-            /* Find the best move for each roll at ply 0 only. */
-            if (FindnSaveBestMoves(&ml, i + 1, j + 1, (ConstTanBoard) anBoardTemp, NULL, 0.0f,
-                                   &ciOpp, pec, defaultFilters) < 0) {
-                g_free(ml.amMoves);
-                return ERR_VAL;
-            }
-
-            if (!ml.cMoves) {
-
-                SwapSides(anBoardTemp);
-
-                if (GeneralEvaluationE(ar, (ConstTanBoard) anBoardTemp, pci, pec) < 0)
-                    return ERR_VAL;
+    memcpy(&ciOpp, pci, sizeof(cubeinfo));
+    ciOpp.fMove = !pci->fMove;
 
-                if (pec->fCubeful) {
-                    if (pci->nMatchTo)
-                        aar[i][j] = mwc2eq(ar[OUTPUT_CUBEFUL_EQUITY], pci);
-                    else
-                        aar[i][j] = ar[OUTPUT_CUBEFUL_EQUITY];
-                } else
-                    aar[i][j] = ar[OUTPUT_EQUITY];
+    memcpy(&anBoardTemp[0][0], &anBoard[0][0], 2 * 25 * sizeof(int));
+    SwapSides(anBoardTemp);
 
-            } else {
-                aar[i][j] = -ml.amMoves[0].rScore;
-                g_free(ml.amMoves);
-            }
+    if (ScoreRolls(aarOpp, (ConstTanBoard) anBoardTemp, &ciOpp, pec, FALSE) < 0)
+        return ERR_VAL;
 
-            rMean += aar[i][j];
+    for (i = 0; i < 6; i++)
+        for (j = i + 1; j < 6; j++)
+            aar[i][j] = -aarOpp[j][i];
 
-        }
+    for (i = 0; i < 6; i++)
+        for (j = 0; j < 6; j++)
+            if (i != j)
+                rMean += aar[i][j];
 
     if (n0 > n1)
         return aar[n0][n1] - rMean / 30.0f;
@@ -182,50 +131,16 @@ static float
 LuckNormal(const TanBoard anBoard, const int n0, const int n1, const cubeinfo * pci, const evalcontext * pec)
 {
 
-    TanBoard anBoardTemp;
     int i, j;
-    float aar[6][6], ar[NUM_ROLLOUT_OUTPUTS], rMean = 0.0f;
-    cubeinfo ciOpp;
-    movelist ml;
+    float aar[6][6], rMean = 0.0f;
 
-    memcpy(&ciOpp, pci, sizeof(cubeinfo));
-    ciOpp.fMove = !pci->fMove;
+    if (ScoreRolls(aar, anBoard, pci, pec, TRUE) < 0)
+        return ERR_VAL;
 
     for (i = 0; i < 6; i++)
-        for (j = 0; j <= i; j++) {
-            memcpy(&anBoardTemp[0][0], &anBoard[0][0], 2 * 25 * sizeof(int));
-
-            /* Find the best move for each roll at ply 0 only. */
-            if (FindnSaveBestMoves(&ml, i + 1, j + 1, (ConstTanBoard) anBoardTemp, NULL, 0.0f,
-                                   pci, pec, defaultFilters) < 0) {
-                g_free(ml.amMoves);
-                return ERR_VAL;
-            }
-
-            if (!ml.cMoves) {
-
-                SwapSides(anBoardTemp);
-
-                if (GeneralEvaluationE(ar, (ConstTanBoard) anBoardTemp, &ciOpp, pec) < 0)
-                    return ERR_VAL;
-
-                if (pec->fCubeful) {
-                    if (pci->nMatchTo)
-                        aar[i][j] = -mwc2eq(ar[OUTPUT_CUBEFUL_EQUITY], &ciOpp);
-                    else
-                        aar[i][j] = -ar[OUTPUT_CUBEFUL_EQUITY];
-                } else
-                    aar[i][j] = -ar[OUTPUT_EQUITY];
-
-            } else {
-                aar[i][j] = ml.amMoves[0].rScore;
-                g_free(ml.amMoves);
-            }
-
+        for (j = 0; j <= i; j++)
             rMean += (i == j) ? aar[i][j] : aar[i][j] * 2.0f;
 
-        }
-
     return aar[n0][n1] - rMean / 36.0f;
 
 }
@@ -657,7 +572,9 @@ AnalyzeMove(moverecord * pmr, matchstate * pms, const listOLD * plParentGame,
         } else
             pmr->CubeDecPtr->esDouble.et = EVAL_NONE;
 
-        /* luck analysis */
+        /* luck analysis; this leaves the 0-ply evaluations of the
+         * candidates for the roll played in the cache, where the first
+         * pass of the move analysis below finds them */
 
         if (fAnalyseDice) {
             pmr->rLuck = LuckAnalysis((ConstTanBoard) pms->anBoard, pmr->anDice[0], pmr->anDice[1], pms);
@@ -1234,6 +1151,472 @@ CommandAnalyseSession(char *sz)
 }
 
 
+/* Batch analysis: the matches found in a directory (or matching a pattern) are imported one after
+ * the other, as the parsers are not reentrant, and analysed a window of several at a time: the
+ * moves of every match of the window are queued together, so that the threads are kept busy to the
+ * end of the window and all of them share the evaluation cache. Each match is then saved as SGF
+ * (and added to the database if asked), and its file recorded in a manifest in the output folder,
+ * so that an interrupted batch can be started again and resumes where it stopped. A file is "ok"
+ * in the manifest once its SGF file is written and, with a database, its match committed; the
+ * files that failed are tried again when the batch is resumed. */
+
+#define BATCH_MANIFEST "gnubg-batch.manifest"
+
+typedef struct {
+    gchar *szFile;
+    gchar *szSGF;               /* where it is saved */
+    listOLD lMatch;             /* the games, detached from the global match */
+    matchinfo mi;
+    matchstate ms;
+    char aszName[2][MAX_NAME_LEN];
+} batchmatch;
+
+static GList *
+BatchFiles(const char *sz)
+/* The files of the directory sz, or matching the pattern sz, in alphabetical order */
+{
+    gchar *szDir, *szPattern;
+    GDir *pd;
+    const gchar *szName;
+    GList *pl = NULL;
+
+    if (g_file_test(sz, G_FILE_TEST_IS_DIR)) {
+        szDir = g_strdup(sz);
+        szPattern = g_strdup("*");
+    } else {
+        szDir = g_path_get_dirname(sz);
+        szPattern = g_path_get_basename(sz);
+    }
+
+    if ((pd = g_dir_open(szDir, 0, NULL)) != NULL) {
+        while ((szName = g_dir_read_name(pd)) != NULL) {
+            gchar *szFile;
+
+            if (!strcmp(szName, BATCH_MANIFEST) || !g_pattern_match_simple(szPattern, szName))
+                continue;
+
+            szFile = g_build_filename(szDir, szName, NULL);
+            if (g_file_test(szFile, G_FILE_TEST_IS_REGULAR))
+                pl = g_list_prepend(pl, szFile);
+            else
+                g_free(szFile);
+        }
+        g_dir_close(pd);
+    }
+
+    g_free(szDir);
+    g_free(szPattern);
+
+    return g_list_sort(pl, (GCompareFunc) strcmp);
+}
+
+static gchar *
+BatchStem(const char *szFile)
+/* The name of szFile without its folder and extension */
+{
+    gchar *szBase = g_path_get_basename(szFile);
+    char *pch = strrchr(szBase, '.');
+
+    if (pch)
+        *pch = 0;
+
+    return szBase;
+}
+
+static GHashTable *
+BatchClashes(GList * plFiles)
+/* The names without extension shared by several files, such as a.mat and a.txt */
+{
+    GHashTable *phSeen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTable *phClash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GList *pl;
+
+    for (pl = plFiles; pl; pl = pl->next) {
+        gchar *szStem = BatchStem((const char *) pl->data);
+
+        if (g_hash_table_lookup(phSeen, szStem))
+            g_hash_table_insert(phClash, szStem, szStem);
+        else
+            g_hash_table_insert(phSeen, szStem, szStem);
+    }
+
+    g_hash_table_destroy(phSeen);
+
+    return phClash;
+}
+
+static gchar *
+BatchSGF(const char *szFile, const char *szOutput, GHashTable * phClash)
+/* The SGF file of szFile: its name with .sgf for extension, or with .sgf added
+ * if another file has the same name with another extension */
+{
+    gchar *szStem = BatchStem(szFile);
+    gchar *sz, *szSGF;
+
+    if (g_hash_table_lookup(phClash, szStem)) {
+        gchar *szBase = g_path_get_basename(szFile);
+
+        sz = g_strconcat(szBase, ".sgf", NULL);
+        g_free(szBase);
+    } else
+        sz = g_strconcat(szStem, ".sgf", NULL);
+
+    szSGF = g_build_filename(szOutput, sz, NULL);
+    g_free(sz);
+    g_free(szStem);
+
+    return szSGF;
+}
+
+static GHashTable *
+ReadBatchManifest(const char *szManifest)
+/* The files done by a previous run; a later line for the same file overrides an earlier one */
+{
+    GHashTable *ph = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    FILE *pf;
+    char sz[4096];
+
+    if ((pf = g_fopen(szManifest, "r")) == NULL)
+        return ph;
+
+    while (fgets(sz, sizeof(sz), pf)) {
+        char *pch = strchr(sz, '\t');
+
+        if (pch) {
+            *pch++ = 0;
+            g_strchomp(pch);
+            if (!strcmp(pch, "ok")) {
+                gchar *szFile = g_strdup(sz);
+
+                g_hash_table_insert(ph, szFile, szFile);
+            } else
+                g_hash_table_remove(ph, sz);
+        }
+    }
+
+    fclose(pf);
+
+    return ph;
+}
+
+static void
+WriteBatchManifest(FILE * pf, const char *szFile, const char *szStatus)
+{
+    if (!pf)
+        return;
+
+    fprintf(pf, "%s\t%s\n", szFile, szStatus);
+    fflush(pf);
+}
+
+static void
+DetachMatch(batchmatch * pbm)
+/* Moves the match just imported out of the globals, so that the next one can be imported */
+{
+    int i;
+
+    pbm->lMatch = lMatch;
+    pbm->lMatch.plNext->plPrev = pbm->lMatch.plPrev->plNext = &pbm->lMatch;
+    ListCreate(&lMatch);
+
+    pbm->mi = mi;
+    memset(&mi, 0, sizeof(mi));         /* the strings now belong to pbm */
+    pbm->ms = ms;
+    for (i = 0; i < 2; ++i)
+        strcpy(pbm->aszName[i], ap[i].szName);
+
+#if defined(USE_GTK)
+    if (fX) {
+        GTKClearMoveRecord();
+        GTKPopGame(0);
+    }
+#endif
+
+    ClearMatch();
+    plGame = plLastMove = NULL;
+}
+
+static void
+AttachMatch(batchmatch * pbm)
+/* Makes it the current match again, for saving it */
+{
+    listOLD *pl;
+    int i;
+
+    lMatch = pbm->lMatch;
+    lMatch.plNext->plPrev = lMatch.plPrev->plNext = &lMatch;
+    ListCreate(&pbm->lMatch);
+
+    mi = pbm->mi;
+    ms = pbm->ms;
+    for (i = 0; i < 2; ++i)
+        strcpy(ap[i].szName, pbm->aszName[i]);
+
+    plGame = lMatch.plPrev->p;
+    plLastMove = plGame->plPrev;
+
+    IniStatcontext(&scMatch);
+    for (pl = lMatch.plNext; pl != &lMatch; pl = pl->plNext) {
+        moverecord *pmr = (moverecord *) ((listOLD *) pl->p)->plNext->p;
+
+        g_assert(pmr->mt == MOVE_GAMEINFO);
+        AddStatcontext(&pmr->g.sc, &scMatch);
+    }
+}
+
+static void
+FreeBatchMatch(batchmatch * pbm)
+{
+    if (!ListEmpty(&pbm->lMatch)) {
+        AttachMatch(pbm);
+        FreeMatch();
+        ClearMatch();
+        plGame = plLastMove = NULL;
+    }
+    g_free(pbm->szFile);
+    g_free(pbm->szSGF);
+    g_free(pbm);
+}
+
+static int
+SaveBatchMatch(batchmatch * pbm, const int fDatabase)
+/* Saves the current match, and adds it to the database if asked. Returns 0 if both are done. */
+{
+    gchar *sz = g_strdup_printf("\"%s\"", pbm->szSGF);
+    int result = 0;
+
+    /* CommandSaveMatch() says nothing to the caller: see if the file is there afterwards */
+    g_unlink(pbm->szSGF);
+    CommandSaveMatch(sz);
+    g_free(sz);
+
+    if (!g_file_test(pbm->szSGF, G_FILE_TEST_IS_REGULAR)) {
+        outputf(_("%s could not be saved to %s.\n"), pbm->szFile, pbm->szSGF);
+        result = -1;
+    } else if (fDatabase && RelationalAddMatch(TRUE) < 0) {
+        outputf(_("%s could not be added to the database.\n"), pbm->szFile);
+        result = -1;
+    }
+
+    return result;
+}
+
+static int
+AnalyseBatchWindow(GList * plWindow, const int fDatabase, FILE * pfManifest, int *pcFailed)
+/* Analyses the matches of plWindow together, then saves them one after the other.
+ * Returns the number of matches saved, or -1 if interrupted. */
+{
+    GList *pl;
+    listOLD *plg;
+    int nMoves = 0;
+    int result = 0;
+    int cSaved = 0;
+
+    for (pl = plWindow; pl; pl = pl->next)
+        nMoves += NumberMovesMatch(&((batchmatch *) pl->data)->lMatch);
+
+    ProgressStartValue(_("Analysing matches; move:"), nMoves);
+
+    for (pl = plWindow; pl && !result; pl = pl->next) {
+        batchmatch *pbm = (batchmatch *) pl->data;
+
+        for (plg = pbm->lMatch.plNext; plg != &pbm->lMatch; plg = plg->plNext)
+            if (AnalyzeGame(plg->p, FALSE) < 0) {
+                result = -1;
+                break;
+            }
+    }
+
+    multi_debug("wait for all task: batch analysis");
+    if (MT_WaitForTasks(UpdateProgressBar, 250, FALSE) < 0 || fInterrupt)
+        result = -1;
+
+    ProgressEnd();
+
+    if (result < 0)
+        return -1;
+
+    /* One database connection for the window, each match is still committed on its own */
+    if (fDatabase)
+        RelationalBatchStart();
+
+    for (pl = plWindow; pl; pl = pl->next) {
+        batchmatch *pbm = (batchmatch *) pl->data;
+
+        AttachMatch(pbm);
+
+        if (SaveBatchMatch(pbm, fDatabase) < 0) {
+            WriteBatchManifest(pfManifest, pbm->szFile, "failed");
+            (*pcFailed)++;
+        } else {
+            WriteBatchManifest(pfManifest, pbm->szFile, "ok");
+            cSaved++;
+        }
+
+        FreeMatch();
+        ClearMatch();
+        plGame = plLastMove = NULL;
+    }
+
+    if (fDatabase)
+        RelationalBatchEnd();
+
+    return cSaved;
+}
+
+static int
+RunBatchWindow(GList ** pplWindow, const int fDatabase, FILE * pfManifest,
+               int *pcDone, int *pcFailed, const double rStart)
+{
+    int cSaved;
+
+    if ((cSaved = AnalyseBatchWindow(*pplWindow, fDatabase, pfManifest, pcFailed)) < 0)
+        return -1;
+
+    *pcDone += cSaved;
+    outputf(_("%d matches analysed (%.1f matches per hour)\n"),
+            *pcDone, *pcDone * 3600000.0 / MAX(get_time() - rStart, 1.0));
+
+    g_list_free_full(*pplWindow, (GDestroyNotify) FreeBatchMatch);
+    *pplWindow = NULL;
+
+    return 0;
+}
+
+extern void
+CommandAnalyseBatch(char *sz)
+{
+    char *szFiles = NextToken(&sz);
+    char *szOutput = NULL;
+    char *pch;
+    int fDatabase = FALSE;
+    gchar *szFolder, *szManifest;
+    GList *plFiles, *pl;
+    GList *plWindow = NULL;
+    GHashTable *phDone, *phClash;
+    FILE *pfManifest;
+    int nWindow, cWindow = 0;
+    int cDone = 0, cFailed = 0, cSkipped = 0;
+    int fStoreConfirmSave = fConfirmSave;
+    double rStart;
+
+    if (!szFiles || !*szFiles) {
+        outputl(_("You must specify a directory or a pattern (see `help analyse batch')."));
+        return;
+    }
+
+    while ((pch = NextToken(&sz)) != NULL) {
+        if (!g_ascii_strcasecmp(pch, "database"))
+            fDatabase = TRUE;
+        else
+            szOutput = pch;
+    }
+
+    if (CheckSettings())
+        return;
+
+    plFiles = BatchFiles(szFiles);
+    if (!plFiles) {
+        outputf(_("No files found in `%s'.\n"), szFiles);
+        return;
+    }
+
+    if (szOutput)
+        szFolder = g_strdup(szOutput);
+    else if (g_file_test(szFiles, G_FILE_TEST_IS_DIR))
+        szFolder = g_strdup(szFiles);
+    else
+        szFolder = g_path_get_dirname(szFiles);
+
+    if (!g_file_test(szFolder, G_FILE_TEST_IS_DIR)) {
+        outputf(_("The folder `%s' doesn't exist.\n"), szFolder);
+        g_list_free_full(plFiles, g_free);
+        g_free(szFolder);
+        return;
+    }
+
+    if (!get_input_discard()) {
+        g_list_free_full(plFiles, g_free);
+        g_free(szFolder);
+        return;
+    }
+
+#if defined(USE_GTK)
+    if (fX)
+        GTKClearMoveRecord();
+#endif
+    FreeMatch();
+    ClearMatch();
+    plGame = plLastMove = NULL;
+
+    szManifest = g_build_filename(szFolder, BATCH_MANIFEST, NULL);
+    phDone = ReadBatchManifest(szManifest);
+    phClash = BatchClashes(plFiles);
+    if ((pfManifest = g_fopen(szManifest, "a")) == NULL)
+        outputerr(szManifest);
+
+    /* enough matches in flight to keep all the threads busy, few enough to bound the memory */
+    nWindow = MAX(2, 2 * (int) MT_GetNumThreads());
+
+    fConfirmSave = FALSE;
+    rStart = get_time();
+
+    for (pl = plFiles; pl && !fInterrupt; pl = pl->next) {
+        const char *szFile = (const char *) pl->data;
+        batchmatch *pbm;
+        gchar *szImport;
+
+        if (g_hash_table_lookup(phDone, szFile)) {
+            cSkipped++;
+            continue;
+        }
+
+        szImport = g_strdup_printf("\"%s\"", szFile);
+        CommandImportAuto(szImport);
+        g_free(szImport);
+
+        if (ListEmpty(&lMatch)) {
+            WriteBatchManifest(pfManifest, szFile, "failed");
+            cFailed++;
+            continue;
+        }
+
+        pbm = g_new0(batchmatch, 1);
+        pbm->szFile = g_strdup(szFile);
+        pbm->szSGF = BatchSGF(szFile, szFolder, phClash);
+        DetachMatch(pbm);
+        plWindow = g_list_append(plWindow, pbm);
+
+        if (++cWindow == nWindow) {
+            if (RunBatchWindow(&plWindow, fDatabase, pfManifest, &cDone, &cFailed, rStart) < 0)
+                break;
+            cWindow = 0;
+        }
+    }
+
+    if (plWindow && !fInterrupt && !pl)
+        RunBatchWindow(&plWindow, fDatabase, pfManifest, &cDone, &cFailed, rStart);
+
+    /* what is left was interrupted */
+    g_list_free_full(plWindow, (GDestroyNotify) FreeBatchMatch);
+
+    fConfirmSave = fStoreConfirmSave;
+
+    outputf(_("Batch analysis: %d matches analysed, %d files failed, %d already done.\n"),
+            cDone, cFailed, cSkipped);
+
+    if (pfManifest)
+        fclose(pfManifest);
+    g_hash_table_destroy(phDone);
+    g_hash_table_destroy(phClash);
+    g_free(szManifest);
+    g_free(szFolder);
+    g_list_free_full(plFiles, g_free);
+
+    playSound(SOUND_ANALYSIS_FINISHED);
+}
+
+
 
 extern void
 IniStatcontext(statcontext * psc)
@@ -511,6 +511,7 @@ extern void UpdateSettings(void);
 extern void UpdateSetting(void *p);
 extern void CommandAccept(char *);
 extern void CommandAgree(char *);
+extern void CommandAnalyseBatch(char *);
 extern void CommandAnalyseClearGame(char *);
 extern void CommandAnalyseClearMatch(char *);
 extern void CommandAnalyseClearMove(char *);
@@ -709,6 +710,8 @@ extern void CommandSetEvalParamRollout(char *);
 extern void CommandSetEvalParamType(char *);
 extern void CommandSetEvalPlies(char *);
 extern void CommandSetEvalPrune(char *);
+extern void CommandSetEvalQuantized(char *);
+extern void CommandSetEvalTime(char *);
 extern void CommandSetEvalSameAsAnalysis(char *);
 extern void CommandSetExportCubeDisplayActual(char *);
 extern void CommandSetExportCubeDisplayBad(char *);
@@ -781,6 +784,8 @@ extern void CommandSetGUIUseStatsPanel(char *);
 extern void CommandSetGUIWindowPositions(char *);
 extern void CommandSetImportFolder(char *);
 extern void CommandSetInvertMatchEquityTable(char *);
+extern void CommandSetIterativeMoveGen(char *);
+extern void CommandSetPersistentCache(char *);
 extern void CommandSetJacoby(char *);
 extern void CommandSetLang(char *);
 extern void CommandSetMatchAnnotator(char *);
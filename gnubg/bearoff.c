@@ -256,22 +256,38 @@ HeuristicDatabase(void (*pfProgress) (unsigned int))
 }
 
 
+/*
+ * Read nBytes at offset from a database that is not mapped in memory.
+ *
+ * Where pread() is available, it is used on the descriptor of the
+ * already opened file: it doesn't use or move the shared file
+ * position, so concurrent lookups from several threads need no lock.
+ * Otherwise fseek() + fread() are serialised with MT_Exclusive().
+ */
+
 static void
 ReadBearoffFile(const bearoffcontext * pbc, unsigned int offset, unsigned char *buf, unsigned int nBytes)
 {
+    int fOK;
+
+#if defined(HAVE_UNISTD_H) && !defined(WIN32)
+    fOK = pread(fileno(pbc->pf), buf, nBytes, (off_t) offset) == (ssize_t) nBytes;
+#else
     MT_Exclusive();
 
-    if ((fseek(pbc->pf, (long) offset, SEEK_SET) < 0) || (fread(buf, 1, nBytes, pbc->pf) < nBytes)) {
+    fOK = (fseek(pbc->pf, (long) offset, SEEK_SET) == 0) && (fread(buf, 1, nBytes, pbc->pf) == nBytes);
+
+    MT_Release();
+#endif
+
+    if (!fOK) {
         if (errno)
             perror(_("bearoff database"));
         else
             fprintf(stderr, _("Error reading bearoff database"));
 
         memset(buf, 0, nBytes);
-        return;
     }
-
-    MT_Release();
 }
 
 /* BEAROFF_GNUBG: read two sided bearoff database */
@@ -43,7 +43,9 @@ static int PyMySQLConnect(const char *dbfilename, const char *user, const char *
 static void PyDisconnect(void);
 static RowSet *PySelect(const char *str);
 static int PyUpdateCommand(const char *str);
-static void PyCommit(void);
+static int PyUpdateCommandArgs(const char *str, int n, const char *const *args);
+static int PyCommit(void);
+static void PyRollback(void);
 static int PyPostgreConnect(const char *dbfilename, const char *user, const char *password, const char *hostname);
 static GList *PyPostgreGetDatabaseList(const char *user, const char *password, const char *hostname);
 static int PyPostgreDeleteDatabase(const char *dbfilename, const char *user, const char *password,
@@ -56,7 +58,9 @@ static int SQLiteConnect(const char *dbfilename, const char *user, const char *p
 static void SQLiteDisconnect(void);
 static RowSet *SQLiteSelect(const char *str);
 static int SQLiteUpdateCommand(const char *str);
-static void SQLiteCommit(void);
+static int SQLiteUpdateCommandArgs(const char *str, int n, const char *const *args);
+static int SQLiteCommit(void);
+static void SQLiteRollback(void);
 #endif
 
 #if NUM_PROVIDERS
@@ -64,28 +68,30 @@ static int SQLiteDeleteDatabase(const char *dbfilename, const char *user, const
 static GList *SQLiteGetDatabaseList(const char *user, const char *password, const char *hostname);
 static DBProvider providers[NUM_PROVIDERS] = {
 #if defined(USE_SQLITE)
-    {SQLiteConnect, SQLiteDisconnect, SQLiteSelect, SQLiteUpdateCommand, SQLiteCommit, SQLiteGetDatabaseList,
-     SQLiteDeleteDatabase,
+    {SQLiteConnect, SQLiteDisconnect, SQLiteSelect, SQLiteUpdateCommand, SQLiteUpdateCommandArgs, SQLiteCommit,
+     SQLiteRollback, SQLiteGetDatabaseList, SQLiteDeleteDatabase,
      "SQLite", "SQLite", N_("Direct SQLite3 connection"), FALSE, TRUE, "gnubg", "", "", ""},
 #endif
 #if defined(USE_PYTHON)
 #if !defined(USE_SQLITE)
-    {PySQLiteConnect, PyDisconnect, PySelect, PyUpdateCommand, PyCommit, SQLiteGetDatabaseList, SQLiteDeleteDatabase,
+    {PySQLiteConnect, PyDisconnect, PySelect, PyUpdateCommand, PyUpdateCommandArgs, PyCommit, PyRollback,
+     SQLiteGetDatabaseList, SQLiteDeleteDatabase,
      "SQLite (Python)", "PythonSQLite", N_("SQLite3 connection via Python"), FALSE, TRUE, "gnubg",
      "", "", ""},
 #endif
-    {PyMySQLConnect, PyDisconnect, PySelect, PyUpdateCommand, PyCommit, PyMySQLGetDatabaseList, PyMySQLDeleteDatabase,
+    {PyMySQLConnect, PyDisconnect, PySelect, PyUpdateCommand, PyUpdateCommandArgs, PyCommit, PyRollback,
+     PyMySQLGetDatabaseList, PyMySQLDeleteDatabase,
      "MySQL (Python)", "PythonMySQL", N_("MySQL/MariaDB connection via MySQLdb Python module"), TRUE, TRUE, "gnubg", "", "",
      "localhost:3306"},
-    {PyPostgreConnect, PyDisconnect, PySelect, PyUpdateCommand, PyCommit, PyPostgreGetDatabaseList,
-     PyPostgreDeleteDatabase,
+    {PyPostgreConnect, PyDisconnect, PySelect, PyUpdateCommand, PyUpdateCommandArgs, PyCommit, PyRollback,
+     PyPostgreGetDatabaseList, PyPostgreDeleteDatabase,
      "PostgreSQL (Python)", "PythonPostgre", N_("PostgreSQL connection via PyGreSQL Python module"), TRUE, TRUE, "gnubg", "",
      "", "localhost:5432"},
 #endif
 };
 
 #else
-DBProvider providers[1] = { {0, 0, 0, 0, 0, 0, 0, "No Providers", "No Providers", N_("No database providers"), 0, 0, 0, 0, 0, 0} };
+DBProvider providers[1] = { {0, 0, 0, 0, 0, 0, 0, 0, 0, "No Providers", "No Providers", N_("No database providers"), 0, 0, 0, 0, 0, 0} };
 #endif
 
 #if defined(USE_PYTHON) || defined(USE_SQLITE)
@@ -402,10 +408,53 @@ PyUpdateCommand(const char *str)
         return TRUE;
 }
 
-static void
+static int
+PyUpdateCommandArgs(const char *str, int n, const char *const *args)
+{
+    PyObject *func = PyDict_GetItemString(pdict, "PyUpdateCommandArgs");
+    PyObject *values, *ret;
+    int i;
+
+    if (!func) {
+        outputerrf(_("Error running database command"));
+        return FALSE;
+    }
+
+    values = PyTuple_New(n);
+    for (i = 0; i < n; i++) {
+        PyObject *v = args[i] ? PyUnicode_FromString(args[i]) : (Py_INCREF(Py_None), Py_None);
+        PyTuple_SET_ITEM(values, i, v);
+    }
+
+    /* Run update, the module's driver binds the values */
+    ret = PyObject_CallFunction(func, "sO", str, values);
+    Py_DECREF(values);
+    if (!ret) {
+        PyErr_Print();
+        return FALSE;
+    }
+    Py_DECREF(ret);
+    return TRUE;
+}
+
+static int
 PyCommit(void)
 {
-    if (!PyRun_String("PyCommit()", Py_eval_input, pdict, pdict))
+    PyObject *ret = PyRun_String("PyCommit()", Py_eval_input, pdict, pdict);
+
+    if (!ret) {
+        PyErr_Print();
+        return FALSE;
+    }
+
+    Py_DECREF(ret);
+    return TRUE;
+}
+
+static void
+PyRollback(void)
+{
+    if (!PyRun_String("PyRollback()", Py_eval_input, pdict, pdict))
         PyErr_Print();
 }
 
@@ -565,6 +614,14 @@ PyPostgreDeleteDatabase(const char *dbfilename, const char *user, const char *pa
 #include <sqlite3.h>
 
 static sqlite3 *connection;
+static int fTransaction;        /* updates since the last commit are in a transaction */
+static GHashTable *statements;  /* prepared statements of SQLiteUpdateCommandArgs(), by SQL text */
+
+static void
+FinalizeStatement(gpointer p)
+{
+    sqlite3_finalize((sqlite3_stmt *) p);
+}
 
 int
 SQLiteConnect(const char *dbfilename, const char *UNUSED(user), const char *UNUSED(password),
@@ -582,19 +639,57 @@ SQLiteConnect(const char *dbfilename, const char *UNUSED(user), const char *UNUS
     g_free(name);
     g_free(filename);
 
-    if (ret == SQLITE_OK)
-        return exists ? 1 : 0;
-    else
+    if (ret != SQLITE_OK)
         return -1;
+
+    /* With a write-ahead log a commit appends to the log instead of
+     * syncing the database, and readers do not block the writer */
+    sqlite3_exec(connection, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+    sqlite3_exec(connection, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
+
+    fTransaction = FALSE;
+    statements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, FinalizeStatement);
+
+    return exists ? 1 : 0;
 }
 
 static void
 SQLiteDisconnect(void)
 {
+    /* As with the other providers, changes not committed are lost */
+    if (fTransaction)
+        SQLiteRollback();
+
+    if (statements) {
+        g_hash_table_destroy(statements);
+        statements = NULL;
+    }
+
     if (sqlite3_close(connection) != SQLITE_OK)
         outputerrf("SQL error: %s in sqlite3_close()", sqlite3_errmsg(connection));
 }
 
+static int
+SQLiteTransaction(const char *str)
+{
+    char *zErrMsg;
+    int ret = sqlite3_exec(connection, str, NULL, NULL, &zErrMsg);
+    if (ret != SQLITE_OK) {
+        outputerrf("SQL error: %s\nfrom '%s'", zErrMsg, str);
+        sqlite3_free(zErrMsg);
+    }
+    return (ret == SQLITE_OK);
+}
+
+static int
+SQLiteBegin(void)
+{                               /* Group the updates until the next commit */
+    if (!fTransaction)
+        fTransaction = SQLiteTransaction("BEGIN");
+
+    return fTransaction;
+}
+
 RowSet *
 SQLiteSelect(const char *str)
 {
@@ -650,7 +745,12 @@ int
 SQLiteUpdateCommand(const char *str)
 {
     char *zErrMsg;
-    int ret = sqlite3_exec(connection, str, NULL, NULL, &zErrMsg);
+    int ret;
+
+    if (!SQLiteBegin())
+        return FALSE;
+
+    ret = sqlite3_exec(connection, str, NULL, NULL, &zErrMsg);
     if (ret != SQLITE_OK) {
         outputerrf("SQL error: %s\nfrom '%s'", zErrMsg, str);
         sqlite3_free(zErrMsg);
@@ -658,9 +758,68 @@ SQLiteUpdateCommand(const char *str)
     return (ret == SQLITE_OK);
 }
 
-static void
+static int
+SQLiteUpdateCommandArgs(const char *str, int n, const char *const *args)
+{
+    sqlite3_stmt *pStmt = g_hash_table_lookup(statements, str);
+    int i, ret;
+
+    if (!SQLiteBegin())
+        return FALSE;
+
+    if (!pStmt) {
+#if SQLITE_VERSION_NUMBER >= 3003011
+        ret = sqlite3_prepare_v2(connection, str, -1, &pStmt, NULL);
+#else
+        ret = sqlite3_prepare(connection, str, -1, &pStmt, NULL);
+#endif
+        if (ret != SQLITE_OK) {
+            outputerrf("SQL error: %s\nfrom '%s'", sqlite3_errmsg(connection), str);
+            return FALSE;
+        }
+        g_hash_table_insert(statements, g_strdup(str), pStmt);
+    }
+
+    /* The values are bound as text, which the column types convert as
+     * they did the quoted values of UpdateCommand() */
+    for (i = 0; i < n; i++) {
+        if (args[i])
+            sqlite3_bind_text(pStmt, i + 1, args[i], -1, SQLITE_STATIC);
+        else
+            sqlite3_bind_null(pStmt, i + 1);
+    }
+
+    ret = sqlite3_step(pStmt);
+    if (ret != SQLITE_DONE)
+        outputerrf("SQL error: %s\nfrom '%s'", sqlite3_errmsg(connection), str);
+
+    sqlite3_reset(pStmt);
+    sqlite3_clear_bindings(pStmt);
+
+    return (ret == SQLITE_DONE);
+}
+
+static int
 SQLiteCommit(void)
-{                               /* No transaction in sqlite by default */
+{
+    int ret = TRUE;
+
+    if (fTransaction) {
+        if (!(ret = SQLiteTransaction("COMMIT")))
+            SQLiteTransaction("ROLLBACK");
+        fTransaction = FALSE;
+    }
+
+    return ret;
+}
+
+static void
+SQLiteRollback(void)
+{
+    if (fTransaction) {
+        SQLiteTransaction("ROLLBACK");
+        fTransaction = FALSE;
+    }
 }
 #endif
 
@@ -696,6 +855,16 @@ SQLiteDeleteDatabase(const char *dbfilename, const char *UNUSED(user), const cha
     /* Delete database file */
     ret = g_unlink(filename);
 
+    /* and the write-ahead log, if left behind */
+    if (ret == 0) {
+        char *log = g_strdup_printf("%s-wal", filename);
+        g_unlink(log);
+        g_free(log);
+        log = g_strdup_printf("%s-shm", filename);
+        g_unlink(log);
+        g_free(log);
+    }
+
     g_free(filename);
     g_free(name);
     return (ret == 0);
@@ -36,7 +36,10 @@ typedef struct {
     void (*Disconnect) (void);
     RowSet *(*Select) (const char *str);
     int (*UpdateCommand) (const char *str);
-    void (*Commit) (void);
+    /* As UpdateCommand, with the n values (as text, NULL for NULL) bound to the '?' in str */
+    int (*UpdateCommandArgs) (const char *str, int n, const char *const *args);
+    int (*Commit) (void);      /* TRUE if the updates are committed */
+    void (*Rollback) (void);
     GList *(*GetDatabaseList) (const char *user, const char *password, const char *hostname);
     int (*DeleteDatabase) (const char *database, const char *user, const char *password, const char *hostname);
 
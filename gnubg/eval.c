@@ -202,6 +202,7 @@ f_FindnSaveBestMoves FindnSaveBestMoves = FindnSaveBestMovesNoLocking;
 f_FindBestMove FindBestMove = FindBestMoveNoLocking;
 f_EvaluatePosition EvaluatePosition = EvaluatePositionNoLocking;
 f_ScoreMove ScoreMove = ScoreMoveNoLocking;
+f_ScoreRolls ScoreRolls = ScoreRollsNoLocking;
 f_GeneralCubeDecisionE GeneralCubeDecisionE = GeneralCubeDecisionENoLocking;
 f_GeneralEvaluationE GeneralEvaluationE = GeneralEvaluationENoLocking;
 
@@ -209,6 +210,7 @@ f_GeneralEvaluationE GeneralEvaluationE = GeneralEvaluationENoLocking;
 #define FindBestMove FindBestMoveNoLocking
 #define EvaluatePosition EvaluatePositionNoLocking
 #define ScoreMove ScoreMoveNoLocking
+#define ScoreRolls ScoreRollsNoLocking
 #define GeneralCubeDecisionE GeneralCubeDecisionENoLocking
 #define GeneralEvaluationE GeneralEvaluationENoLocking
 #define EvaluatePositionCache EvaluatePositionCacheNoLocking
@@ -217,6 +219,7 @@ f_GeneralEvaluationE GeneralEvaluationE = GeneralEvaluationENoLocking;
 #define EvaluatePositionCubeful3 EvaluatePositionCubeful3NoLocking
 #define ScoreMoves ScoreMovesNoLocking
 #define ScoreMovesPruned ScoreMovesPrunedNoLocking
+#define ScoreMovesBatch ScoreMovesBatchNoLocking
 #define FindBestMoveInEval FindBestMoveInEvalNoLocking
 #define GeneralEvaluationEPliedCubeful GeneralEvaluationEPliedCubefulNoLocking
 #define EvaluatePositionCubeful4 EvaluatePositionCubeful4NoLocking
@@ -247,8 +250,10 @@ bearoffcontext *apbcHyper[3] = { NULL, NULL, NULL };
 
 evalCache cEval;
 evalCache cpEval;
+persistCache cPersist;
 unsigned int cCache;
 int fInterrupt = FALSE;
+int fIterativeMoveGen = TRUE;
 int fMatchCancelled = FALSE;
 
 /* variation of backgammon used by gnubg */
@@ -512,6 +517,7 @@ EvalShutdown(void)
 
     CacheDestroy(&cEval);
     CacheDestroy(&cpEval);
+    PersistCacheClose(&cPersist);
 
     return 0;
 
@@ -1425,7 +1431,7 @@ CalculateHalfInputs(const unsigned int anBoard[25], const unsigned int anBoardOp
 }
 
 
-static void
+extern void
 CalculateRaceInputs(const TanBoard anBoard, float inputs[])
 {
     unsigned int side;
@@ -1538,7 +1544,7 @@ menOffNonCrashed(const unsigned int *anBoard, float *afInput)
 
 /* Calculates contact neural net inputs from the board position. */
 
-static void
+extern void
 CalculateContactInputs(const TanBoard anBoard, float arInput[])
 {
     baseInputs(anBoard, arInput);
@@ -1563,7 +1569,7 @@ CalculateContactInputs(const TanBoard anBoard, float arInput[])
 
 /* Calculates crashed neural net inputs from the board position. */
 
-static void
+extern void
 CalculateCrashedInputs(const TanBoard anBoard, float arInput[])
 {
     baseInputs(anBoard, arInput);
@@ -2153,6 +2159,57 @@ EvalCrashed(const TanBoard anBoard, float arOutput[], const bgvariation UNUSED(b
 #endif
 }
 
+/* EvalRace(), EvalContact() and EvalCrashed() with the quantized nets */
+
+static int
+EvaluateQuantized(const neuralnet * pnn, const float arInput[], float arOutput[])
+{
+#if defined(USE_SIMD_INSTRUCTIONS)
+    return NeuralNetEvaluateQuantizedSSE(pnn, arInput, arOutput);
+#else
+    return NeuralNetEvaluateQuantized(pnn, arInput, arOutput);
+#endif
+}
+
+static int
+EvalRaceQuantized(const TanBoard anBoard, float arOutput[], const bgvariation bgv, NNState * UNUSED(nnStates))
+{
+    SSE_ALIGN(float arInput[NUM_RACE_INPUTS]);
+
+    CalculateRaceInputs(anBoard, arInput);
+
+    if (EvaluateQuantized(&nnRace, arInput, arOutput))
+        return -1;
+
+    /* special evaluation of backgammons overrides net output */
+
+    EvalRaceBG(anBoard, arOutput, bgv);
+
+    return 0;
+}
+
+static int
+EvalContactQuantized(const TanBoard anBoard, float arOutput[], const bgvariation UNUSED(bgv),
+                     NNState * UNUSED(nnStates))
+{
+    SSE_ALIGN(float arInput[NUM_INPUTS]);
+
+    CalculateContactInputs(anBoard, arInput);
+
+    return EvaluateQuantized(&nnContact, arInput, arOutput);
+}
+
+static int
+EvalCrashedQuantized(const TanBoard anBoard, float arOutput[], const bgvariation UNUSED(bgv),
+                     NNState * UNUSED(nnStates))
+{
+    SSE_ALIGN(float arInput[NUM_INPUTS]);
+
+    CalculateCrashedInputs(anBoard, arInput);
+
+    return EvaluateQuantized(&nnCrashed, arInput, arOutput);
+}
+
 extern int
 EvalOver(const TanBoard anBoard, float arOutput[], const bgvariation bgv, NNState * UNUSED(nnStates))
 {
@@ -2240,6 +2297,17 @@ classevalfunc acef[N_CLASSES] = {
     EvalRace, EvalCrashed, EvalContact
 };
 
+/* for evaluation contexts with fQuantized */
+classevalfunc acefQuantized[N_CLASSES] = {
+    EvalOver,
+    EvalHypergammon1,
+    EvalHypergammon2,
+    EvalHypergammon3,
+    EvalBearoff2, EvalBearoffTS,
+    EvalBearoff1, EvalBearoffOS,
+    EvalRaceQuantized, EvalCrashedQuantized, EvalContactQuantized
+};
+
 extern float
 Noise(const evalcontext * pec, const TanBoard anBoard, int iOutput)
 {
@@ -2311,9 +2379,10 @@ EvalKey(const evalcontext * pec, const int nPlies, const cubeinfo * pci, int fCu
      * Bit 25   : fCrawford
      * Bit 26   : fJacoby
      * Bit 27   : fBeavers
+     * Bit 28   : fQuantized
      */
 
-    iKey = (nPlies | (pec->fCubeful << 4) | (pci->fMove << 5));
+    iKey = (nPlies | (pec->fCubeful << 4) | (pci->fMove << 5) | (pec->fQuantized << 28));
 
     if (nPlies)
         iKey ^= ((pec->fUsePrune) << 6);
@@ -2665,9 +2734,31 @@ ApplyMove(TanBoard anBoard, const int anMove[8], const int fCheckLegal)
 }
 
 static void
-SaveMoves(movelist * pml, unsigned int cMoves, unsigned int cPip, int anMoves[], const TanBoard anBoard, int fPartial)
+NewMoveHash(movehash * pmh)
+{
+    if (++pmh->nStamp > 0xffff) {
+        /* stamps wrapped around: old entries could look valid again */
+        memset(pmh->anEntry, 0, sizeof(pmh->anEntry));
+        pmh->nStamp = 1;
+    }
+}
+
+static inline unsigned int
+MoveHashSlot(const positionkey * pkey)
 {
-    unsigned int i, j;
+    unsigned int i, h = 0;
+
+    for (i = 0; i < 7; i++)
+        h = (h ^ pkey->data[i]) * 0x9E3779B1U;
+
+    return (h ^ (h >> 16)) & (MOVE_HASH_SIZE - 1);
+}
+
+static void
+SaveMoves(movelist * pml, movehash * pmh, unsigned int cMoves, unsigned int cPip, int anMoves[],
+          const TanBoard anBoard, int fPartial)
+{
+    unsigned int i, j, iSlot;
     move *pm;
     positionkey key;
 
@@ -2685,8 +2776,10 @@ SaveMoves(movelist * pml, unsigned int cMoves, unsigned int cPip, int anMoves[],
         if (cMoves < pml->cMaxMoves || cPip < pml->cMaxPips)
             return;
 
-        if (cMoves > pml->cMaxMoves || cPip > pml->cMaxPips)
+        if (cMoves > pml->cMaxMoves || cPip > pml->cMaxPips) {
             pml->cMoves = 0;
+            NewMoveHash(pmh);
+        }
 
         pml->cMaxMoves = cMoves;
         pml->cMaxPips = cPip;
@@ -2694,9 +2787,13 @@ SaveMoves(movelist * pml, unsigned int cMoves, unsigned int cPip, int anMoves[],
 
     PositionKey(anBoard, &key);
 
-    for (i = 0; i < pml->cMoves; i++) {
+    for (iSlot = MoveHashSlot(&key);; iSlot = (iSlot + 1) & (MOVE_HASH_SIZE - 1)) {
+        unsigned int nEntry = pmh->anEntry[iSlot];
+
+        if ((nEntry >> 16) != pmh->nStamp)
+            break;              /* empty slot: new position */
 
-        pm = &(pml->amMoves[i]);
+        pm = &(pml->amMoves[nEntry & 0xffff]);
 
         if (EqualKeys(key, pm->key)) {
             if (cMoves > pm->cMoves || cPip > pm->cPips) {
@@ -2714,6 +2811,7 @@ SaveMoves(movelist * pml, unsigned int cMoves, unsigned int cPip, int anMoves[],
         }
     }
 
+    pmh->anEntry[iSlot] = (pmh->nStamp << 16) | pml->cMoves;
     pm = pml->amMoves + pml->cMoves;
 
     for (i = 0; i < cMoves * 2; i++)
@@ -2756,7 +2854,7 @@ LegalMove(const TanBoard anBoard, int iSrc, int nPips)
 }
 
 static int
-GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
+GenerateMovesSub(movelist * pml, movehash * pmh, int anRoll[], int nMoveDepth,
                  int iPip, int cPip, const TanBoard anBoard, int anMoves[], int fPartial)
 {
     int i, fUsed = 0;
@@ -2779,9 +2877,9 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
 
         ApplySubMove(anBoardNew, 24, anRoll[nMoveDepth], TRUE);
 
-        if (GenerateMovesSub(pml, anRoll, nMoveDepth + 1, 23, cPip +
+        if (GenerateMovesSub(pml, pmh, anRoll, nMoveDepth + 1, 23, cPip +
                              anRoll[nMoveDepth], (ConstTanBoard) anBoardNew, anMoves, fPartial))
-            SaveMoves(pml, nMoveDepth + 1, cPip + anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew, fPartial);
+            SaveMoves(pml, pmh, nMoveDepth + 1, cPip + anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew, fPartial);
 
         return fPartial;
     } else {
@@ -2794,10 +2892,10 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
 
                 ApplySubMove(anBoardNew, i, anRoll[nMoveDepth], TRUE);
 
-                if (GenerateMovesSub(pml, anRoll, nMoveDepth + 1,
+                if (GenerateMovesSub(pml, pmh, anRoll, nMoveDepth + 1,
                                      anRoll[0] == anRoll[1] ? i : 23,
                                      cPip + anRoll[nMoveDepth], (ConstTanBoard) anBoardNew, anMoves, fPartial))
-                    SaveMoves(pml, nMoveDepth + 1, cPip +
+                    SaveMoves(pml, pmh, nMoveDepth + 1, cPip +
                               anRoll[nMoveDepth], anMoves, (ConstTanBoard) anBoardNew, fPartial);
 
                 fUsed = 1;
@@ -2807,6 +2905,134 @@ GenerateMovesSub(movelist * pml, int anRoll[], int nMoveDepth,
     return !fUsed || fPartial;
 }
 
+/* Same search as GenerateMovesSub(), in the same order, without recursion.
+ * The board is changed in place and restored when backtracking, own
+ * chequers are tracked in an occupancy mask and the back chequer is
+ * updated incrementally. Points made by the opponent cannot change
+ * during a move (only blots are hit), so the sources with an open
+ * destination are precomputed for each die. */
+
+static void
+GenerateMovesIter(movelist * pml, movehash * pmh, const int anRoll[4], const TanBoard anBoardIn, int fPartial)
+{
+    TanBoard anBoard;
+    unsigned int nOwn = 0, nBlocked = 0, anOpen[7];
+    int anMoves[8], aiNext[4], aiLow[4], aiBack[4], afHit[4], afUsed[4];
+    int i, d, nDie, iBack = 0, cPip = 0;
+
+    memcpy(anBoard, anBoardIn, sizeof(anBoard));
+
+    for (i = 0; i < 25; i++) {
+        if (anBoard[1][i])
+            nOwn |= 1U << i;
+        if (i < 24 && anBoard[0][23 - i] > 1)
+            nBlocked |= 1U << i;
+        if (i && anBoard[1][i])
+            iBack = i;
+    }
+
+    /* sources (including the bar) that have a destination on the board
+     * not made by the opponent */
+    for (nDie = 1; nDie <= 6; nDie++)
+        anOpen[nDie] = (~nBlocked << nDie) & 0x1FFFFFFU & ~((1U << nDie) - 1);
+
+    d = 0;
+    aiNext[0] = aiLow[0] = 24;
+    if (!(nOwn & (1U << 24))) {
+        aiNext[0] = 23;
+        aiLow[0] = 0;
+    }
+    afUsed[0] = FALSE;
+
+    for (;;) {
+        const int nRoll = anRoll[d];
+
+        unsigned int nCand = anOpen[nRoll];
+
+        if (iBack <= 5)         /* bearing off: exact roll, or the back chequer */
+            nCand |= ((1U << iBack) | (1U << (nRoll - 1))) & ((1U << nRoll) - 1);
+
+        nCand &= nOwn & (aiNext[d] >= 0 ? (2U << aiNext[d]) - 1 : 0) & ~((1U << aiLow[d]) - 1);
+
+        if (nCand) {
+            int iDest;
+
+            for (i = aiNext[d]; !(nCand & (1U << i)); i--);
+            iDest = i - nRoll;
+
+            /* play the chequer on i */
+            aiNext[d] = i - 1;
+            afUsed[d] = TRUE;
+            aiBack[d] = iBack;
+            anMoves[d * 2] = i;
+            anMoves[d * 2 + 1] = iDest;
+
+            afHit[d] = FALSE;
+            if (iDest >= 0) {
+                if (anBoard[0][23 - iDest]) {
+                    anBoard[0][23 - iDest] = 0;
+                    anBoard[0][24]++;
+                    afHit[d] = TRUE;
+                }
+                anBoard[1][iDest]++;
+                nOwn |= 1U << iDest;
+            }
+            if (!--anBoard[1][i]) {
+                nOwn &= ~(1U << i);
+                if (i == iBack)
+                    for (iBack = i - 1; iBack > 0 && !anBoard[1][iBack]; iBack--);
+            }
+            cPip += nRoll;
+
+            if (d < 3 && anRoll[d + 1]) {
+                /* go one die deeper */
+                d++;
+                afUsed[d] = FALSE;
+                if (nOwn & (1U << 24)) {
+                    aiNext[d] = aiLow[d] = 24;
+                } else {
+                    aiNext[d] = (anRoll[0] == anRoll[1] && i < 24) ? i : 23;
+                    aiLow[d] = 0;
+                }
+                continue;
+            }
+
+            /* all dice played */
+            SaveMoves(pml, pmh, d + 1, cPip, anMoves, (ConstTanBoard) anBoard, fPartial);
+        } else {
+            /* no more chequers to play with this die */
+            const int fSave = !afUsed[d] || fPartial;
+
+            if (d == 0)
+                return;
+
+            d--;
+
+            if (fSave)
+                SaveMoves(pml, pmh, d + 1, cPip, anMoves, (ConstTanBoard) anBoard, fPartial);
+        }
+
+        /* take back the chequer played with die d */
+        {
+            const int iSrc = anMoves[d * 2];
+            const int iDest = anMoves[d * 2 + 1];
+
+            if (iDest >= 0) {
+                if (!--anBoard[1][iDest])
+                    nOwn &= ~(1U << iDest);
+                if (afHit[d]) {
+                    anBoard[0][23 - iDest] = 1;
+                    anBoard[0][24]--;
+                }
+            }
+            anBoard[1][iSrc]++;
+            nOwn |= 1U << iSrc;
+            iBack = aiBack[d];
+            cPip -= anRoll[d];
+        }
+    }
+}
+
 extern int
 CompareMoves(const move * pm0, const move * pm1)
 {
@@ -2871,6 +3097,8 @@ GenerateMoves(movelist * pml, const TanBoard anBoard, int n0, int n1, int fParti
 {
 
     int anRoll[4], anMoves[8];
+    movehash *pmh = MT_Get_MoveHash();
+
     anRoll[0] = n0;
     anRoll[1] = n1;
 
@@ -2878,12 +3106,26 @@ GenerateMoves(movelist * pml, const TanBoard anBoard, int n0, int n1, int fParti
 
     pml->cMoves = pml->cMaxMoves = pml->cMaxPips = pml->iMoveBest = 0;
     pml->amMoves = MT_Get_aMoves();
-    GenerateMovesSub(pml, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
+    NewMoveHash(pmh);
+
+    if (fIterativeMoveGen) {
+        GenerateMovesIter(pml, pmh, anRoll, anBoard, fPartial);
+
+        if (anRoll[0] != anRoll[1]) {
+            swap(anRoll, anRoll + 1);
+
+            GenerateMovesIter(pml, pmh, anRoll, anBoard, fPartial);
+        }
+
+        return pml->cMoves;
+    }
+
+    GenerateMovesSub(pml, pmh, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
 
     if (anRoll[0] != anRoll[1]) {
         swap(anRoll, anRoll + 1);
 
-        GenerateMovesSub(pml, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
+        GenerateMovesSub(pml, pmh, anRoll, 0, 23, 0, anBoard, anMoves, fPartial);
     }
 
     return pml->cMoves;
@@ -3175,10 +3417,65 @@ GetCubeRecommendation(const cubedecision cd)
 }
 
 
+/* Stamp of what n-ply evaluations depend on besides the evaluation
+ * context: the weights, the match equity table and the bearoff
+ * databases available */
+
+static uint32_t
+EvalStamp(void)
+{
+    const neuralnet *apnn[] = { &nnContact, &nnRace, &nnCrashed, &nnpContact, &nnpRace, &nnpCrashed };
+    int afBearoff[] = { pbc1 != NULL, pbc2 != NULL, pbcOS != NULL, pbcTS != NULL };
+    uint32_t nStamp = CacheStamp(0, WEIGHTS_VERSION, strlen(WEIGHTS_VERSION));
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(apnn); i++) {
+        const neuralnet *pnn = apnn[i];
+
+        if (!pnn->arHiddenWeight)
+            continue;
+
+        nStamp = CacheStamp(nStamp, pnn->arHiddenWeight, pnn->cInput * pnn->cHidden * sizeof(float));
+        nStamp = CacheStamp(nStamp, pnn->arOutputWeight, pnn->cHidden * pnn->cOutput * sizeof(float));
+        nStamp = CacheStamp(nStamp, pnn->arHiddenThreshold, pnn->cHidden * sizeof(float));
+        nStamp = CacheStamp(nStamp, pnn->arOutputThreshold, pnn->cOutput * sizeof(float));
+    }
+
+    nStamp = CacheStamp(nStamp, aafMET, sizeof(aafMET));
+    nStamp = CacheStamp(nStamp, aafMETPostCrawford, sizeof(aafMETPostCrawford));
+
+    return CacheStamp(nStamp, afBearoff, sizeof(afBearoff));
+}
+
+extern int
+EvalPersistentCacheOpen(const char *szFile, unsigned int cEntries)
+{
+    int n;
+
+    PersistCacheClose(&cPersist);
+
+    if ((n = PersistCacheOpen(&cPersist, szFile, cEntries)) < 0)
+        return n;
+
+    cPersist.nStamp = EvalStamp();
+    return (int) cPersist.size;
+}
+
+extern void
+EvalPersistentCacheClose(void)
+{
+    PersistCacheClose(&cPersist);
+}
+
 extern void
 EvalCacheFlush(void)
 {
     CacheFlush(&cEval);
+
+    /* called when the match equity table changes: entries made with the
+     * old one are now rejected */
+    if (cPersist.entries)
+        cPersist.nStamp = EvalStamp();
 }
 
 void
@@ -3223,7 +3520,8 @@ GetCacheMB(int size)
     if (size <= 0)
         return 0;
     else
-        return (1 << (size + 15)) * (int) sizeof(cacheNode) / (1024 * 1024);
+        return (int) (((size_t) 1 << (size + 16)) * (sizeof(cacheNodeDetail) + sizeof(cacheTags) / CACHE_WAYS)
+                      / (1024 * 1024));
 }
 
 extern int
@@ -4328,6 +4626,16 @@ cmp_evalcontext(const evalcontext * pec1, const evalcontext * pec2)
             return +1;
     }
 
+    if (pec1->fQuantized < pec2->fQuantized)
+        return -1;
+    else if (pec1->fQuantized > pec2->fQuantized)
+        return +1;
+
+    if (pec1->nTimeLimit < pec2->nTimeLimit)
+        return -1;
+    else if (pec1->nTimeLimit > pec2->nTimeLimit)
+        return +1;
+
     return 0;
 
 }
@@ -5246,6 +5554,7 @@ DoubleType(const int fDoubled, const int fMove, const int fTurn)
 #define FindBestMove FindBestMoveWithLocking
 #define EvaluatePosition EvaluatePositionWithLocking
 #define ScoreMove ScoreMoveWithLocking
+#define ScoreRolls ScoreRollsWithLocking
 #define GeneralCubeDecisionE GeneralCubeDecisionEWithLocking
 #define GeneralEvaluationE GeneralEvaluationEWithLocking
 #define EvaluatePositionCache EvaluatePositionCacheWithLocking
@@ -5254,6 +5563,7 @@ DoubleType(const int fDoubled, const int fMove, const int fTurn)
 #define EvaluatePositionCubeful3 EvaluatePositionCubeful3WithLocking
 #define ScoreMoves ScoreMovesWithLocking
 #define ScoreMovesPruned ScoreMovesPrunedWithLocking
+#define ScoreMovesBatch ScoreMovesBatchWithLocking
 #define FindBestMoveInEval FindBestMoveInEvalWithLocking
 #define GeneralEvaluationEPliedCubeful GeneralEvaluationEPliedCubefulWithLocking
 #define EvaluatePositionCubeful4 EvaluatePositionCubeful4WithLocking
@@ -5277,7 +5587,7 @@ static int EvaluatePositionCubeful3(NNState * nnStates, const TanBoard anBoard,
 
 /* Functions that have both locking and non-locking versions below here */
 
-static int ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies);
+static int ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies, double rDeadline);
 static int ScoreMovesPruned(movelist * pml, const cubeinfo * pci, const evalcontext * pec, unsigned int *bmovesi,
                             unsigned int prune_moves);
 /*
@@ -5319,7 +5629,7 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
     prune_moves = MIN_PRUNE_MOVES + LogCube(ml.cMoves);
 
     if (ml.cMoves <= prune_moves) {
-        ScoreMoves(&ml, pci, pec, 0);
+        ScoreMoves(&ml, pci, pec, 0, 0.0);
         PositionFromKey(anBoardOut, &ml.amMoves[ml.iMoveBest].key);
         return;
     }
@@ -5398,70 +5708,148 @@ FindBestMoveInEval(NNState * nnStates, int const nDice0, int const nDice1, const
     if (i == ml.cMoves)
         ScoreMovesPruned(&ml, pci, pec, bmovesi, prune_moves);
     else
-        ScoreMoves(&ml, pci, pec, 0);
+        ScoreMoves(&ml, pci, pec, 0, 0.0);
 
     PositionFromKey(anBoardOut, &ml.amMoves[ml.iMoveBest].key);
 }
 
+/* The 21 distinct rolls in the order the n-ply loops have always summed
+ * them, so that the result does not depend on which thread did what */
+static const int aanRollDice[21][2] = {
+    {1, 1},
+    {2, 1}, {2, 2},
+    {3, 1}, {3, 2}, {3, 3},
+    {4, 1}, {4, 2}, {4, 3}, {4, 4},
+    {5, 1}, {5, 2}, {5, 3}, {5, 4}, {5, 5},
+    {6, 1}, {6, 2}, {6, 3}, {6, 4}, {6, 5}, {6, 6}
+};
+
+/* Roll loops from this depth on are shared with idle threads; shallower
+ * ones are over too quickly to be worth handing out */
+#define PARALLEL_ROLLS_MIN_PLIES 2
+
+/* One level of n-ply expansion: play the best move for every roll and
+ * evaluate the result one ply less deep */
+typedef struct {
+    ConstTanBoard anBoard;
+    const cubeinfo *pci;
+    const evalcontext *pec;
+    unsigned int nPlies;
+    const cubeinfo *aci;        /* cube positions, NULL for cubeless */
+    int cci;
+    float aarOutput[21][NUM_OUTPUTS];
+    float *aarCubeful;          /* cci equities per roll */
+    int aiRet[21];
+} rollexpansion;
+
 static int
-EvaluatePositionFull(NNState * nnStates, const TanBoard anBoard, float arOutput[],
-                     cubeinfo * const pci, const evalcontext * pec, unsigned int nPlies, positionclass pc)
+ExpandRoll(NNState * nnStates, rollexpansion * pre, unsigned int iRoll)
 {
-    SSE_ALIGN(float arVariationOutput[NUM_OUTPUTS]);
+    int const n0 = aanRollDice[iRoll][0];
+    int const n1 = aanRollDice[iRoll][1];
+    const evalcontext *pec = pre->pec;
+    SSE_ALIGN(float ar[NUM_OUTPUTS]);
+    TanBoard anBoardNew;
+    cubeinfo ci, ciOpp;
     int i;
 
-    if (pc > CLASS_PERFECT && nPlies > 0) {
-        /* internal node; recurse */
+    for (i = 0; i < 25; i++) {
+        anBoardNew[0][i] = pre->anBoard[0][i];
+        anBoardNew[1][i] = pre->anBoard[1][i];
+    }
 
-        TanBoard anBoardNew;
-        /* int anMove[ 8 ]; */
-        cubeinfo ciOpp;
-        float rTemp;
-        int n0, n1;
+    if (fInterrupt) {
+        errno = EINTR;
+        return -1;
+    }
 
-        int const usePrune = pec->fUsePrune && pec->rNoise == 0.0f && pci->bgv == VARIATION_STANDARD;
+    /* FindBestMoveInEval() flips fMove while it works */
+    ci = *pre->pci;
 
-        for (i = 0; i < NUM_OUTPUTS; i++)
-            arOutput[i] = 0.0;
+    if (pec->fUsePrune && pec->rNoise == 0.0f && ci.bgv == VARIATION_STANDARD)
+        FindBestMoveInEval(nnStates, n0, n1, pre->anBoard, anBoardNew, &ci, pec);
+    else
+        FindBestMovePlied(NULL, n0, n1, anBoardNew, &ci, pec, 0, defaultFilters);
 
-        /* loop over rolls */
+    SwapSides(anBoardNew);
 
-        for (n0 = 1; n0 <= 6; n0++) {
-            for (n1 = 1; n1 <= n0; n1++) {
-                float w = (n0 == n1) ? 1.0f : 2.0f;
+    SetCubeInfo(&ciOpp, ci.nCube, ci.fCubeOwner, !ci.fMove,
+                ci.nMatchTo, ci.anScore, ci.fCrawford, ci.fJacoby, ci.fBeavers, ci.bgv);
 
-                for (i = 0; i < 25; i++) {
-                    anBoardNew[0][i] = anBoard[0][i];
-                    anBoardNew[1][i] = anBoard[1][i];
-                }
+    if (pre->aci) {
+        if (EvaluatePositionCubeful3(nnStates, (ConstTanBoard) anBoardNew, ar, pre->aarCubeful + iRoll * pre->cci,
+                                     pre->aci, pre->cci, &ciOpp, pec, pre->nPlies - 1, FALSE))
+            return -1;
+    } else if (EvaluatePositionCache(nnStates, (ConstTanBoard) anBoardNew, ar, &ciOpp, pec, pre->nPlies - 1,
+                                     ClassifyPosition((ConstTanBoard) anBoardNew, ciOpp.bgv)))
+        return -1;
 
-                if (fInterrupt) {
-                    errno = EINTR;
-                    return -1;
-                }
+    memcpy(pre->aarOutput[iRoll], ar, sizeof(ar));
 
-                if (usePrune) {
-                    FindBestMoveInEval(nnStates, n0, n1, anBoard, anBoardNew, pci, pec);
-                } else {
+    return 0;
+}
 
-                    FindBestMovePlied(NULL, n0, n1, anBoardNew, pci, pec, 0, defaultFilters);
-                }
+static void
+ExpandRollTask(void *data, unsigned int iRoll)
+{
+    rollexpansion *pre = (rollexpansion *) data;
 
-                SwapSides(anBoardNew);
+    pre->aiRet[iRoll] = ExpandRoll(MT_Get_nnState(), pre, iRoll);
+}
 
-                SetCubeInfo(&ciOpp, pci->nCube, pci->fCubeOwner, !pci->fMove,
-                            pci->nMatchTo, pci->anScore, pci->fCrawford, pci->fJacoby, pci->fBeavers, pci->bgv);
+static int
+ExpandRolls(NNState * nnStates, rollexpansion * pre)
+{
+    unsigned int iRoll;
 
-                /* Evaluate at 0-ply */
-                if (EvaluatePositionCache(nnStates, (ConstTanBoard) anBoardNew, arVariationOutput,
-                                          &ciOpp, pec, nPlies - 1,
-                                          ClassifyPosition((ConstTanBoard) anBoardNew, ciOpp.bgv)))
-                    return -1;
+    if (pre->nPlies < PARALLEL_ROLLS_MIN_PLIES) {
+        for (iRoll = 0; iRoll < 21; iRoll++)
+            if (ExpandRoll(nnStates, pre, iRoll))
+                return -1;
+        return 0;
+    }
 
-                for (i = 0; i < NUM_OUTPUTS; i++)
-                    arOutput[i] += w *arVariationOutput[i];
-            }
+    MT_ParallelFor(21, ExpandRollTask, pre);
+
+    for (iRoll = 0; iRoll < 21; iRoll++)
+        if (pre->aiRet[iRoll])
+            return -1;
 
+    return 0;
+}
+
+static int
+EvaluatePositionFull(NNState * nnStates, const TanBoard anBoard, float arOutput[],
+                     cubeinfo * const pci, const evalcontext * pec, unsigned int nPlies, positionclass pc)
+{
+    int i;
+
+    if (pc > CLASS_PERFECT && nPlies > 0) {
+        /* internal node; recurse */
+
+        rollexpansion re;
+        float rTemp;
+        unsigned int iRoll;
+
+        re.anBoard = anBoard;
+        re.pci = pci;
+        re.pec = pec;
+        re.nPlies = nPlies;
+        re.aci = NULL;
+        re.cci = 0;
+        re.aarCubeful = NULL;
+
+        if (ExpandRolls(nnStates, &re))
+            return -1;
+
+        for (i = 0; i < NUM_OUTPUTS; i++)
+            arOutput[i] = 0.0;
+
+        for (iRoll = 0; iRoll < 21; iRoll++) {
+            float w = (aanRollDice[iRoll][0] == aanRollDice[iRoll][1]) ? 1.0f : 2.0f;
+
+            for (i = 0; i < NUM_OUTPUTS; i++)
+                arOutput[i] += w *re.aarOutput[iRoll][i];
         }
 
         /* normalize */
@@ -5482,7 +5870,7 @@ EvaluatePositionFull(NNState * nnStates, const TanBoard anBoard, float arOutput[
     } else {
         /* at leaf node; use static evaluation */
 
-        if (acef[pc] (anBoard, arOutput, pci->bgv, nnStates))
+        if ((pec->fQuantized ? acefQuantized : acef)[pc] (anBoard, arOutput, pci->bgv, nnStates))
             return -1;
 
         if (pec->rNoise > 0.0f && pc != CLASS_OVER) {
@@ -5502,6 +5890,9 @@ EvaluatePositionFull(NNState * nnStates, const TanBoard anBoard, float arOutput[
 }
 
 
+/* Ask the OS to write back the persistent cache after that many additions */
+#define PERSIST_SYNC_ADDS (1U << 20)
+
 static int
 EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput[],
                       cubeinfo * const pci, const evalcontext * pecx, int nPlies, positionclass pc)
@@ -5522,12 +5913,25 @@ EvaluatePositionCache(NNState * nnStates, const TanBoard anBoard, float arOutput
         return 0;
     }
 
+    /* 0-ply evaluations are cheaper than a trip to the disk */
+    if (nPlies > 0 && cPersist.entries && PersistCacheLookup(&cPersist, &ec, arOutput)) {
+        memcpy(ec.ar, arOutput, sizeof(float) * NUM_OUTPUTS);
+        ec.ar[5] = 0.f;
+        CacheAdd(&cEval, &ec, l);
+        return 0;
+    }
+
     if (EvaluatePositionFull(nnStates, anBoard, arOutput, pci, pecx, nPlies, pc))
         return -1;
 
     memcpy(ec.ar, arOutput, sizeof(float) * NUM_OUTPUTS);
     ec.ar[5] = 0.f;
     CacheAdd(&cEval, &ec, l);
+
+    if (nPlies > 0 && cPersist.entries) {
+        if (!(PersistCacheAdd(&cPersist, &ec) % PERSIST_SYNC_ADDS))
+            PersistCacheSync(&cPersist);
+    }
     return 0;
 }
 
@@ -5580,24 +5984,193 @@ ScoreMove(NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext
     return 0;
 }
 
+/* Maximum number of candidates evaluated in one call of the batch
+ * neural net evaluation functions */
+#define MAX_BATCH_MOVES 32
+
+/* ecBasic with the quantized nets: the context of the 0-ply evaluations
+ * below a cubeful evaluation with fQuantized */
+static const evalcontext ecBasicQuantized = { FALSE, 0, FALSE, TRUE, 0.0f, TRUE };
+
+/*
+ * Evaluate at 0-ply the candidates aiMoves[0..cMoves-1] of pml that
+ * use one of the neural nets and are not cached yet, and add these
+ * evaluations to the cache.  The ScoreMove() calls that follow then
+ * find them there.  Candidates using the same net are evaluated
+ * together, so that the hidden weights are streamed from memory once
+ * per batch instead of once per candidate.
+ */
+
+static void
+ScoreMovesBatch(const movelist * pml, const cubeinfo * pci, const evalcontext * pec, const unsigned int *aiMoves,
+                unsigned int cMoves)
+{
+    static const neuralnet *const apnn[] = { &nnRace, &nnCrashed, &nnContact };
+    SSE_ALIGN(float aarInput[MAX_BATCH_MOVES * NUM_INPUTS]);
+    SSE_ALIGN(float aarOutput[MAX_BATCH_MOVES * NUM_OUTPUTS]);
+    unsigned int *aiBatch = (unsigned int *) g_alloca(cMoves * sizeof(unsigned int));
+    positionclass *apc = (positionclass *) g_alloca(cMoves * sizeof(positionclass));
+    uint32_t *al = (uint32_t *) g_alloca(cMoves * sizeof(uint32_t));
+    evalcache ec;
+    cubeinfo ci;
+    TanBoard anBoard;
+    positionclass pc;
+    unsigned int i, j, k;
+
+    /* the moves are evaluated from the opponent's point of view, with
+     * the context EvaluatePosition() would use at 0-ply */
+    memcpy(&ci, pci, sizeof(ci));
+    ci.fMove = !ci.fMove;
+    ec.nEvalContext = EvalKey(pec->fCubeful ? (pec->fQuantized ? &ecBasicQuantized : &ecBasic) : pec, 0, &ci, FALSE);
+
+    for (i = 0; i < cMoves; i++) {
+        const move *pm = pml->amMoves + (aiMoves ? aiMoves[i] : i);
+
+        PositionFromKeySwapped(anBoard, &pm->key);
+        apc[i] = ClassifyPosition((ConstTanBoard) anBoard, ci.bgv);
+
+        if (apc[i] < CLASS_RACE)
+            continue;
+
+        CopyKey(pm->key, ec.key);
+        if ((al[i] = CacheLookup(&cEval, &ec, aarOutput, NULL)) == CACHEHIT)
+            apc[i] = CLASS_OVER;
+    }
+
+    for (pc = CLASS_RACE; pc <= CLASS_CONTACT; pc++) {
+        const neuralnet *pnn = apnn[pc - CLASS_RACE];
+
+        i = 0;
+        while (i < cMoves) {
+            unsigned int cBatch = 0;
+
+            for (; i < cMoves && cBatch < MAX_BATCH_MOVES; i++) {
+                if (apc[i] != pc)
+                    continue;
+
+                PositionFromKeySwapped(anBoard, &pml->amMoves[aiMoves ? aiMoves[i] : i].key);
+
+                switch (pc) {
+                case CLASS_RACE:
+                    CalculateRaceInputs((ConstTanBoard) anBoard, aarInput + cBatch * pnn->cInput);
+                    break;
+                case CLASS_CRASHED:
+                    CalculateCrashedInputs((ConstTanBoard) anBoard, aarInput + cBatch * pnn->cInput);
+                    break;
+                default:
+                    CalculateContactInputs((ConstTanBoard) anBoard, aarInput + cBatch * pnn->cInput);
+                    break;
+                }
+
+                aiBatch[cBatch++] = i;
+            }
+
+            if (cBatch == 0)
+                break;
+
+#if defined(USE_SIMD_INSTRUCTIONS)
+            if (pec->fQuantized)
+                NeuralNetEvaluateBatchQuantizedSSE(pnn, cBatch, aarInput, aarOutput);
+            else
+                NeuralNetEvaluateBatchSSE(pnn, cBatch, aarInput, aarOutput);
+#else
+            if (pec->fQuantized)
+                NeuralNetEvaluateBatchQuantized(pnn, cBatch, aarInput, aarOutput);
+            else
+                NeuralNetEvaluateBatch(pnn, cBatch, aarInput, aarOutput);
+#endif
+
+            for (j = 0; j < cBatch; j++) {
+                const move *pm;
+
+                k = aiBatch[j];
+                pm = pml->amMoves + (aiMoves ? aiMoves[k] : k);
+                PositionFromKeySwapped(anBoard, &pm->key);
+
+                memcpy(ec.ar, aarOutput + j * NUM_OUTPUTS, sizeof(float) * NUM_OUTPUTS);
+
+                if (pc == CLASS_RACE)
+                    /* special evaluation of backgammons overrides net output */
+                    EvalRaceBG((ConstTanBoard) anBoard, ec.ar, ci.bgv);
+
+                SanityCheck((ConstTanBoard) anBoard, ec.ar);
+
+                CopyKey(pm->key, ec.key);
+                ec.ar[5] = 0.f;
+                CacheAdd(&cEval, &ec, al[k]);
+            }
+        }
+    }
+}
+
+/* Moves of a list scored at one ply or more, shared with idle threads */
+typedef struct {
+    movelist *pml;
+    const cubeinfo *pci;
+    const evalcontext *pec;
+    int nPlies;
+    double rDeadline;
+    int *aiRet;
+} scoremoves;
+
+static void
+ScoreMoveTask(void *data, unsigned int i)
+{
+    scoremoves *psm = (scoremoves *) data;
+
+    if (psm->rDeadline > 0.0 && get_time() > psm->rDeadline)
+        psm->aiRet[i] = 1;
+    else
+        psm->aiRet[i] = ScoreMove(MT_Get_nnState(), psm->pml->amMoves + i, psm->pci, psm->pec, psm->nPlies);
+}
+
+/* Score the moves of a list and find the best one. Returns -1 on error
+ * and 1 if the deadline (from get_time(), 0 for none) passed before all
+ * moves were scored, in which case the scores are a mixture of plies */
+
 static int
-ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies)
+ScoreMoves(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies, double rDeadline)
 {
     unsigned int i;
     int r = 0;                  /* return value */
     NNState *nnStates = MT_Get_nnState();
+    int *aiRet = NULL;
 
     pml->rBestScore = -99999.9f;
 
     if (nPlies == 0) {
         /* start incremental evaluations */
         nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_INCREMENTAL;
-    }
 
+        if (cCache && pec->rNoise == 0.0f && pml->cMoves > 1)
+            ScoreMovesBatch(pml, pci, pec, NULL, pml->cMoves);
+    } else if (pml->cMoves > 1) {
+        /* score all moves first, possibly in parallel, then pick the best
+         * one in list order as the serial loop does */
+        scoremoves sm;
+
+        aiRet = (int *) g_alloca(pml->cMoves * sizeof(int));
+        sm.pml = pml;
+        sm.pci = pci;
+        sm.pec = pec;
+        sm.nPlies = nPlies;
+        sm.rDeadline = rDeadline;
+        sm.aiRet = aiRet;
+        MT_ParallelFor(pml->cMoves, ScoreMoveTask, &sm);
+    }
 
     for (i = 0; i < pml->cMoves; i++) {
-        if (ScoreMove(nnStates, pml->amMoves + i, pci, pec, nPlies) < 0) {
-            r = -1;
+        int ret;
+
+        if (aiRet)
+            ret = aiRet[i];
+        else if (rDeadline > 0.0 && get_time() > rDeadline)
+            ret = 1;
+        else
+            ret = ScoreMove(nnStates, pml->amMoves + i, pci, pec, nPlies);
+
+        if (ret) {
+            r = ret;
             break;
         }
 
@@ -5631,6 +6204,9 @@ ScoreMovesPruned(movelist * pml, const cubeinfo * pci, const evalcontext * pec,
     /* start incremental evaluations */
     nnStates[0].state = nnStates[1].state = nnStates[2].state = NNSTATE_INCREMENTAL;
 
+    if (cCache && pec->rNoise == 0.0f)
+        ScoreMovesBatch(pml, pci, pec, bmovesi, prune_moves);
+
     for (j = 0; j < prune_moves; j++) {
 
         unsigned int i = bmovesi[j];
@@ -5655,6 +6231,33 @@ ScoreMovesPruned(movelist * pml, const cubeinfo * pci, const evalcontext * pec,
 
 static movefilter NullFilter = { -1, 0, 0.0 };
 
+/* ScoreMoves() for one ply of an anytime search: if the deadline passes,
+ * the list is put back as the previous ply left it */
+
+static int
+ScoreMovesAnytime(movelist * pml, const cubeinfo * pci, const evalcontext * pec, int nPlies, double rDeadline)
+{
+    move *amSaved;
+    int r;
+
+    if (rDeadline <= 0.0)
+        return ScoreMoves(pml, pci, pec, nPlies, 0.0);
+
+    amSaved = (move *) g_malloc(pml->cMoves * sizeof(move));
+    memcpy(amSaved, pml->amMoves, pml->cMoves * sizeof(move));
+
+    if ((r = ScoreMoves(pml, pci, pec, nPlies, rDeadline)) > 0) {
+        /* the previous ply sorted the list */
+        memcpy(pml->amMoves, amSaved, pml->cMoves * sizeof(move));
+        pml->iMoveBest = 0;
+        pml->rBestScore = pml->amMoves[0].rScore;
+    }
+
+    g_free(amSaved);
+
+    return r;
+}
+
 static int
 FindBestMovePlied(int anMove[8], int nDice0, int nDice1,
                   TanBoard anBoard,
@@ -5717,6 +6320,15 @@ FindnSaveBestMoves(movelist * pml, int nDice0, int nDice1, const TanBoard anBoar
     movefilter *mFilters;
     unsigned int nMaxPly = 0;
     unsigned int cOldMoves;
+    int r;
+
+    /* With a time limit, every ply after the first one scored runs
+     * against the clock. When it runs out the moves stay as the last
+     * complete ply scored them, which makes this an anytime search:
+     * each ply only looks at the best moves of the one before */
+    double const rEnd = (pec->nTimeLimit && pec->nPlies) ? get_time() + pec->nTimeLimit : 0.0;
+    double rDeadline = 0.0;
+    int fTimedOut = FALSE;
 
     /* Find all moves -- note that pml contains internal pointers to static
      * data, so we can't call GenerateMoves again (or anything that calls
@@ -5749,13 +6361,18 @@ FindnSaveBestMoves(movelist * pml, int nDice0, int nDice1, const TanBoard anBoar
             continue;
         }
 
-        if (ScoreMoves(pml, pci, pec, iPly) < 0) {
+        if ((r = ScoreMovesAnytime(pml, pci, pec, iPly, rDeadline)) < 0) {
             g_free(pm);
             pml->cMoves = 0;
             pml->amMoves = NULL;
             return -1;
+        } else if (r > 0) {
+            fTimedOut = TRUE;
+            goto finished;
         }
 
+        rDeadline = rEnd;
+
         qsort(pml->amMoves, pml->cMoves, sizeof(move), (cfunc) CompareMoves);
         pml->iMoveBest = 0;
 
@@ -5784,11 +6401,14 @@ FindnSaveBestMoves(movelist * pml, int nDice0, int nDice1, const TanBoard anBoar
 
     /* evaluate moves on top ply */
 
-    if (ScoreMoves(pml, pci, pec, pec->nPlies) < 0) {
+    if ((r = ScoreMovesAnytime(pml, pci, pec, pec->nPlies, rDeadline)) < 0) {
         g_free(pm);
         pml->cMoves = 0;
         pml->amMoves = NULL;
         return -1;
+    } else if (r > 0) {
+        fTimedOut = TRUE;
+        goto finished;
     }
 
     nMaxPly = pec->nPlies;
@@ -5820,7 +6440,8 @@ FindnSaveBestMoves(movelist * pml, int nDice0, int nDice1, const TanBoard anBoar
                     fResort = TRUE;
                 }
 
-                if ((fabsf(pml->amMoves[i].rScore - pml->amMoves[0].rScore) > rThr) && (nMaxPly < pec->nPlies)) {
+                if ((fabsf(pml->amMoves[i].rScore - pml->amMoves[0].rScore) > rThr) && (nMaxPly < pec->nPlies)
+                    && !fTimedOut) {
 
                     /* this is en error/blunder: re-analyse at top-ply */
 
@@ -5857,6 +6478,113 @@ FindnSaveBestMoves(movelist * pml, int nDice0, int nDice1, const TanBoard anBoar
 
 }
 
+/* ScoreRolls() at one ply or more: a move search per roll */
+
+static int
+ScoreRollsPlied(float aarScore[6][6], const TanBoard anBoard, const cubeinfo * pci, const evalcontext * pec,
+                int fDoubles)
+{
+    movelist ml;
+    move m;
+    int i, j;
+
+    for (i = 0; i < 6; i++)
+        for (j = 0; j < (fDoubles ? i + 1 : i); j++) {
+            if (FindnSaveBestMoves(&ml, i + 1, j + 1, anBoard, NULL, 0.0f, pci, pec, defaultFilters) < 0) {
+                g_free(ml.amMoves);
+                return -1;
+            }
+
+            if (ml.cMoves) {
+                aarScore[i][j] = ml.amMoves[0].rScore;
+                g_free(ml.amMoves);
+                continue;
+            }
+
+            memset(&m, 0, sizeof(move));
+            PositionKey(anBoard, &m.key);
+
+            if (ScoreMove(MT_Get_nnState(), &m, pci, pec, pec->nPlies) < 0)
+                return -1;
+
+            aarScore[i][j] = m.rScore;
+        }
+
+    return 0;
+}
+
+/*
+ * The best score for the player on roll of every roll, in aarScore[i][j]
+ * for the roll i+1, j+1 (j <= i, or j < i without the doubles), at the
+ * plies of pec.  A roll with no legal move scores the position as it is.
+ *
+ * This is what luck analysis needs.  At 0-ply it is much cheaper than a
+ * FindnSaveBestMoves() per roll: the candidates of all rolls go into one
+ * list, so the batch evaluation in ScoreMoves() sees them all at once.
+ * Deeper, each roll gets a move search with the default filters.
+ */
+
+extern int
+ScoreRolls(float aarScore[6][6], const TanBoard anBoard, const cubeinfo * pci, const evalcontext * pec, int fDoubles)
+{
+    movelist ml, mlRoll;
+    move *am = NULL;
+    unsigned int aiFirst[22];
+    unsigned int cMoves = 0, cMax = 0;
+    unsigned int c, k, l;
+    int i, j;
+
+    if (pec->nPlies)
+        return ScoreRollsPlied(aarScore, anBoard, pci, pec, fDoubles);
+
+    /* GenerateMoves() reuses the same storage for every roll, so the
+     * candidates are copied out as they come */
+    for (i = 0, k = 0; i < 6; i++)
+        for (j = 0; j < (fDoubles ? i + 1 : i); j++, k++) {
+            GenerateMoves(&mlRoll, anBoard, i + 1, j + 1, FALSE);
+
+            c = mlRoll.cMoves ? mlRoll.cMoves : 1;
+
+            if (cMoves + c > cMax) {
+                cMax = MAX(2 * cMax, cMoves + c);
+                am = (move *) g_realloc(am, cMax * sizeof(move));
+            }
+
+            if (mlRoll.cMoves)
+                memcpy(am + cMoves, mlRoll.amMoves, c * sizeof(move));
+            else {
+                memset(am + cMoves, 0, sizeof(move));
+                PositionKey(anBoard, &am[cMoves].key);
+            }
+
+            aiFirst[k] = cMoves;
+            cMoves += c;
+        }
+    aiFirst[k] = cMoves;
+
+    ml.amMoves = am;
+    ml.cMoves = cMoves;
+    ml.cMaxMoves = ml.cMaxPips = ml.iMoveBest = 0;
+
+    if (ScoreMoves(&ml, pci, pec, 0, 0.0) < 0) {
+        g_free(am);
+        return -1;
+    }
+
+    for (i = 0, k = 0; i < 6; i++)
+        for (j = 0; j < (fDoubles ? i + 1 : i); j++, k++) {
+            aarScore[i][j] = am[aiFirst[k]].rScore;
+
+            for (l = aiFirst[k] + 1; l < aiFirst[k + 1]; l++)
+                if (am[l].rScore > aarScore[i][j])
+                    aarScore[i][j] = am[l].rScore;
+        }
+
+    g_free(am);
+
+    return 0;
+}
+
 extern int
 GeneralCubeDecisionE(float aarOutput[2][NUM_ROLLOUT_OUTPUTS],
                      const TanBoard anBoard,
@@ -5964,13 +6692,9 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
 
     int i;
     positionclass pc;
-    SSE_ALIGN(float ar[NUM_OUTPUTS]);
     float arEquity[4];
 
-    cubeinfo ciMoveOpp;
-
     float *arCf = (float *) g_alloca(2 * cci * sizeof(float));
-    float *arCfTemp = (float *) g_alloca(2 * cci * sizeof(float));
     cubeinfo *aci = (cubeinfo *) g_alloca(2 * cci * sizeof(cubeinfo));
 
     pc = ClassifyPosition(anBoard, pciMove->bgv);
@@ -5978,66 +6702,42 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
     if (pc > CLASS_OVER && nPlies > 0 && !(pc <= CLASS_PERFECT && !pciMove->nMatchTo)) {
         /* internal node; recurse */
 
-        TanBoard anBoardNew;
-        int n0, n1;
+        rollexpansion re;
+        unsigned int iRoll;
         float r;
 
-        int const usePrune = pec->fUsePrune && pec->rNoise == 0.0f && pciMove->bgv == VARIATION_STANDARD;
-
-        for (i = 0; i < NUM_OUTPUTS; i++)
-            arOutput[i] = 0.0;
-
-        for (i = 0; i < 2 * cci; i++)
-            arCf[i] = 0.0;
-
         /* construct next level cube positions */
 
         MakeCubePos(aciCubePos, cci, fTop, aci, TRUE);
 
         /* loop over rolls */
 
-        for (n0 = 1; n0 <= 6; n0++) {
-            for (n1 = 1; n1 <= n0; n1++) {
-                float w = (n0 == n1) ? 1.0f : 2.0f;
-
-                for (i = 0; i < 25; i++) {
-                    anBoardNew[0][i] = anBoard[0][i];
-                    anBoardNew[1][i] = anBoard[1][i];
-                }
-
-                if (fInterrupt) {
-                    errno = EINTR;
-                    return -1;
-                }
-
-                if (usePrune) {
-                    FindBestMoveInEval(nnStates, n0, n1, anBoard, anBoardNew, pciMove, pec);
-                } else {
-
-                    FindBestMovePlied(NULL, n0, n1, anBoardNew, pciMove, pec, 0, defaultFilters);
-                }
-
-                SwapSides(anBoardNew);
+        re.anBoard = anBoard;
+        re.pci = pciMove;
+        re.pec = pec;
+        re.nPlies = nPlies;
+        re.aci = aci;
+        re.cci = 2 * cci;
+        re.aarCubeful = (float *) g_alloca(21 * 2 * cci * sizeof(float));
 
-                SetCubeInfo(&ciMoveOpp,
-                            pciMove->nCube, pciMove->fCubeOwner,
-                            !pciMove->fMove, pciMove->nMatchTo,
-                            pciMove->anScore, pciMove->fCrawford, pciMove->fJacoby, pciMove->fBeavers, pciMove->bgv);
+        if (ExpandRolls(nnStates, &re))
+            return -1;
 
-                /* Evaluate at 0-ply */
-                if (EvaluatePositionCubeful3(nnStates, (ConstTanBoard) anBoardNew,
-                                             ar, arCfTemp, aci, 2 * cci, &ciMoveOpp, pec, nPlies - 1, FALSE))
-                    return -1;
+        /* Sum up cubeless winning chances and cubeful equities */
 
-                /* Sum up cubeless winning chances and cubeful equities */
+        for (i = 0; i < NUM_OUTPUTS; i++)
+            arOutput[i] = 0.0;
 
-                for (i = 0; i < NUM_OUTPUTS; i++)
-                    arOutput[i] += w *ar[i];
-                for (i = 0; i < 2 * cci; i++)
-                    arCf[i] += w *arCfTemp[i];
+        for (i = 0; i < 2 * cci; i++)
+            arCf[i] = 0.0;
 
-            }
+        for (iRoll = 0; iRoll < 21; iRoll++) {
+            float w = (aanRollDice[iRoll][0] == aanRollDice[iRoll][1]) ? 1.0f : 2.0f;
 
+            for (i = 0; i < NUM_OUTPUTS; i++)
+                arOutput[i] += w *re.aarOutput[iRoll][i];
+            for (i = 0; i < 2 * cci; i++)
+                arCf[i] += w *re.aarCubeful[iRoll * 2 * cci + i];
         }
 
         /* Flip evals */
@@ -6107,7 +6807,7 @@ EvaluatePositionCubeful4(NNState * nnStates, const TanBoard anBoard,
 
             /* evaluate with neural net */
 
-            if (EvaluatePosition(nnStates, anBoard, arOutput, pciMove, NULL))
+            if (EvaluatePosition(nnStates, anBoard, arOutput, pciMove, pec->fQuantized ? &ecBasicQuantized : NULL))
                 return -1;
 
             if (pec->rNoise > 0.0f && pc != CLASS_OVER) {
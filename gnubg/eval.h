@@ -73,6 +73,18 @@ typedef enum {
 #define MAX_INCOMPLETE_MOVES 3875
 #define MAX_MOVES 3060
 
+/* Open addressing index of the moves generated so far, keyed on their
+ * position key. Used by GenerateMoves() to find duplicates in constant
+ * time. An entry holds the generation stamp in its upper 16 bits and
+ * the index in amMoves in its lower 16 bits; entries with an old stamp
+ * are empty, so the table is cleared by incrementing nStamp. */
+#define MOVE_HASH_SIZE 8192     /* power of 2, at least 2 * MAX_INCOMPLETE_MOVES */
+
+typedef struct {
+    unsigned int nStamp;
+    unsigned int anEntry[MOVE_HASH_SIZE];
+} movehash;
+
 typedef struct movefilter_s {
     int Accept;                 /* always allow this many moves. 0 means don't use this */
     /* level, since at least 1 is needed when used. */
@@ -93,6 +105,10 @@ typedef struct {
     unsigned int fDeterministic:1;
     unsigned int :25;		/* padding */
     float rNoise;               /* standard deviation */
+    /* after rNoise so that the many { fCubeful, nPlies, fUsePrune,
+     * fDeterministic, rNoise } initialisers leave it off */
+    unsigned int fQuantized:1;  /* 16 bit hidden weights, see neuralnet.h */
+    unsigned int nTimeLimit:24; /* ms for a move search, 0 for none; see FindnSaveBestMoves() */
 } evalcontext;
 
 /* identifies the format of evaluation info in .sgf files
@@ -278,6 +294,7 @@ typedef struct {
 } move;
 
 extern int fInterrupt;
+extern int fIterativeMoveGen;   /* GenerateMoves() without recursion */
 extern cubeinfo ciCubeless;
 extern const char *aszEvalType[(int) EVAL_ROLLOUT + 1];
 
@@ -329,6 +346,7 @@ typedef enum {
 typedef int (*classevalfunc) (const TanBoard anBoard, float arOutput[], const bgvariation bgv, NNState * nnStates);
 
 extern classevalfunc acef[N_CLASSES];
+extern classevalfunc acefQuantized[N_CLASSES];
 
 /* Evaluation cache size is 2^SIZE entries */
 #define CACHE_SIZE_DEFAULT 19
@@ -395,6 +413,8 @@ extern int
  GameStatus(const TanBoard anBoard, const bgvariation bgv);
 
 extern void EvalCacheFlush(void);
+extern int EvalPersistentCacheOpen(const char *szFile, unsigned int cEntries);
+extern void EvalPersistentCacheClose(void);
 extern int EvalCacheResize(unsigned int cNew);
 extern int EvalCacheStats(unsigned int *pcUsed, unsigned int *pcLookup, unsigned int *pcHit);
 extern double GetEvalCacheSize(void);
@@ -404,6 +424,7 @@ extern int GetCacheMB(int size);
 
 extern evalCache cEval;
 extern evalCache cpEval;
+extern persistCache cPersist;
 extern unsigned int cCache;
 
 extern int
@@ -509,6 +530,9 @@ extern void
 
 EXP_LOCK_FUN(int, ScoreMove, NNState * nnStates, move * pm, const cubeinfo * pci, const evalcontext * pec, int nPlies);
 
+EXP_LOCK_FUN(int, ScoreRolls, float aarScore[6][6], const TanBoard anBoard, const cubeinfo * pci,
+             const evalcontext * pec, int fDoubles);
+
 extern void
  CopyMoveList(movelist * pmlDest, const movelist * pmlSrc);
 
@@ -536,6 +560,10 @@ extern int
 extern void
  baseInputs(const TanBoard anBoard, float arInput[]);
 
+extern void CalculateRaceInputs(const TanBoard anBoard, float inputs[]);
+extern void CalculateContactInputs(const TanBoard anBoard, float arInput[]);
+extern void CalculateCrashedInputs(const TanBoard anBoard, float arInput[]);
+
 extern int CompareMoves(const move * pm0, const move * pm1);
 extern float EvalEfficiency(const TanBoard anBoard, positionclass pc);
 extern float Cl2CfMoney(float arOutput[NUM_OUTPUTS], cubeinfo * pci, float rCubeX);
@@ -49,6 +49,14 @@
 #include <sys/un.h>
 #endif                          /* #if HAVE_SYS_SOCKET_H */
 
+#include <fcntl.h>
+#if defined(__linux__)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#else
+#include <sys/select.h>
+#endif
+
 #else                           /* #ifndef WIN32 */
 
 #include <winsock2.h>
@@ -110,6 +118,10 @@
 #include "eval.h"
 #include "matchid.h"
 #include "lib/gnubg-types.h"
+#include "multithread.h"
+#if defined(USE_GTK)
+#include "gtkgame.h"
+#endif
 
 #if HAVE_SOCKETS
 
@@ -421,6 +433,8 @@ ExtEvaluation(scancontext * pec)
     ec.fUsePrune = pec->fUsePrune;
     ec.fDeterministic = pec->fDeterministic;
     ec.rNoise = pec->rNoise;
+    ec.fQuantized = FALSE;
+    ec.nTimeLimit = 0;
 
     if (GeneralEvaluationE(arOutput, (ConstTanBoard) processedBoard.anBoard, &ci, &ec))
         return NULL;
@@ -595,267 +609,723 @@ ExtFIBSBoard(scancontext * pec)
 
     return szResponse;
 }
+
+/* The external server serves any number of connections at once. The main thread waits for the
+ * sockets to be ready (with epoll on Linux, select elsewhere), reads and parses the requests of
+ * every connection, and hands the evaluations they ask for to the thread pool, so that the
+ * requests of different clients are evaluated at the same time, with the same cache and weights.
+ * A finished evaluation puts its answer on a queue and writes a byte to a pipe watched with the
+ * sockets, so the main thread sends each answer as soon as it is ready and keeps serving the
+ * other clients meanwhile. Each connection has at most one evaluation in progress; its next
+ * requests wait in its input buffer, so that the answers go back in order. FIBS board requests
+ * needing a cube rollout are evaluated on the main thread as they are parsed, and hold up every
+ * client until they are done. */
+
+#define EXT_MAX_LINE 4096       /* longer requests are an error */
+#if defined(WIN32)
+#define EXT_POLL_TIME 10        /* ms: select() cannot watch a pipe, so the answers are polled */
 #endif
 
-extern void
-CommandExternal(char *sz)
+typedef struct {
+    int h;
+    scancontext scanctx;
+    GString *gsIn;              /* bytes read, not yet handled */
+    GString *gsOut;             /* bytes to write */
+    int fPending;               /* an evaluation is in progress */
+    int fClosing;               /* close once the output is written */
+    int fWantWrite;             /* the output is waiting for the socket */
+    int fReadable, fWritable;
+} extclient;
+
+typedef struct {
+    extclient *pc;
+    char *szResponse;
+} extanswer;
+
+typedef struct {
+    int h;                      /* listening socket */
+    GList *plClients;
+#if defined(USE_EPOLL)
+    int hEpoll;
+#endif
+    int fAcceptable;
+    GAsyncQueue *pqAnswers;     /* extanswer of the evaluations done */
+    int cEvaluating;            /* evaluations not answered yet */
+#if !defined(WIN32)
+    int ahWake[2];              /* a byte is written to ahWake[1] for each answer */
+    int fWake;
+#endif
+} extserver;
+
+typedef struct {
+    Task task;
+    extserver *pes;
+    extclient *pc;
+    scancontext sc;             /* the request, owned by the task */
+} exttask;
+
+static int
+ExtWouldBlock(void)
+{
+#ifdef WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static int
+ExtSetNonBlocking(int h)
 {
+#ifdef WIN32
+    u_long f = 1;
 
-#if !defined(HAVE_SOCKETS)
-    (void) sz;                  /* silence compiler warning */
-    outputl(_("This installation of GNU Backgammon was compiled without\n"
-              "socket support, and does not implement external controllers."));
+    return ioctlsocket((SOCKET) h, FIONBIO, &f);
 #else
-    int h, hPeer, cb;
-    struct sockaddr *psa;
-    char szCommand[256];
-    char *szResponse = NULL;
-    struct sockaddr_in saRemote;
-    socklen_t saLen;
-    scancontext scanctx;
-    int fExit;
-    int fRestart = TRUE;
-    int retval = 0;
+    int f = fcntl(h, F_GETFL, 0);
 
-    sz = NextToken(&sz);
+    return f < 0 ? -1 : fcntl(h, F_SETFL, f | O_NONBLOCK);
+#endif
+}
 
-    if (!sz || !*sz) {
-        outputl(_("You must specify the name of the socket to the external controller."));
-        return;
+#if defined(USE_EPOLL)
+static void
+ExtWatch(extserver * pes, int h, void *p, int fWrite, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | (fWrite ? EPOLLOUT : 0);
+    ev.data.ptr = p;
+    epoll_ctl(pes->hEpoll, op, h, &ev);
+}
+#endif
+
+static int
+ExtWaitEvents(extserver * pes, int msTimeout)
+/* Waits for msTimeout at most, and flags the sockets ready */
+{
+    GList *pl;
+#if defined(USE_EPOLL)
+    struct epoll_event aev[64];
+    int i, n;
+#else
+    fd_set fdsRead, fdsWrite;
+    struct timeval tv;
+    int hMax = pes->h;
+    int n;
+#endif
+
+    pes->fAcceptable = FALSE;
+#if !defined(WIN32)
+    pes->fWake = FALSE;
+#endif
+    for (pl = pes->plClients; pl; pl = pl->next) {
+        extclient *pc = (extclient *) pl->data;
+
+        pc->fReadable = pc->fWritable = FALSE;
     }
 
-    memset(&scanctx, 0, sizeof(scanctx));
-    ExtInitParse(&scanctx.scanner);
+#if defined(USE_EPOLL)
+    if ((n = epoll_wait(pes->hEpoll, aev, G_N_ELEMENTS(aev), msTimeout)) < 0)
+        return errno == EINTR ? 0 : -1;
 
-  listenloop:
-    {
-        fExit = FALSE;
-        scanctx.fDebug = FALSE;
-        scanctx.fNewInterface = FALSE;
+    for (i = 0; i < n; ++i) {
+        extclient *pc = (extclient *) aev[i].data.ptr;
 
-        if ((h = ExternalSocket(&psa, &cb, sz)) < 0) {
-            SockErr(sz);
-            ExtDestroyParse(scanctx.scanner);
-            return;
+        if (!pc)
+            pes->fAcceptable = TRUE;
+        else if (aev[i].data.ptr == pes)
+            pes->fWake = TRUE;
+        else {
+            pc->fReadable = (aev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+            pc->fWritable = (aev[i].events & EPOLLOUT) != 0;
         }
+    }
+#else
+    FD_ZERO(&fdsRead);
+    FD_ZERO(&fdsWrite);
+    FD_SET(pes->h, &fdsRead);
+#if !defined(WIN32)
+    FD_SET(pes->ahWake[0], &fdsRead);
+    if (pes->ahWake[0] > hMax)
+        hMax = pes->ahWake[0];
+#endif
+    for (pl = pes->plClients; pl; pl = pl->next) {
+        extclient *pc = (extclient *) pl->data;
+
+        FD_SET(pc->h, &fdsRead);
+        if (pc->fWantWrite)
+            FD_SET(pc->h, &fdsWrite);
+        if (pc->h > hMax)
+            hMax = pc->h;
+    }
 
-        if (bind(h, psa, cb) < 0) {
-            SockErr(sz);
-            closesocket(h);
-            g_free(psa);
-            ExtDestroyParse(scanctx.scanner);
-            return;
-        }
+    tv.tv_sec = msTimeout / 1000;
+    tv.tv_usec = (msTimeout % 1000) * 1000;
 
-        g_free(psa);
+    if ((n = select(hMax + 1, &fdsRead, &fdsWrite, NULL, &tv)) < 0)
+        return errno == EINTR ? 0 : -1;
+
+    pes->fAcceptable = FD_ISSET(pes->h, &fdsRead);
+#if !defined(WIN32)
+    pes->fWake = FD_ISSET(pes->ahWake[0], &fdsRead);
+#endif
+    for (pl = pes->plClients; pl; pl = pl->next) {
+        extclient *pc = (extclient *) pl->data;
+
+        pc->fReadable = FD_ISSET(pc->h, &fdsRead);
+        pc->fWritable = FD_ISSET(pc->h, &fdsWrite);
+    }
+#endif
+
+    return 0;
+}
+
+static void
+ExtAccept(extserver * pes)
+{
+    struct sockaddr_in saRemote;
+    socklen_t saLen;
+    int hPeer;
+
+    for (;;) {
+        extclient *pc;
 
-        if (listen(h, 1) < 0) {
-            SockErr("listen");
-            closesocket(h);
-            ExternalUnbind(sz);
-            ExtDestroyParse(scanctx.scanner);
+        /* Must set length when using windows */
+        saLen = sizeof(struct sockaddr);
+        if ((hPeer = accept(pes->h, (struct sockaddr *) &saRemote, &saLen)) < 0) {
+            if (errno != EINTR && !ExtWouldBlock())
+                SockErr("accept");
             return;
         }
-        outputf(_("Waiting for a connection from %s...\n"), sz);
+
+        ExtSetNonBlocking(hPeer);
+
+        pc = g_new0(extclient, 1);
+        pc->h = hPeer;
+        ExtInitParse(&pc->scanctx.scanner);
+        pc->gsIn = g_string_new(NULL);
+        pc->gsOut = g_string_new(NULL);
+        pes->plClients = g_list_append(pes->plClients, pc);
+#if defined(USE_EPOLL)
+        ExtWatch(pes, hPeer, pc, FALSE, EPOLL_CTL_ADD);
+#endif
+
+        /* print info about remote client */
+
+        outputf(_("Accepted connection from %s.\n"), inet_ntoa(saRemote.sin_addr));
         outputx();
-        ProcessEvents();
+    }
+}
 
-        /* Must set length when using windows */
-        saLen = sizeof(struct sockaddr);
-        while ((hPeer = accept(h, (struct sockaddr *) &saRemote, &saLen)) < 0) {
-            if (errno == EINTR) {
-                ProcessEvents();
+static void
+ExtCloseClient(extserver * pes, extclient * pc)
+{
+#if defined(USE_EPOLL)
+    epoll_ctl(pes->hEpoll, EPOLL_CTL_DEL, pc->h, NULL);
+#endif
+    closesocket(pc->h);
+
+    unset_scan_context(&pc->scanctx, TRUE);
+    g_string_free(pc->gsIn, TRUE);
+    g_string_free(pc->gsOut, TRUE);
+
+    pes->plClients = g_list_remove(pes->plClients, pc);
+    g_free(pc);
+}
 
-                if (fInterrupt) {
-                    closesocket(h);
-                    ExternalUnbind(sz);
-                    ExtDestroyParse(scanctx.scanner);
-                    return;
-                }
+static void
+ExtFlush(extserver * pes, extclient * pc)
+/* Writes as much of the output as the socket takes */
+{
+    int fWantWrite;
+
+    while (pc->gsOut->len) {
+#ifdef WIN32
+        int n = send((SOCKET) pc->h, pc->gsOut->str, (int) pc->gsOut->len, 0);
+#else
+        ssize_t n;
+        psighandler sh;
+
+        PortableSignal(SIGPIPE, SIG_IGN, &sh, FALSE);
+        n = write(pc->h, pc->gsOut->str, pc->gsOut->len);
+        PortableSignalRestore(SIGPIPE, &sh);
+#endif
 
+        if (n < 0) {
+            if (errno == EINTR)
                 continue;
+            if (!ExtWouldBlock()) {
+                SockErr(_("writing to external connection"));
+                g_string_truncate(pc->gsOut, 0);
+                pc->fClosing = TRUE;
             }
+            break;
+        }
 
-            SockErr("accept");
-            closesocket(h);
-            ExternalUnbind(sz);
-            ExtDestroyParse(scanctx.scanner);
+        g_string_erase(pc->gsOut, 0, n);
+    }
+
+    fWantWrite = pc->gsOut->len > 0;
+#if defined(USE_EPOLL)
+    if (fWantWrite != pc->fWantWrite)
+        ExtWatch(pes, pc->h, pc, fWantWrite, EPOLL_CTL_MOD);
+#else
+    (void) pes;
+#endif
+    pc->fWantWrite = fWantWrite;
+}
+
+static void
+ExtReadClient(extclient * pc)
+{
+    char sz[1024];
+
+    for (;;) {
+#ifdef WIN32
+        int n = recv((SOCKET) pc->h, sz, sizeof(sz), 0);
+#else
+        ssize_t n = read(pc->h, sz, sizeof(sz));
+#endif
+
+        if (!n) {
+            outputl(_("External connection closed."));
+            pc->fClosing = TRUE;
+            return;
+        } else if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (!ExtWouldBlock()) {
+                SockErr(_("reading from external connection"));
+                pc->fClosing = TRUE;
+            }
             return;
         }
 
-        closesocket(h);
-        ExternalUnbind(sz);
+        g_string_append_len(pc->gsIn, sz, n);
+    }
+}
 
-        /* print info about remove client */
+static void
+ExtDebugBoard(scancontext * psc, GString * gs)
+/* The request and the board as understood, for "set debug on" */
+{
+    ProcessedFIBSBoard processedBoard;
+    GValue *optionsmapgv;
+    GValue *boarddatagv;
+    int anScore[2];
+    int fcrawford, fjacoby;
+    char *asz[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+    char szBoard[10000];
+    char **aszLines, **aszLinesOrig;
+    char *szMatchID;
+
+    optionsmapgv = (GValue *) g_list_nth_data(g_value_get_boxed(psc->pCmdData), 1);
+    boarddatagv = (GValue *) g_list_nth_data(g_value_get_boxed(psc->pCmdData), 0);
+    g_string_append(gs, DEBUG_PREFIX);
+    g_value_tostring(gs, optionsmapgv, 0);
+    g_string_append(gs, "\n" DEBUG_PREFIX);
+    g_value_tostring(gs, boarddatagv, 0);
+    g_string_append(gs, "\n" DEBUG_PREFIX "\n");
+    ProcessFIBSBoardInfo(&psc->bi, &processedBoard);
+
+    anScore[0] = processedBoard.nScoreOpp;
+    anScore[1] = processedBoard.nScore;
+    /* If the session isn't using Crawford rule, set Crawford flag to false */
+    fcrawford = psc->fCrawfordRule ? processedBoard.fCrawford : FALSE;
+    /* Set the Jacoby flag appropriately from the external interface settings */
+    fjacoby = psc->fJacobyRule;
 
-        outputf(_("Accepted connection from %s.\n"), inet_ntoa(saRemote.sin_addr));
-        outputx();
-        ProcessEvents();
+    szMatchID = MatchID((unsigned int *) processedBoard.anDice, 1, processedBoard.nResignation,
+                        processedBoard.fDoubled, 1, processedBoard.fCubeOwner, fcrawford,
+                        processedBoard.nMatchTo, anScore, processedBoard.nCube, fjacoby, GAME_PLAYING);
 
-        while (!fExit && !(retval = ExternalRead(hPeer, szCommand, sizeof(szCommand)))) {
-            /* To keep lexer happy terminate each line with \n */
-            if (szCommand[strlen(szCommand) - 1] != '\n')
-                strcat(szCommand, "\n");
+    DrawBoard(szBoard, (ConstTanBoard) & processedBoard.anBoard, 1, asz, szMatchID, 15);
 
-            if ((ExtParse(&scanctx, szCommand)) == 0) {
-                /* parse error */
-                szResponse = scanctx.szError;
+    aszLines = g_strsplit(&szBoard[0], "\n", 32);
+    aszLinesOrig = aszLines;
+    while (*aszLines) {
+        g_string_append_printf(gs, DEBUG_PREFIX "%s\n", *aszLines);
+        aszLines++;
+    }
+
+    g_string_append_printf(gs, DEBUG_PREFIX "X is %s, O is %s\n", processedBoard.szPlayer, processedBoard.szOpp);
+    if (processedBoard.nMatchTo) {
+        g_string_append_printf(gs, DEBUG_PREFIX "Match Play %s Crawford Rule\n",
+                               psc->fCrawfordRule ? "with" : "without");
+        g_string_append_printf(gs, DEBUG_PREFIX "Score: %d-%d/%d%s, ", processedBoard.nScore,
+                               processedBoard.nScoreOpp, processedBoard.nMatchTo, fcrawford ? "*" : "");
+    } else {
+        g_string_append_printf(gs, DEBUG_PREFIX "Money Session %s Jacoby Rule, %s Beavers\n",
+                               psc->fJacobyRule ? "with" : "without", psc->fBeavers ? "with" : "without");
+        g_string_append_printf(gs, DEBUG_PREFIX "Score: %d-%d, ", processedBoard.nScore, processedBoard.nScoreOpp);
+    }
+    g_string_append_printf(gs, "Roll: %d%d\n", processedBoard.anDice[0], processedBoard.anDice[1]);
+    g_string_append_printf(gs,
+                           DEBUG_PREFIX
+                           "CubeOwner: %d, Cube: %d, Turn: %c, Doubled: %d, Resignation: %d\n",
+                           processedBoard.fCubeOwner, processedBoard.nCube, 'X',
+                           processedBoard.fDoubled, processedBoard.nResignation);
+    g_string_append(gs, DEBUG_PREFIX "\n");
+
+    g_strfreev(aszLinesOrig);
+}
+
+static int
+ExtOnMainThread(const scancontext * psc)
+/* A FIBS board request whose cube decision is a rollout would roll out
+ * on the thread pool from inside a pool task, and wait for itself */
+{
+    return psc->ct == COMMAND_FIBSBOARD && (GetEvalCube()->et != EVAL_EVAL || esEvalCube.et != EVAL_EVAL);
+}
+
+static void
+ExtAnswer(extserver * pes, extclient * pc, char *szResponse)
+/* Hands the answer of an evaluation to the main thread */
+{
+    extanswer *pa = g_new(extanswer, 1);
+
+    pa->pc = pc;
+    pa->szResponse = szResponse;
+    g_async_queue_push(pes->pqAnswers, pa);
+
+#if !defined(WIN32)
+    /* if the pipe is full, the main thread is awake anyway */
+    if (write(pes->ahWake[1], "", 1) < 0 && errno != EAGAIN)
+        g_warning("external: %s", g_strerror(errno));
+#endif
+}
+
+static void
+ExtEvaluateMT(Task * pt)
+{
+    exttask *pet = (exttask *) pt;
+    char *szResponse;
+
+    if (pet->sc.ct == COMMAND_EVALUATION)
+        szResponse = ExtEvaluation(&pet->sc);
+    else
+        szResponse = ExtFIBSBoard(&pet->sc);
+
+    unset_scan_context(&pet->sc, FALSE);
+
+    ExtAnswer(pet->pes, pet->pc, szResponse);
+}
+
+static int
+ExtHandleLine(extserver * pes, extclient * pc, char *szCommand)
+/* Answers szCommand, or prepares the task evaluating it.
+ * Returns 1 if the client is to be closed, 0 otherwise. */
+{
+    scancontext *psc = &pc->scanctx;
+    char *szResponse = NULL;
+    int fExit = FALSE;
+
+    if ((ExtParse(psc, szCommand)) == 0) {
+        /* parse error */
+        szResponse = psc->szError;
+        psc->szError = NULL;
+    } else {
+        gchar *szOptStr;
+        exttask *pet;
+
+        switch (psc->ct) {
+        case COMMAND_HELP:
+            szResponse = g_strdup("\tNo help information available\n");
+            break;
+
+        case COMMAND_SET:
+            szOptStr = g_value_get_gstring_gchar(g_list_nth_data(psc->pCmdData, 0));
+            if (g_ascii_strcasecmp(szOptStr, KEY_STR_DEBUG) == 0) {
+                psc->fDebug = g_value_get_int(g_list_nth_data(psc->pCmdData, 1));
+                szResponse = g_strdup_printf("Debug output %s\n", psc->fDebug ? "ON" : "OFF");
+            } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_NEWINTERFACE) == 0) {
+                psc->fNewInterface = g_value_get_int(g_list_nth_data(psc->pCmdData, 1));
+                szResponse = g_strdup_printf("New interface %s\n", psc->fNewInterface ? "ON" : "OFF");
             } else {
-                ProcessedFIBSBoard processedBoard;
-                gchar *szOptStr;
-
-                switch (scanctx.ct) {
-                case COMMAND_HELP:
-                    szResponse = g_strdup("\tNo help information available\n");
-                    break;
-
-                case COMMAND_SET:
-                    szOptStr = g_value_get_gstring_gchar(g_list_nth_data(scanctx.pCmdData, 0));
-                    if (g_ascii_strcasecmp(szOptStr, KEY_STR_DEBUG) == 0) {
-                        scanctx.fDebug = g_value_get_int(g_list_nth_data(scanctx.pCmdData, 1));
-                        szResponse = g_strdup_printf("Debug output %s\n", scanctx.fDebug ? "ON" : "OFF");
-                    } else if (g_ascii_strcasecmp(szOptStr, KEY_STR_NEWINTERFACE) == 0) {
-                        scanctx.fNewInterface = g_value_get_int(g_list_nth_data(scanctx.pCmdData, 1));
-                        szResponse = g_strdup_printf("New interface %s\n", scanctx.fNewInterface ? "ON" : "OFF");
-                    } else {
-                        szResponse = g_strdup_printf("Error: set option '%s' not supported\n", szOptStr);
-                    }
-                    g_list_gv_boxed_free(scanctx.pCmdData);
-
-                    break;
-
-                case COMMAND_VERSION:
-                    szResponse = g_strdup("Interface: " EXTERNAL_INTERFACE_VERSION "\n"
-                                          "RFBF: " RFBF_VERSION_SUPPORTED "\n"
-                                          "Engine: " WEIGHTS_VERSION "\n" "Software: " VERSION "\n");
-
-                    break;
-
-                case COMMAND_NONE:
-                    szResponse = g_strdup("Error: no command given\n");
-                    break;
-
-                case COMMAND_FIBSBOARD:
-                case COMMAND_EVALUATION:
-                    if (scanctx.fDebug) {
-                        GValue *optionsmapgv;
-                        GValue *boarddatagv;
-                        GString *dbgStr;
-                        int anScore[2];
-                        int fcrawford, fjacoby;
-                        char *asz[7] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL };
-                        char szBoard[10000];
-                        char **aszLines, **aszLinesOrig;
-                        char *szMatchID;
-
-                        optionsmapgv = (GValue *) g_list_nth_data(g_value_get_boxed(scanctx.pCmdData), 1);
-                        boarddatagv = (GValue *) g_list_nth_data(g_value_get_boxed(scanctx.pCmdData), 0);
-                        dbgStr = g_string_new(DEBUG_PREFIX);
-                        g_value_tostring(dbgStr, optionsmapgv, 0);
-                        g_string_append(dbgStr, "\n" DEBUG_PREFIX);
-                        g_value_tostring(dbgStr, boarddatagv, 0);
-                        g_string_append(dbgStr, "\n" DEBUG_PREFIX "\n");
-                        ExternalWrite(hPeer, dbgStr->str, strlen(dbgStr->str));
-                        ProcessFIBSBoardInfo(&scanctx.bi, &processedBoard);
-
-                        anScore[0] = processedBoard.nScoreOpp;
-                        anScore[1] = processedBoard.nScore;
-                        /* If the session isn't using Crawford rule, set Crawford flag to false */
-                        fcrawford = scanctx.fCrawfordRule ? processedBoard.fCrawford : FALSE;
-                        /* Set the Jacoby flag appropriately from the external interface settings */
-                        fjacoby = scanctx.fJacobyRule;
-
-                        szMatchID = MatchID((unsigned int *) processedBoard.anDice, 1, processedBoard.nResignation,
-                                            processedBoard.fDoubled, 1, processedBoard.fCubeOwner, fcrawford,
-                                            processedBoard.nMatchTo, anScore, processedBoard.nCube, fjacoby,
-                                            GAME_PLAYING);
-
-                        DrawBoard(szBoard, (ConstTanBoard) & processedBoard.anBoard, 1, asz, szMatchID, 15);
-
-                        aszLines = g_strsplit(&szBoard[0], "\n", 32);
-                        aszLinesOrig = aszLines;
-                        while (*aszLines) {
-                            ExternalWrite(hPeer, DEBUG_PREFIX, strlen(DEBUG_PREFIX));
-                            ExternalWrite(hPeer, *aszLines, strlen(*aszLines));
-                            ExternalWrite(hPeer, "\n", 1);
-                            aszLines++;
-                        }
-
-                        dbgStr = g_string_assign(dbgStr, "");
-                        g_string_append_printf(dbgStr, DEBUG_PREFIX "X is %s, O is %s\n", processedBoard.szPlayer,
-                                               processedBoard.szOpp);
-                        if (processedBoard.nMatchTo) {
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Match Play %s Crawford Rule\n",
-                                                   scanctx.fCrawfordRule ? "with" : "without");
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Score: %d-%d/%d%s, ", processedBoard.nScore,
-                                                   processedBoard.nScoreOpp, processedBoard.nMatchTo,
-                                                   fcrawford ? "*" : "");
-                        } else {
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Money Session %s Jacoby Rule, %s Beavers\n",
-                                                   scanctx.fJacobyRule ? "with" : "without",
-                                                   scanctx.fBeavers ? "with" : "without");
-                            g_string_append_printf(dbgStr, DEBUG_PREFIX "Score: %d-%d, ", processedBoard.nScore,
-                                                   processedBoard.nScoreOpp);
-                        }
-                        g_string_append_printf(dbgStr, "Roll: %d%d\n",
-                                               processedBoard.anDice[0], processedBoard.anDice[1]);
-                        g_string_append_printf(dbgStr,
-                                               DEBUG_PREFIX
-                                               "CubeOwner: %d, Cube: %d, Turn: %c, Doubled: %d, Resignation: %d\n",
-                                               processedBoard.fCubeOwner, processedBoard.nCube, 'X',
-                                               processedBoard.fDoubled, processedBoard.nResignation);
-                        g_string_append(dbgStr, DEBUG_PREFIX "\n");
-                        ExternalWrite(hPeer, dbgStr->str, strlen(dbgStr->str));
-
-                        g_string_free(dbgStr, TRUE);
-                        g_strfreev(aszLinesOrig);
-                    }
-                    g_value_unsetfree(scanctx.pCmdData);
-
-                    if (scanctx.ct == COMMAND_EVALUATION)
-                        szResponse = ExtEvaluation(&scanctx);
-                    else
-                        szResponse = ExtFIBSBoard(&scanctx);
-
-                    break;
-
-                case COMMAND_EXIT:
-                    closesocket(hPeer);
-                    fExit = TRUE;
-                    break;
-
-                default:
-                    szResponse = g_strdup("Unsupported Command\n");
-                }
-                unset_scan_context(&scanctx, FALSE);
+                szResponse = g_strdup_printf("Error: set option '%s' not supported\n", szOptStr);
             }
+            g_list_gv_boxed_free(psc->pCmdData);
+
+            break;
+
+        case COMMAND_VERSION:
+            szResponse = g_strdup("Interface: " EXTERNAL_INTERFACE_VERSION "\n"
+                                  "RFBF: " RFBF_VERSION_SUPPORTED "\n"
+                                  "Engine: " WEIGHTS_VERSION "\n" "Software: " VERSION "\n");
+
+            break;
+
+        case COMMAND_NONE:
+            szResponse = g_strdup("Error: no command given\n");
+            break;
 
-            if (szResponse) {
-                /* outputf("%s", szResponse); */
-                if (ExternalWrite(hPeer, szResponse, strlen(szResponse)))
-                    break;
+        case COMMAND_FIBSBOARD:
+        case COMMAND_EVALUATION:
+            if (psc->fDebug)
+                ExtDebugBoard(psc, pc->gsOut);
+            g_value_unsetfree(psc->pCmdData);
 
-                g_free(szResponse);
-                szResponse = NULL;
+            if (ExtOnMainThread(psc)) {
+                szResponse = ExtFIBSBoard(psc);
+                break;
             }
 
+            /* the task takes the request over */
+
+            pet = (exttask *) malloc(sizeof(exttask));
+            pet->task.fun = (AsyncFun) ExtEvaluateMT;
+            pet->task.data = pet;
+            pet->task.pLinkedTask = NULL;
+            pet->pes = pes;
+            pet->pc = pc;
+            memcpy(&pet->sc, psc, sizeof(scancontext));
+            pet->sc.scanner = NULL;
+            psc->bi.gsName = psc->bi.gsOpp = NULL;
+
+            pc->fPending = TRUE;
+#if defined(USE_GTK)
+            /* as while waiting for tasks, so that settings do not change under the evaluations */
+            if (pes->cEvaluating == 0)
+                GTKSuspendInput();
+#endif
+            pes->cEvaluating++;
+            MT_AddDetachedTask((Task *) pet);
+
+            break;
+
+        case COMMAND_EXIT:
+            fExit = TRUE;
+            break;
+
+        default:
+            szResponse = g_strdup("Unsupported Command\n");
+        }
+        unset_scan_context(psc, FALSE);
+    }
+
+    if (szResponse) {
+        g_string_append(pc->gsOut, szResponse);
+        g_free(szResponse);
+    }
+
+    return fExit;
+}
+
+static void
+ExtHandleInput(extserver * pes, extclient * pc)
+/* Handles the complete lines read so far, up to the first one needing an evaluation */
+{
+    char *pch;
+
+    while (!pc->fPending && !pc->fClosing && (pch = memchr(pc->gsIn->str, '\n', pc->gsIn->len))) {
+        gsize cch = (gsize) (pch - pc->gsIn->str) + 1;
+        /* the lexer wants each line terminated with \n */
+        char *szCommand = g_strndup(pc->gsIn->str, cch);
+
+        g_string_erase(pc->gsIn, 0, cch);
+        if (ExtHandleLine(pes, pc, szCommand))
+            pc->fClosing = TRUE;
+        g_free(szCommand);
+    }
+
+    if (pc->gsIn->len > EXT_MAX_LINE && !memchr(pc->gsIn->str, '\n', pc->gsIn->len)) {
+        g_string_append(pc->gsOut, "Error: line too long\n");
+        pc->fClosing = TRUE;
+    }
+}
+
+static void
+ExtTakeAnswer(extserver * pes, extanswer * pa)
+/* Queues the answer of an evaluation for its client, which may send its next request */
+{
+    extclient *pc = pa->pc;
+
+    if (pa->szResponse) {
+        g_string_append(pc->gsOut, pa->szResponse);
+        g_free(pa->szResponse);
+    }
+    pc->fPending = FALSE;
+    g_free(pa);
+
+    if (--pes->cEvaluating == 0) {
+#if defined(USE_GTK)
+        GTKResumeInput();
+#endif
+    }
+}
+
+static void
+ExtTakeAnswers(extserver * pes)
+{
+    extanswer *pa;
+
+#if !defined(WIN32)
+    if (pes->fWake) {
+        char sz[256];
+
+        while (read(pes->ahWake[0], sz, sizeof(sz)) > 0);
+    }
+#endif
+
+    while ((pa = (extanswer *) g_async_queue_try_pop(pes->pqAnswers)) != NULL)
+        ExtTakeAnswer(pes, pa);
+}
+
+static int
+ExtServe(extserver * pes)
+/* Serves the clients until interrupted */
+{
+    while (!fInterrupt) {
+        GList *pl, *plNext;
+        int fBacklog = FALSE;
+        int msTimeout;
+
+        ProcessEvents();
+
+        /* no waiting if a client has requests left from the last round */
+
+        for (pl = pes->plClients; pl; pl = pl->next) {
+            extclient *pc = (extclient *) pl->data;
+
+            if (!pc->fPending && memchr(pc->gsIn->str, '\n', pc->gsIn->len))
+                fBacklog = TRUE;
+        }
+
+        msTimeout = fBacklog ? 0 : UI_UPDATETIME;
+#if defined(WIN32)
+        if (pes->cEvaluating)
+            msTimeout = MIN(msTimeout, EXT_POLL_TIME);
+#endif
+
+        if (ExtWaitEvents(pes, msTimeout) < 0) {
+            SockErr(_("waiting for external connections"));
+            return -1;
         }
-        /* Interrupted : get out of listen loop */
-        if (retval == -2) {
-            ProcessEvents();
-            fRestart = FALSE;
+
+        ExtTakeAnswers(pes);
+
+        if (pes->fAcceptable)
+            ExtAccept(pes);
+
+        for (pl = pes->plClients; pl; pl = pl->next) {
+            extclient *pc = (extclient *) pl->data;
+
+            if (pc->fReadable)
+                ExtReadClient(pc);
+            if (pc->fWritable)
+                ExtFlush(pes, pc);
+            ExtHandleInput(pes, pc);
         }
 
-        closesocket(hPeer);
-        if (szResponse)
-            g_free(szResponse);
+        for (pl = pes->plClients; pl; pl = plNext) {
+            extclient *pc = (extclient *) pl->data;
 
-        szResponse = NULL;
-        scanctx.szError = NULL;
+            plNext = pl->next;
+            ExtFlush(pes, pc);
+            if (pc->fClosing && !pc->fPending && !pc->gsOut->len)
+                ExtCloseClient(pes, pc);
+        }
     }
-    if (fRestart)
-        goto listenloop;
 
-    unset_scan_context(&scanctx, TRUE);
+    return 0;
+}
+#endif
+
+extern void
+CommandExternal(char *sz)
+{
+
+#if !defined(HAVE_SOCKETS)
+    (void) sz;                  /* silence compiler warning */
+    outputl(_("This installation of GNU Backgammon was compiled without\n"
+              "socket support, and does not implement external controllers."));
+#else
+    extserver es;
+    int cb;
+    struct sockaddr *psa;
+
+    sz = NextToken(&sz);
+
+    if (!sz || !*sz) {
+        outputl(_("You must specify the name of the socket to the external controller."));
+        return;
+    }
+
+    memset(&es, 0, sizeof(es));
+
+    if ((es.h = ExternalSocket(&psa, &cb, sz)) < 0) {
+        SockErr(sz);
+        return;
+    }
+
+    if (bind(es.h, psa, cb) < 0) {
+        SockErr(sz);
+        closesocket(es.h);
+        g_free(psa);
+        return;
+    }
+
+    g_free(psa);
+
+    if (ExtSetNonBlocking(es.h) < 0 || listen(es.h, SOMAXCONN) < 0) {
+        SockErr("listen");
+        closesocket(es.h);
+        ExternalUnbind(sz);
+        return;
+    }
+
+#if defined(USE_EPOLL)
+    if ((es.hEpoll = epoll_create1(0)) < 0) {
+        SockErr("epoll_create1");
+        closesocket(es.h);
+        ExternalUnbind(sz);
+        return;
+    }
+    ExtWatch(&es, es.h, NULL, FALSE, EPOLL_CTL_ADD);
+#endif
+
+#if !defined(WIN32)
+    if (pipe(es.ahWake) < 0) {
+        SockErr("pipe");
+#if defined(USE_EPOLL)
+        close(es.hEpoll);
+#endif
+        closesocket(es.h);
+        ExternalUnbind(sz);
+        return;
+    }
+    ExtSetNonBlocking(es.ahWake[0]);
+    ExtSetNonBlocking(es.ahWake[1]);
+#if defined(USE_EPOLL)
+    ExtWatch(&es, es.ahWake[0], &es, FALSE, EPOLL_CTL_ADD);
+#endif
+#endif
+    es.pqAnswers = g_async_queue_new();
+
+    outputf(_("Waiting for connections from %s...\n"), sz);
+    outputx();
+
+    ExtServe(&es);
+
+    /* Interrupted : wait for the evaluations under way, and close everything */
+
+    while (es.cEvaluating)
+        ExtTakeAnswer(&es, (extanswer *) g_async_queue_pop(es.pqAnswers));
+
+    while (es.plClients)
+        ExtCloseClient(&es, (extclient *) es.plClients->data);
+
+    g_async_queue_unref(es.pqAnswers);
+#if !defined(WIN32)
+    close(es.ahWake[0]);
+    close(es.ahWake[1]);
+#endif
+#if defined(USE_EPOLL)
+    close(es.hEpoll);
+#endif
+    closesocket(es.h);
+    ExternalUnbind(sz);
 #endif
 }
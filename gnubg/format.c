@@ -127,6 +127,10 @@ OutputEvalContext(const evalcontext * pec, const int fChequer)
         sprintf(strchr(sz, 0), " %s", _("prune"));
     }
 
+    if (pec->fQuantized) {
+        sprintf(strchr(sz, 0), " %s", _("quantized"));
+    }
+
     if (fChequer && pec->nPlies) {
         /* FIXME: movefilters!!! */
     }
@@ -483,10 +483,12 @@ char player1aliases[256] = "";
 
 /* Usage strings */
 static char szDICE[] = N_("<die> <die>"),
+    szBATCH[] = N_("<folder>|<pattern> [<folder>] [database]"),
     szCOMMAND[] = N_("<command>"),
     szCOMMENT[] = N_("<comment>"),
     szER[] = "evaluation|rollout",
     szFILENAME[] = N_("<filename>"),
+    szPERSISTENTCACHE[] = N_("<filename> [<entries>] | off"),
     szKEYVALUE[] = N_("[<key>=<value> ...]"),
     szLENGTH[] = N_("<length>"),
     szLIMIT[] = N_("<limit>"),
@@ -2882,10 +2884,13 @@ SaveEvalSettings(FILE * pf, const char *sz, evalcontext * pec)
             "%s prune %s\n"
             "%s cubeful %s\n"
             "%s noise %s\n"
-            "%s deterministic %s\n",
+            "%s deterministic %s\n"
+            "%s quantized %s\n"
+            "%s time %u\n",
             sz, pec->nPlies,
             sz, pec->fUsePrune ? "on" : "off",
-            sz, pec->fCubeful ? "on" : "off", sz, szNoise, sz, pec->fDeterministic ? "on" : "off");
+            sz, pec->fCubeful ? "on" : "off", sz, szNoise, sz, pec->fDeterministic ? "on" : "off",
+            sz, pec->fQuantized ? "on" : "off", sz, pec->nTimeLimit);
 }
 
 
@@ -3240,6 +3245,9 @@ SaveEvaluationSettings(FILE * pf)
     SaveEvalSetupSettings(pf, "set evaluation cubedecision", &esEvalCube);
     SaveMoveFilterSettings(pf, "set evaluation movefilter", aamfEval);
     fprintf(pf, "set cache %u\n", GetEvalCacheEntries());
+    fprintf(pf, "set iterativemovegen %s\n", fIterativeMoveGen ? "on" : "off");
+    if (cPersist.entries)
+        fprintf(pf, "set persistentcache \"%s\" %u\n", cPersist.szFile, cPersist.size);
     fprintf(pf, "set matchequitytable \"%s\"\n", miCurrent.szFileName);
     fprintf(pf, "set invert matchequitytable %s\n", fInvertMET ? "on" : "off");
 #if defined(USE_MULTITHREAD)
@@ -34,6 +34,7 @@
 #include "matchequity.h"
 #include "positionid.h"
 #include "matchid.h"
+#include "multithread.h"
 #include "util.h"
 #include "lib/gnubg-types.h"
 #include "lib/simd.h"
@@ -623,10 +624,11 @@ PyToPosInfo(PyObject * p, posinfo * ppi)
 static PyObject *
 EvalContextToPy(const evalcontext * pec)
 {
-    return Py_BuildValue("{s:i,s:i,s:i,s:i,s:f}",
+    return Py_BuildValue("{s:i,s:i,s:i,s:i,s:f,s:i,s:i}",
                          "cubeful", pec->fCubeful,
                          "plies", pec->nPlies, "deterministic", pec->fDeterministic,
-                         "prune", pec->fUsePrune, "noise", pec->rNoise);
+                         "prune", pec->fUsePrune, "noise", pec->rNoise,
+                         "quantized", pec->fQuantized, "time", pec->nTimeLimit);
 }
 
 
@@ -637,7 +639,7 @@ PyToEvalContext(PyObject * p, evalcontext * pec)
     PyObject *pyKey, *pyValue;
     Py_ssize_t iPos = 0;
     static const char *aszKeys[] = {
-        "cubeful", "plies", "deterministic", "prune", "noise", NULL
+        "cubeful", "plies", "deterministic", "prune", "noise", "quantized", "time", NULL
     };
     int i;
 
@@ -670,6 +672,8 @@ PyToEvalContext(PyObject * p, evalcontext * pec)
         case 1:
         case 2:
         case 3:
+        case 5:
+        case 6:
             /* simple integer */
             if (!PyInt_Check(pyValue)) {
                 /* not an integer */
@@ -686,8 +690,12 @@ PyToEvalContext(PyObject * p, evalcontext * pec)
                 pec->nPlies = (i < 8) ? i : 7;
             else if (iKey == 2) {
                 pec->fDeterministic = i ? 1 : 0;
-            } else
+            } else if (iKey == 3)
                 pec->fUsePrune = i ? 1 : 0;
+            else if (iKey == 5)
+                pec->fQuantized = i ? 1 : 0;
+            else
+                pec->nTimeLimit = (i > 0) ? MIN(i, (1 << 24) - 1) : 0;
 
             break;
 
@@ -771,9 +779,32 @@ PythonPosInfo(PyObject * UNUSED(self), PyObject * args)
 
 }
 
+/* A batch evaluation (see RunBatch()) releases the GIL while the
+ * threads work. Entry points that use the thread pool or may change
+ * the engine's globals wait for it to finish, also without the GIL;
+ * the others run at once */
+
+#if defined(USE_MULTITHREAD)
+static int fBatchRunning = FALSE;       /* only changed and read with the GIL held */
+static ManualEvent evBatchDone = NULL;
+
+static void
+BatchWait(void)
+{
+    while (fBatchRunning) {
+        Py_BEGIN_ALLOW_THREADS
+        WaitForManualEvent(evBatchDone);
+        Py_END_ALLOW_THREADS
+    }
+}
+#else
+#define BatchWait()
+#endif
+
 static PyObject *
 PythonNextTurn(PyObject * UNUSED(self), PyObject * UNUSED(args))
 {
+    BatchWait();
 
     fNextTurn = TRUE;
     while (fNextTurn) {
@@ -862,6 +893,8 @@ PythonHint(PyObject * UNUSED(self), PyObject * args)
     if (!PyArg_ParseTuple(args, "|i", &nMaxMoves))
         return NULL;
 
+    BatchWait();
+
     if (nMaxMoves < 0)
         nMaxMoves = MAX_MOVES;
 
@@ -914,6 +947,8 @@ static PyObject *
 PythonUpdateUI(PyObject * UNUSED(self), PyObject * UNUSED(args))
 {
 #if defined(USE_GTK)
+    BatchWait();
+
     if (fX) {
         while (gtk_events_pending())
             gtk_main_iteration();
@@ -942,6 +977,8 @@ PythonEvalContext(PyObject * UNUSED(self), PyObject * args)
     ec.fDeterministic = fDeterministic ? 1 : 0;
     ec.fUsePrune = fPrune ? 1 : 0;
     ec.rNoise = rNoise;
+    ec.fQuantized = gec->fQuantized;
+    ec.nTimeLimit = gec->nTimeLimit;
 
     return EvalContextToPy(&ec);
 }
@@ -957,6 +994,8 @@ PythonCommand(PyObject * UNUSED(self), PyObject * args)
     if (!PyArg_ParseTuple(args, "s:command", &pch))
         return NULL;
 
+    BatchWait();
+
     sz = g_strdup(pch);
 
     PortableSignal(SIGINT, HandleInterrupt, &sh, FALSE);
@@ -993,6 +1032,8 @@ PythonShow(PyObject * UNUSED(self), PyObject * args)
     if (!PyArg_ParseTuple(args, "s:argument", &pch))
         return NULL;
 
+    BatchWait();
+
     sz = g_strdup(pch);
 
     foutput_to_mem = TRUE;
@@ -1236,6 +1277,8 @@ PythonEvaluate(PyObject * UNUSED(self), PyObject * args)
     dd.pci = &ci;
     dd.pec = &ec;
 
+    BatchWait();
+
     fSaveShowProg = fShowProgress;
     fShowProgress = FALSE;
     if ((RunAsyncProcess((AsyncFun) asyncMoveDecisionE, &dd, _("Considering move...")) != 0) || fInterrupt) {
@@ -1293,6 +1336,8 @@ PythonEvaluateCubeful(PyObject * UNUSED(self), PyObject * args)
     dd.pec = &ec;
     dd.pes = NULL;
 
+    BatchWait();
+
     fSaveShowProg = fShowProgress;
     fShowProgress = FALSE;
     if ((RunAsyncProcess((AsyncFun) asyncCubeDecisionE, &dd, _("Considering cube decision...")) != 0) || fInterrupt) {
@@ -1371,6 +1416,8 @@ PythonFindBestMove(PyObject * UNUSED(self), PyObject * args)
     fd.pci = &ci;
     fd.pec = &ec;
 
+    BatchWait();
+
     fSaveShowProg = fShowProgress;
     fShowProgress = FALSE;
     if ((RunAsyncProcess((AsyncFun) asyncFindBestMoves, &fd, _("Considering move...")) != 0) || fInterrupt) {
@@ -1405,6 +1452,286 @@ PythonFindBestMove(PyObject * UNUSED(self), PyObject * args)
     }
 }
 
+/* Batch evaluations
+ *
+ * The boards are passed in a contiguous buffer of 32-bit integers (a
+ * NumPy int32 array, an array.array('i'), ...), 50 per position, as
+ * the two rows of 25 of "board". The results are written into a buffer
+ * the caller preallocated. The positions are shared out among the
+ * threads, without the GIL, so that other Python threads can run
+ * meanwhile (see BatchWait()). Without threads the GIL is kept. */
+
+typedef enum {
+    BATCH_EVALUATE,
+    BATCH_CFEVALUATE,
+    BATCH_FINDBESTMOVE
+} batchtype;
+
+typedef struct {
+    batchtype bt;
+    const unsigned int *anBoards;       /* 2 x 25 per position */
+    const int *anDice;                  /* 2 per position, BATCH_FINDBESTMOVE only */
+    float *arOutput;
+    int *anMoves;                       /* 8 per position, BATCH_FINDBESTMOVE only */
+    cubeinfo ci;
+    evalcontext ec;
+    TmoveFilter aamf;
+} batchData;
+
+typedef struct {
+    Task task;
+    batchData *pbd;
+    Py_ssize_t i;                       /* first position */
+    Py_ssize_t n;                       /* number of positions */
+} batchtask;
+
+/* Number of values per position in the outputs */
+#define BATCH_EVALUATE_OUTPUTS (OUTPUT_EQUITY + 1)
+#define BATCH_MOVE_OUTPUTS 8
+
+static int
+PyToBatchBuffer(PyObject * p, Py_buffer * pview, const char *szTypes, int fWritable, const char *szName)
+{
+    const char *pch;
+
+    if (PyObject_GetBuffer(p, pview, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT | (fWritable ? PyBUF_WRITABLE : 0)) < 0)
+        return -1;
+
+    /* native byte order only */
+    pch = pview->format ? pview->format : "B";
+    if (*pch == '@' || *pch == '=')
+        pch++;
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN
+    else if (*pch == '<')
+        pch++;
+#endif
+
+    if (pview->itemsize != 4 || pch[0] == '\0' || pch[1] != '\0' || !strchr(szTypes, pch[0])) {
+        PyErr_Format(PyExc_TypeError, _("%s must be a contiguous buffer of 32-bit %s"),
+                     szName, strchr(szTypes, 'f') ? "floats" : "integers");
+        PyBuffer_Release(pview);
+        return -1;
+    }
+
+    return 0;
+}
+
+SIMD_STACKALIGN static void
+BatchEvaluateMT(batchtask * pbt)
+{
+    batchData *pbd = pbt->pbd;
+    Py_ssize_t i;
+
+    for (i = pbt->i; i < pbt->i + pbt->n && !fInterrupt; ++i) {
+        TanBoard anBoard;
+        float arOutput[NUM_ROLLOUT_OUTPUTS];
+        float aarOutput[2][NUM_ROLLOUT_OUTPUTS];
+        int anMove[8];
+        int k;
+
+        memcpy(anBoard, pbd->anBoards + i * 2 * 25, sizeof(TanBoard));
+
+        switch (pbd->bt) {
+        case BATCH_EVALUATE:
+            if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, &pbd->ci, &pbd->ec) < 0) {
+                MT_SetResultFailed();
+                return;
+            }
+            memcpy(pbd->arOutput + i * BATCH_EVALUATE_OUTPUTS, arOutput, BATCH_EVALUATE_OUTPUTS * sizeof(float));
+            break;
+
+        case BATCH_CFEVALUATE:
+            if (GeneralCubeDecisionE(aarOutput, (ConstTanBoard) anBoard, &pbd->ci, &pbd->ec, NULL) < 0) {
+                MT_SetResultFailed();
+                return;
+            }
+            FindCubeDecision(pbd->arOutput + i * NUM_CUBEFUL_OUTPUTS, aarOutput, &pbd->ci);
+            break;
+
+        case BATCH_FINDBESTMOVE:
+            if (FindBestMove(anMove, pbd->anDice[i * 2], pbd->anDice[i * 2 + 1], anBoard, &pbd->ci, &pbd->ec,
+                             pbd->aamf) < 0) {
+                MT_SetResultFailed();
+                return;
+            }
+            /* as "findbestmove", but with unused moves set to zero */
+            for (k = 0; k < BATCH_MOVE_OUTPUTS; ++k)
+                pbd->anMoves[i * BATCH_MOVE_OUTPUTS + k] = anMove[k] + 1;
+            break;
+        }
+    }
+}
+
+static gboolean
+BatchCallback(gpointer UNUSED(unused))
+{
+    return TRUE;
+}
+
+static int
+RunBatch(batchData * pbd, Py_ssize_t n)
+{
+    Py_ssize_t cTasks, cPerTask, i;
+    int ret;
+
+    /* a few tasks per thread to even out the load */
+    cTasks = MIN(n, (Py_ssize_t) MT_GetNumThreads() * 4);
+    cPerTask = (n + cTasks - 1) / cTasks;
+
+#if defined(USE_MULTITHREAD)
+    BatchWait();
+
+    if (!evBatchDone)
+        InitManualEvent(&evBatchDone);
+    ResetManualEvent(evBatchDone);
+    fBatchRunning = TRUE;
+
+    Py_BEGIN_ALLOW_THREADS
+#endif
+
+    for (i = 0; i < n; i += cPerTask) {
+        batchtask *pbt = (batchtask *) malloc(sizeof(batchtask));
+
+        pbt->task.fun = (AsyncFun) BatchEvaluateMT;
+        pbt->task.data = pbt;
+        pbt->task.pLinkedTask = NULL;
+        pbt->pbd = pbd;
+        pbt->i = i;
+        pbt->n = MIN(cPerTask, n - i);
+        MT_AddTask((Task *) pbt, TRUE);
+    }
+
+    ret = MT_WaitForTasks(BatchCallback, UI_UPDATETIME, FALSE);
+
+#if defined(USE_MULTITHREAD)
+    Py_END_ALLOW_THREADS
+
+    fBatchRunning = FALSE;
+    SetManualEvent(evBatchDone);
+#endif
+
+    if (ret != 0 || fInterrupt) {
+        ResetInterrupt();
+        PyErr_SetString(PyExc_StandardError, _("interrupted/errno in batch evaluation"));
+        return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *
+PythonBatch(batchtype bt, PyObject * args)
+{
+    PyObject *pyBoards = NULL;
+    PyObject *pyDice = NULL;
+    PyObject *pyOutput = NULL;
+    PyObject *pyCubeInfo = NULL;
+    PyObject *pyEvalContext = NULL;
+    PyObject *pyMoveFilters = NULL;
+
+    Py_buffer viewBoards, viewDice, viewOutput;
+    batchData *pbd;
+    Py_ssize_t n, i, cOutputs;
+    PyObject *p = NULL;
+
+    if (bt == BATCH_FINDBESTMOVE) {
+        if (!PyArg_ParseTuple(args, "OOO|OOO", &pyBoards, &pyDice, &pyOutput,
+                              &pyCubeInfo, &pyEvalContext, &pyMoveFilters))
+            return NULL;
+    } else if (!PyArg_ParseTuple(args, "OO|OO", &pyBoards, &pyOutput, &pyCubeInfo, &pyEvalContext))
+        return NULL;
+
+    pbd = (batchData *) g_malloc0(sizeof(batchData));
+    pbd->bt = bt;
+    memcpy(&pbd->ec, bt == BATCH_CFEVALUATE ? &GetEvalCube()->ec : &GetEvalChequer()->ec, sizeof(evalcontext));
+    memcpy(pbd->aamf, *GetEvalMoveFilter(), sizeof(TmoveFilter));
+    GetMatchStateCubeInfo(&pbd->ci, &ms);
+
+    if ((pyCubeInfo && PyToCubeInfo(pyCubeInfo, &pbd->ci))
+        || (pyEvalContext && PyToEvalContext(pyEvalContext, &pbd->ec))
+        || (pyMoveFilters && PyToMoveFilters(pyMoveFilters, pbd->aamf))) {
+        g_free(pbd);
+        return NULL;
+    }
+
+    if (PyToBatchBuffer(pyBoards, &viewBoards, "iIlL", FALSE, "boards") < 0) {
+        g_free(pbd);
+        return NULL;
+    }
+    if (PyToBatchBuffer(pyOutput, &viewOutput, bt == BATCH_FINDBESTMOVE ? "iIlL" : "f", TRUE, "output") < 0) {
+        PyBuffer_Release(&viewBoards);
+        g_free(pbd);
+        return NULL;
+    }
+    if (pyDice && PyToBatchBuffer(pyDice, &viewDice, "iIlL", FALSE, "dice") < 0) {
+        PyBuffer_Release(&viewOutput);
+        PyBuffer_Release(&viewBoards);
+        g_free(pbd);
+        return NULL;
+    }
+
+    n = viewBoards.len / (Py_ssize_t) sizeof(TanBoard);
+    cOutputs = bt == BATCH_EVALUATE ? BATCH_EVALUATE_OUTPUTS :
+        bt == BATCH_CFEVALUATE ? NUM_CUBEFUL_OUTPUTS : BATCH_MOVE_OUTPUTS;
+
+    pbd->anBoards = (const unsigned int *) viewBoards.buf;
+    pbd->anDice = pyDice ? (const int *) viewDice.buf : NULL;
+    pbd->arOutput = (float *) viewOutput.buf;
+    pbd->anMoves = (int *) viewOutput.buf;
+
+    if (viewBoards.len % (Py_ssize_t) sizeof(TanBoard))
+        PyErr_SetString(PyExc_ValueError, _("boards must hold 50 values per position"));
+    else if (viewOutput.len < n * cOutputs * 4)
+        PyErr_Format(PyExc_ValueError, _("output must hold %d values per position"), (int) cOutputs);
+    else if (pyDice && viewDice.len < n * 2 * 4)
+        PyErr_SetString(PyExc_ValueError, _("dice must hold 2 values per position"));
+    else {
+        for (i = 0; i < n; ++i) {
+            TanBoard anBoard;
+
+            memcpy(anBoard, pbd->anBoards + i * 2 * 25, sizeof(TanBoard));
+            if (!CheckPosition((ConstTanBoard) anBoard)) {
+                PyErr_Format(PyExc_ValueError, _("invalid board at position %d"), (int) i);
+                break;
+            }
+            if (pyDice && (pbd->anDice[i * 2] < 1 || pbd->anDice[i * 2] > 6
+                           || pbd->anDice[i * 2 + 1] < 1 || pbd->anDice[i * 2 + 1] > 6)) {
+                PyErr_Format(PyExc_ValueError, _("invalid dice at position %d"), (int) i);
+                break;
+            }
+        }
+
+        if (i == n && (n == 0 || RunBatch(pbd, n) == 0))
+            p = PyInt_FromLong((long) n);
+    }
+
+    if (pyDice)
+        PyBuffer_Release(&viewDice);
+    PyBuffer_Release(&viewOutput);
+    PyBuffer_Release(&viewBoards);
+    g_free(pbd);
+
+    return p;
+}
+
+static PyObject *
+PythonEvaluateBatch(PyObject * UNUSED(self), PyObject * args)
+{
+    return PythonBatch(BATCH_EVALUATE, args);
+}
+
+static PyObject *
+PythonEvaluateCubefulBatch(PyObject * UNUSED(self), PyObject * args)
+{
+    return PythonBatch(BATCH_CFEVALUATE, args);
+}
+
+static PyObject *
+PythonFindBestMoveBatch(PyObject * UNUSED(self), PyObject * args)
+{
+    return PythonBatch(BATCH_FINDBESTMOVE, args);
+}
+
 static PyObject *
 METRow(float ar[MAXSCORE], const int n)
 {
@@ -3177,6 +3504,17 @@ static PyMethodDef gnubgMethods[] = {
      "           'deterministic'=> 0/1, 'noise'->float\n"
      "    returns: evaluation = tuple (floats optimal, nodouble, take, drop, int recommendation, String recommendationtext)"}
     ,
+    {"cfevaluatebatch", PythonEvaluateCubefulBatch, METH_VARARGS,
+     "Cubeful evaluation of many positions, shared out among the threads\n"
+     "    Engine calls from other Python threads wait until it returns\n"
+     "    arguments: boards output [cube-info] [eval-context]\n"
+     "       boards = contiguous buffer of 32-bit ints (e.g. numpy int32 array),\n"
+     "           50 per position, laid out as the two rows of 'board'\n"
+     "       output = writable contiguous buffer of 32-bit floats,\n"
+     "           4 per position: optimal, nodouble, take, drop\n"
+     "       cube-info, eval-context: see 'cfevaluate', used for all positions\n"
+     "    returns: int number of positions evaluated"}
+    ,
     {"classifypos", (PyCFunction) PythonClassifyPosition, METH_VARARGS,
      "classify a position for a given backammon variant and board\n"
      "    arguments: [board], [int variant]\n" "    returns: int posclass"}
@@ -3192,6 +3530,14 @@ static PyMethodDef gnubgMethods[] = {
      "    returns tuple(floats P(win), P(win gammon), P(win backgammnon)\n"
      "         P(lose gammon), P(lose backgammon), cubeless equity)"}
     ,
+    {"evaluatebatch", PythonEvaluateBatch, METH_VARARGS,
+     "Cubeless evaluation of many positions, shared out among the threads\n"
+     "    arguments: boards output [cube-info] [eval-context]\n"
+     "         boards: see 'cfevaluatebatch'\n"
+     "         output = writable contiguous buffer of 32-bit floats, 6 per\n"
+     "         position, in the order of the tuple returned by 'evaluate'\n"
+     "    returns: int number of positions evaluated"}
+    ,
     {"evalcontext", PythonEvalContext, METH_VARARGS,
      "make an evalcontext\n"
      "    argument: [tuple ( 5 int, float )]\n" "    returns:  eval-context ( see 'cfevaluate' )"}
@@ -3215,6 +3561,15 @@ static PyMethodDef gnubgMethods[] = {
      "        see 'cfevaluate'\n"
      "    returns: tuple( ints point from, point to, \n" "        unused moves are set to zero"}
     ,
+    {"findbestmovebatch", PythonFindBestMoveBatch, METH_VARARGS,
+     "Find the best move in many positions, shared out among the threads\n"
+     "    arguments: boards dice moves [cube-info] [eval-context] [move-filters]\n"
+     "        boards: see 'cfevaluatebatch'\n"
+     "        dice = contiguous buffer of 32-bit ints, 2 per position\n"
+     "        moves = writable contiguous buffer of 32-bit ints, 8 per position:\n"
+     "            points from, point to as in 'findbestmove', unused moves set to zero\n"
+     "    returns: int number of positions done"}
+    ,
     {"hint", PythonHint, METH_VARARGS,
      "    arguments: [max moves]\n" "    returns: hint dictionary\n"}
     ,
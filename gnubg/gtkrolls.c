@@ -30,6 +30,8 @@
 #include "format.h"
 #include "gtkwindows.h"
 #include "gtkrolls.h"
+#include "multithread.h"
+#include "positionid.h"
 
 typedef struct {
 
@@ -45,90 +47,404 @@ typedef struct {
 } rollswidget;
 
 
-static void
-add_level(GtkTreeStore * model, GtkTreeIter * iter,
-          const int n, const TanBoard anBoard,
-          evalcontext * pec, cubeinfo * pci, const gboolean fInvert, float arOutput[NUM_ROLLOUT_OUTPUTS])
-{
+/* The expansion of the rolls tree is done in two steps: the rolls are first evaluated on the thread
+ * pool into a tree of rolllevel's, which are then turned into rows of the tree store. The same
+ * position is often reached by different sequences of rolls, so the levels are memoized by position
+ * and depth and shared by all the branches reaching them. */
 
-    int n0, n1;
-    GtkTreeIter child_iter;
-    cubeinfo ci;
-    TanBoard an;
-    SSE_ALIGN(float ar[NUM_ROLLOUT_OUTPUTS]);
+typedef struct _rolllevel rolllevel;
+
+typedef struct {
     int anMove[8];
+    float ar[NUM_ROLLOUT_OUTPUTS];      /* as shown in the tree */
+    rolllevel *prl;                     /* the rolls after this one, NULL at the leaves */
+} rollentry;
+
+struct _rolllevel {
+    rollentry ae[21];
+    float arAverage[NUM_ROLLOUT_OUTPUTS];       /* as shown in the tree */
+    float arOutput[NUM_ROLLOUT_OUTPUTS];        /* as used by the level above */
+};
+
+typedef struct {
+    positionkey key;
+    int n;
+} rollkey;
+
+typedef struct {
+    GHashTable *phtLevels;      /* rolllevel's already expanded, by rollkey */
+#if defined(USE_MULTITHREAD)
+    Mutex lock;
+#endif
+    int cDone;                  /* positions evaluated so far, memoized ones included */
+
+    int n;
+    TanBoard anBoard;
+    cubeinfo ci;
+    evalcontext *pec;
+    GtkTreeStore *model;
+
+    rolllevel rlTop;
+    int afDone[21];             /* 1 when the top level roll is expanded, -1 if that failed */
+    int afShown[21];
+} rollsexpansion;
+
+static guint
+RollKeyHash(gconstpointer p)
+{
+    const rollkey *prk = (const rollkey *) p;
+    guint h = (guint) prk->n;
     int i;
 
-    char szRoll[3], szMove[FORMATEDMOVESIZE], *szEquity;
+    for (i = 0; i < 7; ++i)
+        h = h * 31 + prk->key.data[i];
+
+    return h;
+}
+
+static gboolean
+RollKeyEqual(gconstpointer p0, gconstpointer p1)
+{
+    const rollkey *prk0 = (const rollkey *) p0;
+    const rollkey *prk1 = (const rollkey *) p1;
+
+    return prk0->n == prk1->n && EqualKeys(prk0->key, prk1->key);
+}
+
+static rolllevel *
+LookupLevel(rollsexpansion * pre, const rollkey * prk)
+{
+    rolllevel *prl;
+
+#if defined(USE_MULTITHREAD)
+    Mutex_Lock(&pre->lock);
+#endif
+    prl = (rolllevel *) g_hash_table_lookup(pre->phtLevels, prk);
+#if defined(USE_MULTITHREAD)
+    Mutex_Release(&pre->lock);
+#endif
+
+    return prl;
+}
+
+static rolllevel *
+StoreLevel(rollsexpansion * pre, const rollkey * prk, rolllevel * prl)
+/* Another thread may have expanded the same level meanwhile: its copy is then kept */
+{
+    rolllevel *prlOld;
+
+#if defined(USE_MULTITHREAD)
+    Mutex_Lock(&pre->lock);
+#endif
+    if ((prlOld = (rolllevel *) g_hash_table_lookup(pre->phtLevels, prk)) != NULL) {
+        g_free(prl);
+        prl = prlOld;
+    } else {
+        rollkey *prkNew = g_new(rollkey, 1);
+
+        *prkNew = *prk;
+        g_hash_table_insert(pre->phtLevels, prkNew, prl);
+    }
+#if defined(USE_MULTITHREAD)
+    Mutex_Release(&pre->lock);
+#endif
+
+    return prl;
+}
+
+static int
+Leaves(int n)
+{
+    int c = 21;
+
+    while (n--)
+        c *= 21;
+
+    return c;
+}
+
+static rolllevel *ExpandLevel(rollsexpansion * pre, const int n, const TanBoard anBoard,
+                              const cubeinfo * pci, const gboolean fInvert);
+
+static int
+ExpandRoll(rollsexpansion * pre, rollentry * pe, const int n0, const int n1, const int n,
+           const TanBoard anBoard, const cubeinfo * pci, const gboolean fInvert)
+{
+    cubeinfo ci;
+    TanBoard an;
 
     /* cubeinfo for opponent on roll */
 
     memcpy(&ci, pci, sizeof(cubeinfo));
     ci.fMove = !pci->fMove;
 
-    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
-        arOutput[i] = 0.0f;
+    memcpy(an, anBoard, sizeof(an));
+
+    if (FindBestMove(pe->anMove, n0 + 1, n1 + 1, an, pci, pre->pec, defaultFilters) < 0)
+        return -1;
+
+    SwapSides(an);
+
+    if (n) {
+
+        if ((pe->prl = ExpandLevel(pre, n - 1, (ConstTanBoard) an, &ci, !fInvert)) == NULL)
+            return -1;
+
+        memcpy(pe->ar, pe->prl->arOutput, sizeof(pe->ar));
+
+    } else {
 
-    for (n0 = 0; n0 < 6; ++n0) {
-        for (n1 = 0; n1 <= n0; ++n1) {
+        /* evaluate resulting position */
 
-            memcpy(an, anBoard, sizeof(an));
+        pe->prl = NULL;
 
-            if (FindBestMove(anMove, n0 + 1, n1 + 1, an, pci, pec, defaultFilters) < 0)
-                return;
+        if (GeneralEvaluationE(pe->ar, (ConstTanBoard) an, &ci, pre->pec) < 0)
+            return -1;
 
-            SwapSides(an);
+        MT_SafeInc(&pre->cDone);
 
-            gtk_tree_store_append(model, &child_iter, iter);
+    }
+
+    if (fInvert)
+        InvertEvaluationR(pe->ar, &ci);
+
+    return 0;
+}
+
+static void
+AverageLevel(rolllevel * prl, const cubeinfo * pci, const gboolean fInvert)
+{
+    int n0, n1, k, i;
+
+    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
+        prl->arAverage[i] = 0.0f;
+
+    for (n0 = 0, k = 0; n0 < 6; ++n0)
+        for (n1 = 0; n1 <= n0; ++n1, ++k)
+            for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
+                prl->arAverage[i] += (n0 == n1) ? prl->ae[k].ar[i] : 2.0f * prl->ae[k].ar[i];
 
-            if (n) {
+    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
+        prl->arAverage[i] /= 36.0f;
+
+    memcpy(prl->arOutput, prl->arAverage, sizeof(prl->arOutput));
 
-                add_level(model, &child_iter, n - 1, (ConstTanBoard) an, pec, &ci, !fInvert, ar);
-                if (fInterrupt)
-                    return;
+    if (!fInvert)
+        InvertEvaluationR(prl->arOutput, pci);
+}
 
-            } else {
+static rolllevel *
+ExpandLevel(rollsexpansion * pre, const int n, const TanBoard anBoard, const cubeinfo * pci, const gboolean fInvert)
+{
+    /* the cubeinfo and fInvert only depend on the depth, so the key needs no more */
 
-                /* evaluate resulting position */
+    rollkey rk;
+    rolllevel *prl;
+    int n0, n1, k;
 
-                ProgressValueAdd(1);
+    PositionKey(anBoard, &rk.key);
+    rk.n = n;
 
-                if (GeneralEvaluationE(ar, (ConstTanBoard) an, &ci, pec) < 0)
-                    return;
+    if ((prl = LookupLevel(pre, &rk)) != NULL) {
+        MT_SafeAdd(&pre->cDone, Leaves(n));
+        return prl;
+    }
 
+    prl = g_new(rolllevel, 1);
+
+    for (n0 = 0, k = 0; n0 < 6; ++n0)
+        for (n1 = 0; n1 <= n0; ++n1, ++k)
+            if (ExpandRoll(pre, &prl->ae[k], n0, n1, n, anBoard, pci, fInvert) < 0) {
+                g_free(prl);
+                return NULL;
             }
 
-            if (fInvert)
-                InvertEvaluationR(ar, &ci);
+    AverageLevel(prl, pci, fInvert);
+
+    return StoreLevel(pre, &rk, prl);
+}
 
-            sprintf(szRoll, "%d%d", n0 + 1, n1 + 1);
-            FormatMove(szMove, anBoard, anMove);
+static void AddRows(GtkTreeStore * model, GtkTreeIter * iter, const rolllevel * prl,
+                    const TanBoard anBoard, const cubeinfo * pci, const gboolean fInvert);
+
+static void
+AddRollRow(GtkTreeStore * model, GtkTreeIter * iter, const rollentry * pe, const int n0, const int n1,
+           const TanBoard anBoard, const cubeinfo * pci, const gboolean fInvert)
+{
+    GtkTreeIter child_iter;
+    cubeinfo ci;
+    char szRoll[3], szMove[FORMATEDMOVESIZE], *szEquity;
 
-            szEquity = OutputMWC(ar[OUTPUT_CUBEFUL_EQUITY], fInvert ? pci : &ci, TRUE);
+    memcpy(&ci, pci, sizeof(cubeinfo));
+    ci.fMove = !pci->fMove;
 
-            gtk_tree_store_set(model, &child_iter, 0, szRoll, 1, szMove, 2, szEquity, -1);
+    gtk_tree_store_append(model, &child_iter, iter);
 
-            for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
-                arOutput[i] += (n0 == n1) ? ar[i] : 2.0f * ar[i];
+    if (pe->prl) {
+        TanBoard an;
 
-        }
+        memcpy(an, anBoard, sizeof(an));
+        ApplyMove(an, pe->anMove, FALSE);
+        SwapSides(an);
 
+        AddRows(model, &child_iter, pe->prl, (ConstTanBoard) an, &ci, !fInvert);
     }
 
-    for (i = 0; i < NUM_ROLLOUT_OUTPUTS; ++i)
-        arOutput[i] /= 36.0f;
+    sprintf(szRoll, "%d%d", n0 + 1, n1 + 1);
+    FormatMove(szMove, anBoard, pe->anMove);
 
-    /* add average equity */
+    szEquity = OutputMWC(pe->ar[OUTPUT_CUBEFUL_EQUITY], fInvert ? pci : &ci, TRUE);
 
-    szEquity = OutputMWC(arOutput[OUTPUT_CUBEFUL_EQUITY], fInvert ? pci : &ci, TRUE);
+    gtk_tree_store_set(model, &child_iter, 0, szRoll, 1, szMove, 2, szEquity, -1);
+}
+
+static void
+AddAverageRow(GtkTreeStore * model, GtkTreeIter * iter, const rolllevel * prl,
+              const cubeinfo * pci, const gboolean fInvert)
+{
+    GtkTreeIter child_iter;
+    cubeinfo ci;
+    char *szEquity;
+
+    memcpy(&ci, pci, sizeof(cubeinfo));
+    ci.fMove = !pci->fMove;
+
+    szEquity = OutputMWC(prl->arAverage[OUTPUT_CUBEFUL_EQUITY], fInvert ? pci : &ci, TRUE);
 
     gtk_tree_store_append(model, &child_iter, iter);
 
     gtk_tree_store_set(model, &child_iter, 0, _("Average equity"), 1, "", 2, szEquity, -1);
+}
 
-    if (!fInvert)
-        InvertEvaluationR(arOutput, pci);
+static void
+AddRows(GtkTreeStore * model, GtkTreeIter * iter, const rolllevel * prl,
+        const TanBoard anBoard, const cubeinfo * pci, const gboolean fInvert)
+{
+    int n0, n1, k;
+
+    for (n0 = 0, k = 0; n0 < 6; ++n0)
+        for (n1 = 0; n1 <= n0; ++n1, ++k)
+            AddRollRow(model, iter, &prl->ae[k], n0, n1, anBoard, pci, fInvert);
+
+    AddAverageRow(model, iter, prl, pci, fInvert);
+}
+
+typedef struct {
+    /* One roll of the top level, expanded on the thread pool */
+    Task task;
+    rollsexpansion *pre;
+    int n0, n1, k;
+} rolltask;
+
+static rollsexpansion *preComputing = NULL;     /* for the progress callback, which gets no data */
+
+static void
+ExpandRollMT(Task * pt)
+{
+    rolltask *prt = (rolltask *) pt;
+    rollsexpansion *pre = prt->pre;
+
+    if (!fInterrupt && ExpandRoll(pre, &pre->rlTop.ae[prt->k], prt->n0, prt->n1, pre->n - 1,
+                                  (ConstTanBoard) pre->anBoard, &pre->ci, TRUE) == 0)
+        MT_SafeSet(&pre->afDone[prt->k], 1);
+    else
+        MT_SafeSet(&pre->afDone[prt->k], -1);
+}
 
+static void
+ShowExpandedRolls(rollsexpansion * pre)
+{
+    int n0, n1, k;
+
+    for (n0 = 0, k = 0; n0 < 6; ++n0)
+        for (n1 = 0; n1 <= n0; ++n1, ++k)
+            if (!pre->afShown[k] && MT_SafeGet(&pre->afDone[k]) == 1) {
+                AddRollRow(pre->model, NULL, &pre->rlTop.ae[k], n0, n1,
+                           (ConstTanBoard) pre->anBoard, &pre->ci, TRUE);
+                pre->afShown[k] = TRUE;
+            }
+}
+
+static gboolean
+RollsProgress(gpointer UNUSED(unused))
+/* Called regularly during the expansion: adds the rolls done so far to the tree */
+{
+    if (preComputing) {
+        ProgressValue(MT_SafeGet(&preComputing->cDone));
+        ShowExpandedRolls(preComputing);
+    }
+    return TRUE;
+}
+
+static int
+ExpandRolls(GtkTreeStore * model, const int n, evalcontext * pec, const matchstate * pms)
+{
+    rollsexpansion *pre = g_new0(rollsexpansion, 1);
+    GSList *plTasks = NULL;
+    GSList *pl;
+    int n0, n1, k;
+    int fOK = TRUE;
+
+    pre->phtLevels = g_hash_table_new_full(RollKeyHash, RollKeyEqual, g_free, g_free);
+#if defined(USE_MULTITHREAD)
+    InitMutex(&pre->lock);
+#endif
+    pre->n = n;
+    memcpy(pre->anBoard, pms->anBoard, sizeof(pre->anBoard));
+    GetMatchStateCubeInfo(&pre->ci, pms);
+    pre->pec = pec;
+    pre->model = model;
+
+    for (n0 = 0, k = 0; n0 < 6; ++n0)
+        for (n1 = 0; n1 <= n0; ++n1, ++k) {
+            rolltask *prt = (rolltask *) malloc(sizeof(rolltask));
+
+            prt->task.fun = (AsyncFun) ExpandRollMT;
+            prt->task.data = prt;
+            prt->task.pLinkedTask = NULL;
+            prt->pre = pre;
+            prt->n0 = n0;
+            prt->n1 = n1;
+            prt->k = k;
+
+            plTasks = g_slist_prepend(plTasks, prt);
+        }
+
+    ProgressStartValue(_("Calculating equities"), Leaves(n - 1));
+
+    /* plTasks is in reverse order, which is what the threads want as each of them takes the
+     * last task of its queue first; without threads they run in the order they are added */
+#if !defined(USE_MULTITHREAD)
+    plTasks = g_slist_reverse(plTasks);
+#endif
+    for (pl = plTasks; pl; pl = pl->next)
+        MT_AddTask((Task *) pl->data, TRUE);
+    g_slist_free(plTasks);
+
+    preComputing = pre;
+    MT_WaitForTasks(RollsProgress, UI_UPDATETIME, FALSE);
+    preComputing = NULL;
+
+    ProgressEnd();
+
+    for (k = 0; k < 21; ++k)
+        if (pre->afDone[k] != 1)
+            fOK = FALSE;
+
+    if (fOK && !fInterrupt) {
+        ShowExpandedRolls(pre);
+        AverageLevel(&pre->rlTop, &pre->ci, TRUE);
+        AddAverageRow(model, NULL, &pre->rlTop, &pre->ci, TRUE);
+    } else
+        fOK = FALSE;
+
+    g_hash_table_destroy(pre->phtLevels);
+#if defined(USE_MULTITHREAD)
+    FreeMutex(&pre->lock);
+#endif
+    g_free(pre);
+
+    return fOK ? 0 : -1;
 }
 
 
@@ -154,44 +470,27 @@ sort_func(GtkTreeModel * model, GtkTreeIter * a, GtkTreeIter * b, gpointer UNUSE
 }
 
 
-static GtkTreeModel *
-create_model(const int n, evalcontext * pec, const matchstate * pms)
+static int
+create_model(GtkTreeStore * model, const int n, evalcontext * pec, const matchstate * pms)
 {
-    GtkTreeStore *model;
-    TanBoard anBoard;
-    cubeinfo ci;
-    float arOutput[NUM_ROLLOUT_OUTPUTS];
-    int i, j;
-
-    memcpy(anBoard, pms->anBoard, sizeof(anBoard));
-
-    /* create tree store */
-    model = gtk_tree_store_new(3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
-
-    GetMatchStateCubeInfo(&ci, pms);
-
-    for (i = 0, j = 1; i < n; ++i, j *= 21);
-
-    ProgressStartValue(_("Calculating equities"), j);
-
-    add_level(model, NULL, n - 1, (ConstTanBoard) anBoard, pec, &ci, TRUE, arOutput);
+    if (ExpandRolls(model, n, pec, pms) < 0 || fInterrupt)
+        return -1;
 
-    ProgressEnd();
+    gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(model), 2, sort_func, NULL, NULL);
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model), 2, GTK_SORT_DESCENDING);
 
-    if (!fInterrupt) {
-        gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(model), 2, sort_func, NULL, NULL);
-        gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(model), 2, GTK_SORT_DESCENDING);
-        return GTK_TREE_MODEL(model);
-    } else
-        return NULL;
+    return 0;
 }
 
 
 static GtkWidget *
-RollsTree(const int n, evalcontext * pec, const matchstate * pms)
+RollsTree(const int n, evalcontext * pec, const matchstate * pms, rollswidget * prw)
+/* The new tree replaces the current one while it is filled, so that the rolls appear as they are
+ * evaluated; the current one is put back if the calculation is interrupted */
 {
-    GtkTreeModel *pm;
+    GtkTreeStore *model;
     GtkWidget *ptv;
+    GtkWidget *ptvOld = prw->ptv;
     int i;
     static const char *aszColumn[] = {
         N_("Roll"),
@@ -199,12 +498,9 @@ RollsTree(const int n, evalcontext * pec, const matchstate * pms)
         N_("Equity")
     };
 
-    pm = create_model(n, pec, pms);
-    if (fInterrupt) {
-        return NULL;
-    }
-    ptv = gtk_tree_view_new_with_model(pm);
-    g_object_unref(G_OBJECT(pm));
+    model = gtk_tree_store_new(3, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
+    ptv = gtk_tree_view_new_with_model(GTK_TREE_MODEL(model));
+    g_object_unref(G_OBJECT(model));
 
     /* add columns */
 
@@ -218,11 +514,29 @@ RollsTree(const int n, evalcontext * pec, const matchstate * pms)
                                                     -1, Q_(aszColumn[i]), renderer, "text", i, NULL);
     }
 
-    if (fInterrupt) {
+    if (ptvOld) {
+        g_object_ref(G_OBJECT(ptvOld));
+        gtk_container_remove(GTK_CONTAINER(prw->psw), ptvOld);
+    }
+    gtk_container_add(GTK_CONTAINER(prw->psw), ptv);
+    gtk_widget_show_all(GTK_WIDGET(prw->psw));
+    prw->ptv = ptv;
+
+    if (create_model(model, n, pec, pms) < 0) {
         gtk_widget_destroy(ptv);
+        prw->ptv = ptvOld;
+        if (ptvOld) {
+            gtk_container_add(GTK_CONTAINER(prw->psw), ptvOld);
+            g_object_unref(G_OBJECT(ptvOld));
+        }
         return NULL;
     }
 
+    if (ptvOld) {
+        gtk_widget_destroy(ptvOld);
+        g_object_unref(G_OBJECT(ptvOld));
+    }
+
     return ptv;
 }
 
@@ -231,7 +545,6 @@ static gboolean fScrollComplete = FALSE;
 static void
 DepthChanged(GtkRange * pr, rollswidget * prw)
 {
-    GtkWidget *pNewRolls;
     int n;
 
     if (!fScrollComplete)
@@ -253,18 +566,9 @@ DepthChanged(GtkRange * pr, rollswidget * prw)
     gtk_widget_set_sensitive(prw->pScale, FALSE);
     gtk_widget_set_sensitive(prw->pCancel, TRUE);
 
-    pNewRolls = RollsTree(n, prw->pec, prw->pms);
-
-    if (pNewRolls) {
-        if (prw->ptv) {
-            gtk_widget_destroy(GTK_WIDGET(prw->ptv));
-            prw->ptv = NULL;
-        }
-        prw->ptv = pNewRolls;
-
-        gtk_container_add(GTK_CONTAINER(prw->psw), prw->ptv);
+    if (RollsTree(n, prw->pec, prw->pms, prw))
         prw->nDepth = n;
-    } else {
+    else {
         if (!prw->closing)
             gtk_range_set_value(GTK_RANGE(prw->pScale), (double) prw->nDepth);
     }
@@ -337,6 +641,7 @@ GTKShowRolls(const gint nDepth, evalcontext * pec, matchstate * pms)
     prw->pms = pms;
     prw->pec = pec;
     prw->nDepth = -1;           /* not yet calculated */
+    prw->ptv = NULL;
 
     /* vbox to hold tree widget and buttons */
 
@@ -411,10 +716,8 @@ GTKShowRolls(const gint nDepth, evalcontext * pec, matchstate * pms)
 
     /* tree  */
 
-    if ((prw->ptv = RollsTree(n, pec, pms)) != 0) {
-        gtk_container_add(GTK_CONTAINER(prw->psw), prw->ptv);
+    if (RollsTree(n, pec, pms, prw))
         prw->nDepth = n;
-    }
 
     gtk_window_set_default_size(GTK_WINDOW(prw->pDialog), 560, 400);
     g_signal_connect(G_OBJECT(prw->pDialog), "delete_event", G_CALLBACK(RollsClose), prw);      /* In case closed mid calculation */
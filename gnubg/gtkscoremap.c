@@ -29,13 +29,17 @@
             2. New: It calls CalcEquities(), which: 
                 - initializes the match state in each quadrant, by filling
                     psm->aaQuadrantData[i][j].ci for each i,j
-                - for each score i,j, also calls CalcQuadrantEquities() to find
+                - for each score i,j, also queues CalcQuadrantEquities() on the thread pool to find
                     the equity of each decision and therefore the best decision as well,
                     and uses it to set the text for the corresponding quadrant (the best decision is stored in
                     psm->aaQuadrantData[i][j].decisionString). This text is displayed in step 5 below.
                     In the move scoremap, FindMostFrequentMoves() finds the top-k most frequent distinct best moves
                     and assigns them distinct colors, as well as English descriptions (in the "alpha version" where
                     English description is allowed).
+                    While the quadrants are computed, UpdateScoreMapVisual() runs every UI_UPDATETIME ms, so that
+                    they are coloured as their results arrive (the ones still pending are grey). Changing the ply,
+                    match length, cube value or top-left option meanwhile cancels the computation and starts it
+                    again with the new settings.
             4. It calls  UpdateScoreMapVisual(), which for each quadrant runs ColourQuadrant(), updating:
                     (a) The color of each quadrant (for cube scoremap: using FindColour1() or FindColour2(),
                     depending on the coloring scheme; and for move scoremap, using FindMoveColour()). For instance,
@@ -137,6 +141,7 @@ same for gtk_widget_modify_style
 #include "drawboard.h"
 #include "format.h"
 #include "gtkwindows.h"
+#include "multithread.h"
 //#include "gtkoptions.h"  
 
 
@@ -279,6 +284,8 @@ typedef struct {
 
     // 3. specific to move scoremap:
     movelist ml; //scores ordered list of best moves  TODO (still relevant?): (1) replace with int anMove[8] (2) record index of this move in topKDecisions[]
+
+    int fPending; // queued on the thread pool and not computed yet: drawn grey, and the data above is not to be read
 } quadrantdata;
 
 typedef struct {
@@ -346,6 +353,12 @@ typedef struct {
     char topKDecisions[TOP_K][FORMATEDMOVESIZE];            //top-k most frequent best-move decisions
     char * topKClassifiedDecisions[TOP_K];  //top-k most frequent best-move decisions with "English" description
     int topKDecisionsLength;                //b/w 0 and K
+
+    // 4. computation of the quadrants on the thread pool (see CalcEquities()):
+    int fComputing;     // a computation is under way
+    int iGeneration;    // bumped when it is cancelled, so that its queued quadrants are skipped
+    int fRestart;       // the settings changed during the computation: start again once it has stopped
+    int fDestroyed;     // the window was closed during the computation: free everything once it has stopped
 } scoremap;
 
 // *******************************************************************
@@ -465,9 +478,9 @@ mmwc2eq(const float rMwc, const cubeinfo *pci) {
 
 
 static int
-DebugCalcQuadrantEquities(quadrantdata * pq, const scoremap * psm) {
+DebugCalcQuadrantEquities(quadrantdata * pq, const scoremap * psm, const evalcontext * pec) {
         if (FindnSaveBestMoves(&(pq->ml),psm->pms->anDice[0],psm->pms->anDice[1], (ConstTanBoard) psm->pms->anBoard, NULL, //or pkey
-                                        arSkillLevel[SKILL_DOUBTFUL], &(pq->ci), &psm->ec, aamfAnalysis) <0) { 
+                                        arSkillLevel[SKILL_DOUBTFUL], &(pq->ci), pec, aamfAnalysis) <0) { 
             strcpy(pq->decisionString,"");
             return -1;
         }
@@ -475,9 +488,10 @@ DebugCalcQuadrantEquities(quadrantdata * pq, const scoremap * psm) {
 }
 
 static int
-CalcQuadrantEquities(quadrantdata * pq, const scoremap * psm, int recomputeFully) {
+CalcQuadrantEquities(quadrantdata * pq, const scoremap * psm, const evalcontext * pec, int recomputeFully) {
 /* In Cube ScoreMap: Calculates the DT and ND equities for the given quadrant. Updates data in pq accordingly.
 In Move ScoreMap: Calculates the ordered best moves and their equities.
+pec is psm->ec, or a copy of it when running on the thread pool.
 */
     if (psm->cubeScoreMap) {
         if (!GetDPEq(NULL, NULL, & pq->ci)) { // Cube not available
@@ -487,7 +501,7 @@ In Move ScoreMap: Calculates the ordered best moves and their equities.
         } else {
             if (recomputeFully) {
                 float aarOutput[2][NUM_ROLLOUT_OUTPUTS];
-                if (GeneralCubeDecisionE(aarOutput, psm->pms->anBoard, & pq->ci, & psm->ec, NULL)) { 
+                if (GeneralCubeDecisionE(aarOutput, psm->pms->anBoard, & pq->ci, pec, NULL)) { 
                         //GeneralCubeDecisionE is from eval.c
                         // extern int GeneralCubeDecisionE(float aarOutput[2][NUM_ROLLOUT_OUTPUTS], const TanBoard anBoard,
                         // cubeinfo * const pci, const evalcontext * pec, const evalsetup * UNUSED(pes))
@@ -516,7 +530,7 @@ In Move ScoreMap: Calculates the ordered best moves and their equities.
         //     strcpy(pq->decisionString,"");
         //     return -1;
         // }
-        DebugCalcQuadrantEquities(pq, psm);
+        DebugCalcQuadrantEquities(pq, psm, pec);
         //g_assert(pq->ml.cMoves > 0);
         if (pq->ml.cMoves > 0)
             FormatMove(pq->decisionString, (ConstTanBoard) psm->pms->anBoard, pq->ml.amMoves[0].anMove);
@@ -1074,7 +1088,10 @@ ColourQuadrant(gtkquadrant * pgq, quadrantdata * pq, const scoremap * psm) {
     char buf [300];
 
     // color the squares
-    if (pq->isAllowedScore!=ALLOWED) { // Cube not available or unallowed square, e.g. i says Crawford and j post-C.
+    if (MT_SafeGet(&pq->fPending)) { // not computed yet
+        UpdateStyleGrey(pgq);
+        gtk_widget_set_tooltip_text(pgq->pContainerWidget, _("Computing..."));
+    } else if (pq->isAllowedScore!=ALLOWED) { // Cube not available or unallowed square, e.g. i says Crawford and j post-C.
         UpdateStyleGrey(pgq);
         // UpdateFontColor(pq, rgbBackground);
         gtk_widget_set_tooltip_text(pgq->pContainerWidget, pq->unallowedExplanation);
@@ -1580,6 +1597,86 @@ InitQuadrantCubeInfo(scoremap * psm, int i, int j)
 // }
 
 
+typedef struct {
+/* A quadrant computed on the thread pool */
+    Task task;
+    scoremap *psm;
+    quadrantdata *pq;
+    evalcontext ec; // own copy, since the user may change the ply before it runs
+    int recomputeFully;
+    int iGeneration; // of the computation that queued it
+} quadranttask;
+
+static scoremap *psmComputing = NULL; // for the progress callback, which gets no data
+
+static void
+CalcQuadrantEquitiesMT(Task * pt)
+{
+    quadranttask *pqt = (quadranttask *) pt;
+    quadrantdata *pq = pqt->pq;
+
+    if (MT_SafeGet(&pqt->psm->iGeneration) == pqt->iGeneration && !fInterrupt)
+        CalcQuadrantEquities(pq, pqt->psm, &pqt->ec, pqt->recomputeFully);
+    else {
+        // cancelled: show the quadrant as not computed, as when the computation fails
+        strcpy(pq->decisionString,"");
+        pq->ndEquity=-1000;
+        pq->dtEquity=-1000;
+        pq->ml.cMoves=0;
+    }
+
+    MT_SafeSet(&pq->fPending, FALSE);
+}
+
+static GSList *
+QueueQuadrant(GSList * plTasks, scoremap * psm, quadrantdata * pq, int recomputeFully)
+/* Prepares the task computing pq; it is queued with the others in CalcEquities() */
+{
+    quadranttask *pqt = (quadranttask *) malloc(sizeof(quadranttask));
+
+    pqt->task.fun = (AsyncFun) CalcQuadrantEquitiesMT;
+    pqt->task.data = pqt;
+    pqt->task.pLinkedTask = NULL;
+    pqt->psm = psm;
+    pqt->pq = pq;
+    pqt->ec = psm->ec;
+    pqt->recomputeFully = recomputeFully;
+    pqt->iGeneration = psm->iGeneration;
+    pq->fPending = TRUE;
+
+    return g_slist_prepend(plTasks, pqt);
+}
+
+static gboolean
+ScoreMapProgress(gpointer UNUSED(unused))
+/* Called regularly while the quadrants are computed: colours the ones done so far */
+{
+    ProgressValue(MT_GetDoneTasks());
+    if (psmComputing && !psmComputing->fDestroyed)
+        UpdateScoreMapVisual(psmComputing);
+    return TRUE;
+}
+
+static void
+CancelCalcEquities(scoremap * psm)
+/* Stops the computation under way: the quadrants still queued are skipped, and the ones being
+computed are interrupted */
+{
+    MT_SafeInc(&psm->iGeneration);
+    fInterrupt = TRUE;
+}
+
+static void
+FreeScoreMap(scoremap * psm)
+{
+    for (int i=0; i<TOP_K; i++) {
+        // g_free(psm->topKDecisions[i]);
+        g_free(psm->topKClassifiedDecisions[i]);
+    }
+
+    g_free(psm);
+}
+
 static int
 CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
 
@@ -1594,10 +1691,25 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
         - Only does entries in the table >= oldSize. (scomputing old values when resizing the table.)
         - In the move scoremap, it also computes the most frequent best moves across the scoremap
     When calcOnly is set: only do the 2nd step (e.g. if we only changed the ply, no need to recompute the cubeinfo array)
+
+    The equities are computed on the thread pool, and the window is updated as they come in. Since the
+    events are processed meanwhile, this can be called again (from the radio buttons) while a computation
+    is under way: that computation is then cancelled and started again from scratch with the new settings.
+    Returns -1 if the window was closed during the computation (psm is then freed), 0 otherwise.
 */
 {
     // int i,j,
     int aux,aux2;
+    GSList *plTasks = NULL;
+    GSList *pl;
+
+    if (psm->fComputing) {
+        CancelCalcEquities(psm);
+        psm->fRestart = TRUE;
+        return 0;
+    }
+
+  restart:
     //matchstate * pams;
     if(!calcOnly) {
         // matchstate ams = (*psm->pms); // Make a copy of the "master" matchstate  
@@ -1630,7 +1742,7 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
     }
     if (updateMoneyOnly) {
         //we only recompute the top-left money square, and don't bother with the progress bar
-        CalcQuadrantEquities(&(psm->moneyQuadrantData), psm, TRUE); // Recalculate money equity.
+        CalcQuadrantEquities(&(psm->moneyQuadrantData), psm, &psm->ec, TRUE); // Recalculate money equity.
     } else {
         //recompute fully (beyond oldSize); we only recompute the money equity when oldSize==0
         ProgressStartValue(_("Finding correct decisions"), (oldSize==0)? psm->tableSize*psm->tableSize + 1 : MAX(psm->tableSize*psm->tableSize-oldSize*oldSize, 1) );
@@ -1641,9 +1753,7 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
         //if(oldSize == 0 || oldSize == psm->tableSize)  //causes bug: it colors the cell in dark grey, and doesn't show a move
                             //maybe the moneyQuadrantData becomes empty?
         if (oldSize==0) {  //if the money square equity wasn't already computed [we are in the !updateMoneyOnly case]
-            CalcQuadrantEquities(&(psm->moneyQuadrantData), psm, TRUE);
-            /*careful: upon table scaling, ProgressValueAdd causes a redraw => a potential problem  in the pango markup text because it may not be ready yet!*/
-            ProgressValueAdd(1);//not sure if it should be included above, but probably minor
+            plTasks = QueueQuadrant(plTasks, psm, &(psm->moneyQuadrantData), TRUE);
         }
 
         /*
@@ -1689,11 +1799,7 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
                     //Only running the line below when (i >= oldSize || j >= oldSize) 
                     // [now aux>=oldSize] yields a bug with grey squares on resize
                     // if(aux>=oldSize) {
-                        CalcQuadrantEquities(&psm->aaQuadrantData[aux2][aux], psm, (aux >= oldSize));
-                    // if (myDebug)
-                    //     g_print("i=%d,j=%d,FindnSaveBestMoves returned %d, %1.3f; decision: %s\n",i,j,psm->aaQuadrantData[i][j].ml.cMoves,psm->aaQuadrantData[i][j].ml.rBestScore,psm->aaQuadrantData[i][j].decisionString);
-                    // if (aux >= oldSize) // Only count the ones where equities are recomputed (other ones occur near-instantly)
-                        ProgressValueAdd(1);
+                        plTasks = QueueQuadrant(plTasks, psm, &psm->aaQuadrantData[aux2][aux], (aux >= oldSize));
                     // }
                 }
                 else {
@@ -1705,9 +1811,7 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
                         InitQuadrantCubeInfo(psm, aux, aux2);
                     if (psm->aaQuadrantData[aux][aux2].isAllowedScore == ALLOWED || psm->cubeScoreMap) {
                         // if(aux>=oldSize) {
-                            CalcQuadrantEquities(&psm->aaQuadrantData[aux][aux2], psm, (aux >= oldSize));
-                        // if (aux >= oldSize)
-                            ProgressValueAdd(1);
+                            plTasks = QueueQuadrant(plTasks, psm, &psm->aaQuadrantData[aux][aux2], (aux >= oldSize));
                         // }
                     }
                     else {
@@ -1716,6 +1820,42 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
                 }
             }
         }
+
+        /* Now compute them all. plTasks holds the quadrants in reverse order, which is what we want
+        with threads since each of them takes the last task of its queue first: they then start with
+        the money quadrant and the small squares, as above. */
+#if !defined(USE_MULTITHREAD)
+        plTasks = g_slist_reverse(plTasks); // here they simply run in the order they are added
+#endif
+        for (pl = plTasks; pl; pl = pl->next)
+            MT_AddTask((Task *) pl->data, TRUE);
+        g_slist_free(plTasks);
+        plTasks = NULL;
+
+        psm->fComputing = TRUE;
+        psmComputing = psm;
+        MT_WaitForTasks(ScoreMapProgress, UI_UPDATETIME, FALSE);
+        psmComputing = NULL;
+        psm->fComputing = FALSE;
+
+        ProgressEnd();
+
+        if (psm->fDestroyed) {
+            fInterrupt = FALSE;
+            FreeScoreMap(psm);
+            return -1;
+        }
+
+        if (psm->fRestart) {
+            // the settings changed meanwhile: recompute everything
+            fInterrupt = FALSE;
+            psm->fRestart = FALSE;
+            oldSize = 0;
+            updateMoneyOnly = FALSE;
+            calcOnly = FALSE;
+            goto restart;
+        }
+
         /* if we show the true score in the axes and not the away score: when we scale up a table, a "current" score in a 5-point match becomes a "similar" score
                 in a 7-pt match; but we don't currently check that, as DMP, GG, GS etc don't change => check this case only */
         for (int i = 0; i < psm->tableSize; i++) {
@@ -1723,9 +1863,6 @@ CalcEquities(scoremap * psm, int oldSize, int updateMoneyOnly, int calcOnly)
                 psm->aaQuadrantData[i][j].isTrueScore = UpdateIsTrueScore(psm, i, j);
             }
         }
-        
-        ProgressEnd();
-
     }
 
     // if(!calcOnly) {
@@ -1845,6 +1982,9 @@ The function updates the decision text in each square.
         pq=&psm->moneyQuadrantData;
     }
 
+    if (MT_SafeGet(&pq->fPending)) // no text until it is computed
+        return TRUE;
+
     description = pango_font_description_from_string("sans");
     fontsize=MAX(MIN_FONT_SIZE, MIN(MAX_FONT_SIZE, (float)allocation.height/7.0f)); // Set text height as function of the quadrant height
     pango_font_description_set_size(description, (gint)(fontsize*PANGO_SCALE));
@@ -2442,7 +2582,8 @@ ScoreMapPlyToggled(GtkWidget * pw, scoremap * psm)
     if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(pw))) {
         /* recalculate equities */
         psm->ec.nPlies = *pi;
-        CalcEquities(psm,0,FALSE, TRUE);
+        if (CalcEquities(psm,0,FALSE, TRUE))
+            return;
         UpdateScoreMapVisual(psm);
     }
 
@@ -2485,7 +2626,8 @@ TopleftToggled(GtkWidget* pw, scoremap* psm)
             psm->moneyJacoby = TRUE;
         else
             psm->moneyJacoby = FALSE;
-        CalcEquities(psm,psm->tableSize,TRUE,FALSE);
+        if (CalcEquities(psm,psm->tableSize,TRUE,FALSE))
+            return;
         UpdateScoreMapVisual(psm); // Update square colours.
     }
 }
@@ -2572,7 +2714,8 @@ MatchLengthToggled(GtkWidget * pw, scoremap * psm)
         //     psm->oldTableSize=oldTableSize;
         //     UpdateScoreMapVisual(psm,oldTableSize);
         if (psm->tableSize > oldTableSize) {
-            CalcEquities(psm,oldTableSize,FALSE,FALSE);
+            if (CalcEquities(psm,oldTableSize,FALSE,FALSE))
+                return;
         }
         //     psm->tempScaleUp=0;
         //     psm->oldTableSize=0;
@@ -2652,13 +2795,12 @@ Allows garbage collection.
         pwDialog = NULL;
     }
 
-    /* garbage collect */
-    for (int i=0; i<TOP_K; i++) {
-        // g_free(psm->topKDecisions[i]);
-        g_free(psm->topKClassifiedDecisions[i]);
-    }
-
-    g_free(psm);
+    /* garbage collect, or let CalcEquities() do it once its computation has stopped */
+    if (psm->fComputing) {
+        psm->fDestroyed = TRUE;
+        CancelCalcEquities(psm);
+    } else
+        FreeScoreMap(psm);
 }
 
 //Module to add text, based on AddTitle from gtkgame.c
@@ -3013,7 +3155,7 @@ if needed (this was initially planned for some explanation text, which was then
 
     /* ******************* we define the psm default values ******************** */
 
-    psm = (scoremap *) g_malloc(sizeof(scoremap));
+    psm = (scoremap *) g_malloc0(sizeof(scoremap)); // zeroed: the fields not set below start at 0/FALSE
     psm->cubeScoreMap = cube;   // throughout this file: determines whether we want a cube scoremap or a move scoremap
     //colourBasedOn=ALL;     //default gauge; see also the option to set the starting gauge at the bottom
     // psm->describeUsing=DEFAULT_DESCRIPTION; //default description mode: NUMBERS, ENGLISH, BOTH -> moved to static variable
@@ -3227,15 +3369,19 @@ if needed (this was initially planned for some explanation text, which was then
 // **************************************************************************************************
     /* calculate values and set colours/text in the table */
 
-    /* For each i,j, fill sm->aaQuadrantData[i][j].ci, find equities, and set the text*/
-    CalcEquities(psm,0,FALSE,FALSE);
+    /* For each i,j, fill sm->aaQuadrantData[i][j].ci, find equities, and set the text.
+    The window is shown first, so that the quadrants can be coloured as they are computed. */
+
+    gtk_window_set_default_size(GTK_WINDOW(pwDialog), DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
+    g_object_weak_ref(G_OBJECT(pwDialog), DestroyDialog, psm);
+    gtk_widget_show_all(pwDialog);
+
+    if (CalcEquities(psm,0,FALSE,FALSE))
+        return; // closed meanwhile
     UpdateScoreMapVisual(psm);     //Update: (1) The color of each square (2) The hover text of each square
                                     //      (3) the row/col score labels (4) the gauge.
 
     /* modality */
 
-    gtk_window_set_default_size(GTK_WINDOW(pwDialog), DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
-    g_object_weak_ref(G_OBJECT(pwDialog), DestroyDialog, psm);
-
     GTKRunDialog(pwDialog);
 }
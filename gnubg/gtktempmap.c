@@ -43,6 +43,7 @@
 #include "gtkboard.h"
 #include "gtkwindows.h"
 #include "gtkcube.h"
+#include "multithread.h"
 
 #define SIZE_QUADRANT 52
 
@@ -52,6 +53,7 @@ typedef struct {
     matchstate *pms;
     float aarEquity[6][6];
     float rAverage;
+    int fAverage;               /* all the quadrants are computed */
 
     GtkWidget *aapwDA[6][6];
     GtkWidget *aapwe[6][6];
@@ -60,6 +62,7 @@ typedef struct {
     GtkWidget *pweAverage;
 
     int aaanMove[6][6][8];
+    int aafDone[6][6];          /* the quadrant holds the result of the last computation */
 
     gchar *szTitle;
 
@@ -81,6 +84,13 @@ typedef struct {
 
     int nSizeDie;
 
+    evalcontext ec;
+    int fComputing;
+    int iGeneration;
+    int fRestart;               /* the ply changed during the computation: start again once it has stopped */
+    int fDestroyed;             /* the dialog was closed during the computation: free everything once it has stopped */
+    guint idInitial;            /* idle source of the first computation, until it has run */
+
 } tempmapwidget;
 
 /* Retain these from one GTKShowTempMap() to the next */
@@ -88,93 +98,204 @@ static int fShowEquity = FALSE;
 static int fShowBestMove = FALSE;
 
 static int
-TempMapEquities(evalcontext * pec, matchstate * pms,
-                float aarEquity[6][6], int aaanMove[6][6][8], const gchar * szTitle, const float rFac)
+TempMapEquity(evalcontext * pec, const matchstate * pms, const int i, const int j, const float rFac,
+              float *prEquity, int anMove[8])
+/* Equity after the best move with the roll i+1, j+1 */
 {
 
-
-    int i, j;
     float arOutput[NUM_ROLLOUT_OUTPUTS];
     TanBoard anBoard;
-    int aaan[6][6][8];
-    float aar[6][6];
     cubeinfo ci;
     cubeinfo cix;
 
-    /* calculate equities */
-
     GetMatchStateCubeInfo(&cix, pms);
+    memcpy(&ci, &cix, sizeof ci);
 
-    if (szTitle && *szTitle) {
-        gchar *sz = g_strdup_printf(_("Calculating equities for %s"), szTitle);
-        ProgressStartValue(sz, 21);
-        g_free(sz);
-    } else
-        ProgressStartValue(_("Calculating equities"), 21);
+    /* find best move */
 
-    for (i = 0; i < 6; ++i)
-        for (j = 0; j <= i; ++j) {
+    memcpy(anBoard, pms->anBoard, sizeof(anBoard));
 
-            memcpy(&ci, &cix, sizeof ci);
+    if (FindBestMove(anMove, i + 1, j + 1, anBoard, &ci, pec, defaultFilters) < 0)
+        return -1;
 
-            /* find best move */
+    /* evaluate resulting position */
 
-            memcpy(anBoard, pms->anBoard, sizeof(anBoard));
+    SwapSides(anBoard);
+    ci.fMove = !ci.fMove;
 
-            if (FindBestMove(aaan[i][j], i + 1, j + 1, anBoard, &ci, pec, defaultFilters) < 0) {
-                ProgressEnd();
-                return -1;
-            }
+    if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, &ci, pec) < 0)
+        return -1;
 
-            /* evaluate resulting position */
+    InvertEvaluationR(arOutput, &cix);
 
-            SwapSides(anBoard);
-            ci.fMove = !ci.fMove;
+    if (!cix.nMatchTo && rFac != 1.0f)
+        arOutput[OUTPUT_CUBEFUL_EQUITY] *= rFac;
 
-            if (GeneralEvaluationE(arOutput, (ConstTanBoard) anBoard, &ci, pec) < 0) {
-                ProgressEnd();
-                return -1;
-            }
+    *prEquity = arOutput[OUTPUT_CUBEFUL_EQUITY];
 
-            InvertEvaluationR(arOutput, &cix);
+    return 0;
 
-            if (!cix.nMatchTo && rFac != 1.0f)
-                arOutput[OUTPUT_CUBEFUL_EQUITY] *= rFac;
+}
 
-            aar[i][j] = arOutput[OUTPUT_CUBEFUL_EQUITY];
-            aar[j][i] = arOutput[OUTPUT_CUBEFUL_EQUITY];
 
-            if (i != j)
-                memcpy(aaan[j][i], aaan[i][j], sizeof aaan[0][0]);
+typedef struct {
+    /* One roll of one map, computed on the thread pool */
+    Task task;
+    tempmapwidget *ptmw;
+    tempmap *ptm;
+    evalcontext ec;             /* own copy, since the user may change the ply before it runs */
+    float rFac;
+    int i, j;
+    int iGeneration;            /* of the computation that queued it */
+} tempmaptask;
 
-            ProgressValueAdd(1);
+static tempmapwidget *ptmwComputing = NULL;     /* for the progress callback, which gets no data */
 
-        }
+static void
+TempMapEquitiesMT(Task * pt)
+{
+    tempmaptask *pmt = (tempmaptask *) pt;
+    tempmap *ptm = pmt->ptm;
+    int i = pmt->i;
+    int j = pmt->j;
+    int anMove[8];
+    float r;
 
+    /* skipped if cancelled: the quadrant is then left blank */
 
+    if (MT_SafeGet(&pmt->ptmw->iGeneration) != pmt->iGeneration || fInterrupt)
+        return;
 
-    ProgressEnd();
+    if (TempMapEquity(&pmt->ec, ptm->pms, i, j, pmt->rFac, &r, anMove) < 0)
+        return;
 
-    memcpy(aarEquity, aar, sizeof aar);
-    memcpy(aaanMove, aaan, sizeof aaan);
+    ptm->aarEquity[i][j] = ptm->aarEquity[j][i] = r;
+    memcpy(ptm->aaanMove[i][j], anMove, sizeof anMove);
+    memcpy(ptm->aaanMove[j][i], anMove, sizeof anMove);
 
-    return 0;
+    MT_SafeSet(&ptm->aafDone[i][j], TRUE);
+    MT_SafeSet(&ptm->aafDone[j][i], TRUE);
+}
+
+static void UpdateTempMapEquities(tempmapwidget * ptmw);
+
+static gboolean
+TempMapProgress(gpointer UNUSED(unused))
+/* Called regularly while the rolls are evaluated: colours the quadrants done so far */
+{
+    ProgressValue(MT_GetDoneTasks());
+    if (ptmwComputing && !ptmwComputing->fDestroyed)
+        UpdateTempMapEquities(ptmwComputing);
+    return TRUE;
+}
 
+static void
+CancelTempMapEquities(tempmapwidget * ptmw)
+{
+    MT_SafeInc(&ptmw->iGeneration);
+    fInterrupt = TRUE;
 }
 
+static void
+FreeTempMap(tempmapwidget * ptmw)
+{
+    int i;
+
+    g_free(ptmw->achDice[0]);
+    g_free(ptmw->achDice[1]);
+    g_free(ptmw->achPips[0]);
+    g_free(ptmw->achPips[1]);
+
+    for (i = 0; i < ptmw->n; ++i) {
+        g_free(ptmw->atm[i].pms);
+        g_free(ptmw->atm[i].szTitle);
+    }
+
+    g_free(ptmw->atm);
+
+    g_free(ptmw);
+}
 
 static int
 CalcTempMapEquities(evalcontext * pec, tempmapwidget * ptmw)
+/* The 21 rolls of every map are evaluated on the thread pool and the map is updated as they come in.
+ * Since events are processed meanwhile, this can be called again (from the ply buttons) while a
+ * computation is under way: that one is then cancelled and started again with the new context.
+ * Returns -1 if the dialog was closed during the computation (ptmw is then freed), 0 otherwise. */
 {
 
-    int i;
+    int i, j, m;
+    GSList *plTasks = NULL;
+    GSList *pl;
+
+    ptmw->ec = *pec;
+
+    if (ptmw->fComputing) {
+        CancelTempMapEquities(ptmw);
+        ptmw->fRestart = TRUE;
+        return 0;
+    }
+
+  restart:
+    for (m = 0; m < ptmw->n; ++m) {
+        tempmap *ptm = &ptmw->atm[m];
+
+        for (i = 0; i < 6; ++i)
+            for (j = 0; j <= i; ++j) {
+                tempmaptask *pmt = (tempmaptask *) malloc(sizeof(tempmaptask));
+
+                pmt->task.fun = (AsyncFun) TempMapEquitiesMT;
+                pmt->task.data = pmt;
+                pmt->task.pLinkedTask = NULL;
+                pmt->ptmw = ptmw;
+                pmt->ptm = ptm;
+                pmt->ec = ptmw->ec;
+                pmt->rFac = (float) (ptm->pms->nCube / ptmw->atm[0].pms->nCube);
+                pmt->i = i;
+                pmt->j = j;
+                pmt->iGeneration = ptmw->iGeneration;
+                ptm->aafDone[i][j] = ptm->aafDone[j][i] = FALSE;
+
+                plTasks = g_slist_prepend(plTasks, pmt);
+            }
+    }
+
+    if (ptmw->n == 1 && ptmw->atm[0].szTitle && *ptmw->atm[0].szTitle) {
+        gchar *sz = g_strdup_printf(_("Calculating equities for %s"), ptmw->atm[0].szTitle);
+        ProgressStartValue(sz, 21);
+        g_free(sz);
+    } else
+        ProgressStartValue(_("Calculating equities"), 21 * ptmw->n);
+
+    /* plTasks is in reverse order, which is what the threads want as each of them takes the
+     * last task of its queue first; without threads they run in the order they are added */
+#if !defined(USE_MULTITHREAD)
+    plTasks = g_slist_reverse(plTasks);
+#endif
+    for (pl = plTasks; pl; pl = pl->next)
+        MT_AddTask((Task *) pl->data, TRUE);
+    g_slist_free(plTasks);
+    plTasks = NULL;
 
-    for (i = 0; i < ptmw->n; ++i)
-        if (TempMapEquities(pec, ptmw->atm[i].pms,
-                            ptmw->atm[i].aarEquity,
-                            ptmw->atm[i].aaanMove,
-                            ptmw->atm[i].szTitle, (float) (ptmw->atm[i].pms->nCube / ptmw->atm[0].pms->nCube)) < 0)
-            return -1;
+    ptmw->fComputing = TRUE;
+    ptmwComputing = ptmw;
+    MT_WaitForTasks(TempMapProgress, UI_UPDATETIME, FALSE);
+    ptmwComputing = NULL;
+    ptmw->fComputing = FALSE;
+
+    ProgressEnd();
+
+    if (ptmw->fDestroyed) {
+        fInterrupt = FALSE;
+        FreeTempMap(ptmw);
+        return -1;
+    }
+
+    if (ptmw->fRestart) {
+        fInterrupt = FALSE;
+        ptmw->fRestart = FALSE;
+        goto restart;
+    }
 
     return 0;
 
@@ -249,14 +370,20 @@ UpdateTempMapEquities(tempmapwidget * ptmw)
     int m;
     char szMove[FORMATEDMOVESIZE];
 
-    /* calc. min, max and average */
+    /* calc. min, max and average of the quadrants computed so far;
+     * the average is only shown once all of them are */
 
     rMax = -10000;
     rMin = +10000;
     for (m = 0; m < ptmw->n; ++m) {
         ptmw->atm[m].rAverage = 0.0f;
+        ptmw->atm[m].fAverage = TRUE;
         for (i = 0; i < 6; ++i)
             for (j = 0; j < 6; ++j) {
+                if (!MT_SafeGet(&ptmw->atm[m].aafDone[i][j])) {
+                    ptmw->atm[m].fAverage = FALSE;
+                    continue;
+                }
                 r = ptmw->atm[m].aarEquity[i][j];
                 ptmw->atm[m].rAverage += r;
                 if (r > rMax)
@@ -267,6 +394,11 @@ UpdateTempMapEquities(tempmapwidget * ptmw)
         ptmw->atm[m].rAverage /= 36.0f;
     }
 
+    if (rMax < rMin)
+        rMax = rMin = 0.0f;
+    else if (rMax == rMin)
+        rMax += 1e-6f;
+
     ptmw->rMax = rMax;
     ptmw->rMin = rMin;
 
@@ -279,7 +411,16 @@ UpdateTempMapEquities(tempmapwidget * ptmw)
         for (i = 0; i < 6; ++i)
             for (j = 0; j < 6; ++j) {
 
-                gchar *sz = g_strdup_printf("%s [%s]",
+                gchar *sz;
+
+                if (!MT_SafeGet(&ptmw->atm[m].aafDone[i][j])) {
+                    UpdateStyle(ptmw->atm[m].aapwDA[i][j], 0.0f);
+                    gtk_widget_set_tooltip_text(ptmw->atm[m].aapwe[i][j], NULL);
+                    gtk_widget_queue_draw(ptmw->atm[m].aapwDA[i][j]);
+                    continue;
+                }
+
+                sz = g_strdup_printf("%s [%s]",
                                             GetEquityString(ptmw->atm[m].aarEquity[i][j],
                                                             &ci, ptmw->fInvert),
                                             FormatMove(szMove, (ConstTanBoard) ptmw->atm[m].pms->anBoard,
@@ -294,10 +435,14 @@ UpdateTempMapEquities(tempmapwidget * ptmw)
 
             }
 
-        SetStyle(ptmw->atm[m].pwAverage, ptmw->atm[m].rAverage, rMin, rMax, ptmw->fInvert);
-
-        gtk_widget_set_tooltip_text(ptmw->atm[m].pweAverage,
-                                    GetEquityString(ptmw->atm[m].rAverage, &ci, ptmw->fInvert));
+        if (ptmw->atm[m].fAverage) {
+            SetStyle(ptmw->atm[m].pwAverage, ptmw->atm[m].rAverage, rMin, rMax, ptmw->fInvert);
+            gtk_widget_set_tooltip_text(ptmw->atm[m].pweAverage,
+                                        GetEquityString(ptmw->atm[m].rAverage, &ci, ptmw->fInvert));
+        } else {
+            UpdateStyle(ptmw->atm[m].pwAverage, 0.0f);
+            gtk_widget_set_tooltip_text(ptmw->atm[m].pweAverage, NULL);
+        }
         gtk_widget_queue_draw(ptmw->atm[m].pwAverage);
 
     }
@@ -353,6 +498,11 @@ DrawQuadrant(GtkWidget * pw, cairo_t * cr, tempmapwidget * ptmw)
         j = -1;
     }
 
+    /* nothing to write until it is computed */
+
+    if (j >= 0 ? !MT_SafeGet(&ptmw->atm[m].aafDone[i][j]) : !ptmw->atm[m].fAverage)
+        return TRUE;
+
     str = g_string_new("");
 
     if (ptmw->fShowEquity) {
@@ -510,8 +660,8 @@ TempMapPlyToggled(GtkWidget * pw, tempmapwidget * ptmw)
 
         ec.nPlies = *pi;
 
-        if (CalcTempMapEquities(&ec, ptmw))
-            return;
+        if (CalcTempMapEquities(&ec, ptmw) < 0 || ptmw->fComputing)
+            return;             /* closed meanwhile, or still going on in an outer call */
 
         UpdateTempMapEquities(ptmw);
 
@@ -550,31 +700,40 @@ static void
 DestroyDialog(gpointer p, GObject * UNUSED(obj))
 {
     tempmapwidget *ptmw = (tempmapwidget *) p;
-    int i;
 
-    /* garbage collect */
+    /* the first computation may not have started yet */
 
-    g_free(ptmw->achDice[0]);
-    g_free(ptmw->achDice[1]);
-    g_free(ptmw->achPips[0]);
-    g_free(ptmw->achPips[1]);
+    if (ptmw->idInitial)
+        g_source_remove(ptmw->idInitial);
 
-    for (i = 0; i < ptmw->n; ++i) {
-        g_free(ptmw->atm[i].pms);
-        g_free(ptmw->atm[i].szTitle);
-    }
+    /* garbage collect, or let CalcTempMapEquities() do it once its computation has stopped */
 
-    g_free(ptmw->atm);
+    if (ptmw->fComputing) {
+        ptmw->fDestroyed = TRUE;
+        CancelTempMapEquities(ptmw);
+    } else
+        FreeTempMap(ptmw);
 
-    g_free(ptmw);
+}
+
+static gboolean
+InitialTempMapEquities(gpointer p)
+{
+    tempmapwidget *ptmw = (tempmapwidget *) p;
+
+    ptmw->idInitial = 0;
 
+    if (CalcTempMapEquities(&ptmw->ec, ptmw) == 0 && !ptmw->fComputing)
+        UpdateTempMapEquities(ptmw);
+
+    return FALSE;
 }
 
 extern void
 GTKShowTempMap(const matchstate ams[], const int n, gchar * aszTitle[], const int fInvert)
 {
 
-    evalcontext ec = { TRUE, 0, FALSE, TRUE, 0.0 };
+    const evalcontext ec = { TRUE, 0, FALSE, TRUE, 0.0 };
 
     tempmapwidget *ptmw;
     int *pi;
@@ -605,7 +764,7 @@ GTKShowTempMap(const matchstate ams[], const int n, gchar * aszTitle[], const in
     }
                                
 
-    ptmw = (tempmapwidget *) g_malloc(sizeof(tempmapwidget));
+    ptmw = (tempmapwidget *) g_malloc0(sizeof(tempmapwidget));
     ptmw->fShowBestMove = fShowBestMove;
     ptmw->fShowEquity = fShowEquity;
     ptmw->fInvert = fInvert;
@@ -614,7 +773,7 @@ GTKShowTempMap(const matchstate ams[], const int n, gchar * aszTitle[], const in
     ptmw->achDice[0] = ptmw->achDice[1] = NULL;
     ptmw->achPips[0] = ptmw->achPips[1] = NULL;
 
-    ptmw->atm = (tempmap *) g_malloc(n * sizeof(tempmap));
+    ptmw->atm = (tempmap *) g_malloc0(n * sizeof(tempmap));
     for (i = 0; i < n; ++i) {
         ptmw->atm[i].pms = (matchstate *) g_malloc(sizeof(matchstate));
         memcpy(ptmw->atm[i].pms, &ams[i], sizeof(matchstate));
@@ -895,10 +1054,11 @@ GTKShowTempMap(const matchstate ams[], const int n, gchar * aszTitle[], const in
     g_signal_connect(G_OBJECT(pw), "toggled", G_CALLBACK(ShowBestMoveToggled), ptmw);
 
 
-    /* update */
+    /* update, once the dialog is shown so that the quadrants appear as they are computed */
 
-    CalcTempMapEquities(&ec, ptmw);
+    ptmw->ec = ec;
     UpdateTempMapEquities(ptmw);
+    ptmw->idInitial = g_idle_add(InitialTempMapEquities, ptmw);
 
     /* modality */
 
@@ -20,37 +20,86 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if !defined(WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "cache.h"
 #include "positionid.h"
 
+#if defined(USE_SIMD_INSTRUCTIONS) && (defined(USE_SSE2) || defined(USE_AVX))
+#include <emmintrin.h>
+#define CACHE_SIMD_TAGS 1
+#endif
+
 #if defined(USE_MULTITHREAD)
 #include "multithread.h"
 
-#if defined(__GNUC__) && ( \
-    (( __GNUC__ * 100 + __GNUC_MINOR__ >= 401 ) \
-      && (defined (__i486) || defined (__x86_64))) \
-  || (( __GNUC__ * 100 + __GNUC_MINOR__ >= 404 ) \
-      && defined (__i386))			 \
-  )
+/*
+ * Each set is protected by a sequence count: writers make it odd while
+ * they update the set and even again when they are done. Readers never
+ * write to it: they read the set between two loads of the count and
+ * retry if it changed (or was odd), so that hot sets are not bounced
+ * between cores by lookups.
+ */
+
+#if defined(__ATOMIC_ACQUIRE)
+
+static inline void
+cache_pause(void)
+{
+#if defined(__i386) || defined(__x86_64)
+    __asm__ __volatile__ ("pause":::"memory");
+#endif
+}
+
+static inline int
+cache_read_begin(const evalCache * pc, uint32_t k)
+{
+    int n;
+
+    while ((n = __atomic_load_n(&pc->tags[k].nSeq, __ATOMIC_ACQUIRE)) & 1)
+        cache_pause();
+
+    return n;
+}
+
+/* Returns TRUE if the set was modified since cache_read_begin() */
+
+static inline int
+cache_read_end(const evalCache * pc, uint32_t k, int n)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pc->tags[k].nSeq, __ATOMIC_RELAXED) != n;
+}
 
 static inline void
 cache_lock(evalCache * pc, uint32_t k)
 {
-    while (__sync_lock_test_and_set(&(pc->entries[k].lock), 1))
-        while (__sync_fetch_and_add(&pc->entries[k].lock, 0))
-            __asm__ __volatile__ ("pause":::"memory");
+    int n = __atomic_load_n(&pc->tags[k].nSeq, __ATOMIC_RELAXED);
+
+    while ((n & 1) || !__atomic_compare_exchange_n(&pc->tags[k].nSeq, &n, n + 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        cache_pause();
+        n = __atomic_load_n(&pc->tags[k].nSeq, __ATOMIC_RELAXED);
+    }
+    /* the odd count must be visible before the set is modified */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
 static inline void
 cache_unlock(evalCache * pc, uint32_t k)
 {
-    __sync_lock_release(&(pc->entries[k].lock));
+    __atomic_store_n(&pc->tags[k].nSeq, pc->tags[k].nSeq + 1, __ATOMIC_RELEASE);
 }
 
-#else	/* not x86 or older gcc: no suitable intrinsics */
+#else	/* no atomic builtins: readers take the lock too */
 
 static inline void
 WaitForLock(volatile int *lock)
@@ -63,14 +112,29 @@ WaitForLock(volatile int *lock)
 static inline void
 cache_lock(evalCache * pc, uint32_t k)
 {
-    if (MT_SafeIncCheck(&(pc->entries[k].lock)))
-        WaitForLock(&(pc->entries[k].lock));
+    if (MT_SafeIncCheck(&(pc->tags[k].nSeq)))
+        WaitForLock(&(pc->tags[k].nSeq));
 }
 
 static inline void
 cache_unlock(evalCache * pc, uint32_t k)
 {
-    MT_SafeDec(&(pc->entries[k].lock));
+    MT_SafeDec(&(pc->tags[k].nSeq));
+}
+
+static inline int
+cache_read_begin(evalCache * pc, uint32_t k)
+{
+    cache_lock(pc, k);
+    return 0;
+}
+
+static inline int
+cache_read_end(evalCache * pc, uint32_t k, int n)
+{
+    (void) n;
+    cache_unlock(pc, k);
+    return 0;
 }
 
 #endif
@@ -81,6 +145,8 @@ cache_unlock(evalCache * pc, uint32_t k)
 int
 CacheCreate(evalCache * pc, unsigned int s)
 {
+    unsigned int cSets;
+
 #if CACHE_STATS
     pc->cLookup = 0;
     pc->cHit = 0;
@@ -96,12 +162,17 @@ CacheCreate(evalCache * pc, unsigned int s)
         s &= (s - 1);
 
     pc->size = (s < pc->size) ? 2 * s : s;
-    pc->hashMask = (pc->size >> 1) - 1;
+    cSets = (pc->size > CACHE_WAYS) ? pc->size / CACHE_WAYS : 1;
+    pc->hashMask = cSets - 1;
 
-    pc->entries = (cacheNode *) malloc((pc->size / 2) * sizeof(*pc->entries));
-    if (pc->entries == NULL)
+    /* tags first, aligned on a cache line, then the entries */
+    pc->pAlloc = malloc(cSets * (sizeof(cacheTags) + CACHE_WAYS * sizeof(cacheNodeDetail)) + CACHE_LINE);
+    if (pc->pAlloc == NULL)
         return -1;
 
+    pc->tags = (cacheTags *) (((size_t) pc->pAlloc + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1));
+    pc->entries = (cacheNodeDetail *) (pc->tags + cSets);
+
     CacheFlush(pc);
     return 0;
 }
@@ -145,11 +216,120 @@ GetHashKey(uint32_t hashMask, const cacheNodeDetail * restrict e)
     return (hash & hashMask);
 }
 
+/* Fingerprint of an entry within its set. It must not depend on the
+ * set index only, so it is computed independently of GetHashKey().
+ * 0 marks an unused way. */
+
+static inline uint32_t
+GetTag(const cacheNodeDetail * restrict e)
+{
+    uint32_t tag = (uint32_t) e->nEvalContext * 0x9e3779b1;
+    int i;
+
+    for (i = 0; i < 7; i++) {
+        tag = (tag + e->key.data[i]) * 0x9e3779b1;
+        tag ^= tag >> 15;
+    }
+
+    return tag ? tag : 1;
+}
+
+/* Bit mask of the ways of a set whose tag is equal to tag */
+
+static inline unsigned int
+MatchTags(const cacheTags * restrict pct, uint32_t tag)
+{
+#if defined(CACHE_SIMD_TAGS)
+    __m128i const t = _mm_set1_epi32((int) tag);
+    __m128i const lo = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) pct->anTag), t);
+    __m128i const hi = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *) (pct->anTag + 4)), t);
+
+    return (unsigned int) (_mm_movemask_ps(_mm_castsi128_ps(lo)) | (_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4));
+#else
+    unsigned int i, m = 0;
+
+    for (i = 0; i < CACHE_WAYS; i++)
+        m |= (unsigned int) (pct->anTag[i] == tag) << i;
+
+    return m;
+#endif
+}
+
+/*
+ * Tree pseudo-LRU over 8 ways: bit 0 is the root, bits 1-2 the second
+ * level, bits 3-6 the leaves. Each bit points to the half that was
+ * used less recently.
+ */
+
+static inline uint32_t
+TouchLRU(uint32_t nLRU, unsigned int iWay)
+{
+    unsigned int const b2 = iWay >> 2, b1 = (iWay >> 1) & 1, b0 = iWay & 1;
+    unsigned int const n1 = 1 + b2, n2 = 3 + (iWay >> 1);
+
+    nLRU = (nLRU & ~1u) | (b2 ^ 1);
+    nLRU = (nLRU & ~(1u << n1)) | ((b1 ^ 1) << n1);
+    return (nLRU & ~(1u << n2)) | ((b0 ^ 1) << n2);
+}
+
+static inline unsigned int
+VictimLRU(const cacheTags * pct)
+{
+    unsigned int b2, b1, b0, i;
+
+    /* use a free way if there is one */
+    for (i = 0; i < CACHE_WAYS; i++)
+        if (!pct->anTag[i])
+            return i;
+
+    b2 = pct->nLRU & 1;
+    b1 = (pct->nLRU >> (1 + b2)) & 1;
+    b0 = (pct->nLRU >> (3 + (b2 << 1 | b1))) & 1;
+
+    return b2 << 2 | b1 << 1 | b0;
+}
+
+/* Look for e in set l. Returns the way or -1 */
+
+static inline int
+FindInSet(const evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
+{
+    unsigned int m = MatchTags(pc->tags + l, GetTag(e));
+    int iWay;
+
+    for (iWay = 0; m; ++iWay, m >>= 1) {
+        const cacheNodeDetail *pnd = pc->entries + l * CACHE_WAYS + iWay;
+
+        if ((m & 1) && EqualKeys(pnd->key, e->key) && pnd->nEvalContext == e->nEvalContext)
+            return iWay;
+    }
+
+    return -1;
+}
+
+static inline void
+AddToSet(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
+{
+    cacheTags *pct = pc->tags + l;
+    /* Another thread may have added the same entry since our lookup
+     * missed: replace it rather than keep two copies in the set */
+    int const iFound = FindInSet(pc, e, l);
+    unsigned int const iWay = (iFound >= 0) ? (unsigned int) iFound : VictimLRU(pct);
+
+    pc->entries[l * CACHE_WAYS + iWay] = *e;
+    pct->anTag[iWay] = GetTag(e);
+    pct->nLRU = TouchLRU(pct->nLRU, iWay);
+}
 
 uint32_t
 CacheLookupWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, float * restrict arOut, float * restrict arCubeful)
 {
     uint32_t const l = GetHashKey(pc->hashMask, e);
+    float ar[6];
+    int iWay;
+#if defined(USE_MULTITHREAD)
+    int n;
+#endif
 
 #if CACHE_STATS
 #if defined(USE_MULTITHREAD)
@@ -160,30 +340,23 @@ CacheLookupWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict
 #endif
 
 #if defined(USE_MULTITHREAD)
-    cache_lock(pc, l);
+    do {
+        n = cache_read_begin(pc, l);
 #endif
-
-    if (!EqualKeys(pc->entries[l].nd_primary.key, e->key) || pc->entries[l].nd_primary.nEvalContext != e->nEvalContext) {       /* Not in primary slot */
-        if (!EqualKeys(pc->entries[l].nd_secondary.key, e->key) || pc->entries[l].nd_secondary.nEvalContext != e->nEvalContext) {       /* Cache miss */
+        if ((iWay = FindInSet(pc, e, l)) >= 0)
+            memcpy(ar, pc->entries[l * CACHE_WAYS + iWay].ar, sizeof(ar));
 #if defined(USE_MULTITHREAD)
-            cache_unlock(pc, l);
+    } while (cache_read_end(pc, l, n));
 #endif
-            return l;
-        } else {                /* Found in second slot, promote "hot" entry */
-            cacheNodeDetail tmp = pc->entries[l].nd_primary;
 
-            pc->entries[l].nd_primary = pc->entries[l].nd_secondary;
-            pc->entries[l].nd_secondary = tmp;
-        }
-    }
-    /* Cache hit */
-    memcpy(arOut, pc->entries[l].nd_primary.ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
-    if (arCubeful)
-        *arCubeful = pc->entries[l].nd_primary.ar[5];   /* Cubeful equity stored in slot 5 */
+    if (iWay < 0)               /* Cache miss */
+        return l;
 
-#if defined(USE_MULTITHREAD)
-    cache_unlock(pc, l);
-#endif
+    /* Cache hit. The pseudo-LRU bits are left alone: updating them
+     * would make readers write to the set */
+    memcpy(arOut, ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
+    if (arCubeful)
+        *arCubeful = ar[5];     /* Cubeful equity stored in slot 5 */
 
 #if CACHE_STATS
 #if defined(USE_MULTITHREAD)
@@ -200,25 +373,22 @@ uint32_t
 CacheLookupNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, float *restrict arOut, float * restrict arCubeful)
 {
     uint32_t const l = GetHashKey(pc->hashMask, e);
+    const cacheNodeDetail *pnd;
+    int iWay;
 
 #if CACHE_STATS
     ++pc->cLookup;
 #endif
-    if (!EqualKeys(pc->entries[l].nd_primary.key, e->key) || pc->entries[l].nd_primary.nEvalContext != e->nEvalContext) {       /* Not in primary slot */
-        if (!EqualKeys(pc->entries[l].nd_secondary.key, e->key) || pc->entries[l].nd_secondary.nEvalContext != e->nEvalContext) {       /* Cache miss */
-            return l;
-        } else {                /* Found in second slot, promote "hot" entry */
-            cacheNodeDetail tmp = pc->entries[l].nd_primary;
-
-            pc->entries[l].nd_primary = pc->entries[l].nd_secondary;
-            pc->entries[l].nd_secondary = tmp;
-        }
-    }
+    if ((iWay = FindInSet(pc, e, l)) < 0)       /* Cache miss */
+        return l;
 
     /* Cache hit */
-    memcpy(arOut, pc->entries[l].nd_primary.ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
+    pnd = pc->entries + l * CACHE_WAYS + iWay;
+    memcpy(arOut, pnd->ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
     if (arCubeful)
-        *arCubeful = pc->entries[l].nd_primary.ar[5];   /* Cubeful equity stored in slot 5 */
+        *arCubeful = pnd->ar[5];        /* Cubeful equity stored in slot 5 */
+
+    pc->tags[l].nLRU = TouchLRU(pc->tags[l].nLRU, (unsigned int) iWay);
 
 #if CACHE_STATS
     ++pc->cHit;
@@ -234,8 +404,7 @@ CacheAddWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e,
     cache_lock(pc, l);
 #endif
 
-    pc->entries[l].nd_secondary = pc->entries[l].nd_primary;
-    pc->entries[l].nd_primary = *e;
+    AddToSet(pc, e, l);
 
 #if defined(USE_MULTITHREAD)
     cache_unlock(pc, l);
@@ -250,25 +419,25 @@ CacheAddWithLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e,
 #endif
 }
 
-/* CacheAddNoLocking() is inlined and in cache.h */
+void
+CacheAddNoLocking(evalCache * restrict pc, const cacheNodeDetail * restrict e, uint32_t l)
+{
+    AddToSet(pc, e, l);
+#if CACHE_STATS
+    ++pc->nAdds;
+#endif
+}
 
 void
 CacheDestroy(const evalCache * pc)
 {
-    free(pc->entries);
+    free(pc->pAlloc);
 }
 
 void
 CacheFlush(const evalCache * pc)
 {
-    unsigned int k;
-    for (k = 0; k < pc->size / 2; ++k) {
-        pc->entries[k].nd_primary.key.data[0] = (unsigned int) -1;
-        pc->entries[k].nd_secondary.key.data[0] = (unsigned int) -1;
-#if defined(USE_MULTITHREAD)
-        pc->entries[k].lock = 0;
-#endif
-    }
+    memset(pc->tags, 0, (pc->hashMask + 1) * sizeof(cacheTags));
 }
 
 int
@@ -297,3 +466,276 @@ CacheStats(const evalCache * pc, unsigned int *pcLookup, unsigned int *pcHit, un
         *pcUsed = pc->nAdds;
 }
 #endif
+
+/* Persistent cache */
+
+#define PERSIST_MAGIC "GNUbgPC"
+#define PERSIST_VERSION 1
+#define PERSIST_HEADER 64       /* keeps the entries 64 byte aligned */
+
+typedef struct {
+    char szMagic[8];
+    uint32_t nVersion;
+    uint32_t size;
+    uint32_t nEntrySize;
+} persistHeader;
+
+static inline uint32_t
+MurmurMix(uint32_t hash, uint32_t k)
+{
+    k *= 0xcc9e2d51;
+    k = (k << 15) | (k >> (32 - 15));
+    k *= 0x1b873593;
+
+    hash ^= k;
+    hash = (hash << 13) | (hash >> (32 - 13));
+    return hash * 5 + 0xe6546b64;
+}
+
+extern uint32_t
+CacheStamp(uint32_t nStamp, const void *p, size_t cb)
+{
+    const unsigned char *pch = (const unsigned char *) p;
+    size_t i;
+
+    for (i = 0; i + 4 <= cb; i += 4) {
+        uint32_t k;
+
+        memcpy(&k, pch + i, 4);
+        nStamp = MurmurMix(nStamp, k);
+    }
+    for (; i < cb; i++)
+        nStamp = MurmurMix(nStamp, pch[i]);
+
+    return nStamp;
+}
+
+static uint32_t
+PersistCheck(uint32_t nStamp, const cacheNodeDetail * e)
+{
+    uint32_t anWords[sizeof(cacheNodeDetail) / 4];
+    uint32_t hash = nStamp;
+    unsigned int i;
+
+    memcpy(anWords, e, sizeof(anWords));
+    for (i = 0; i < sizeof(anWords) / 4; i++)
+        hash = MurmurMix(hash, anWords[i]);
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+
+    /* 0 marks unused entries */
+    return hash ? hash : 1;
+}
+
+static void
+PersistCacheInit(persistCache * ppc)
+{
+    persistHeader *ph = (persistHeader *) ppc->pMap;
+
+    memset(ppc->pMap, 0, ppc->cbMap);
+    memcpy(ph->szMagic, PERSIST_MAGIC, sizeof(PERSIST_MAGIC));
+    ph->nVersion = PERSIST_VERSION;
+    ph->size = ppc->size;
+    ph->nEntrySize = sizeof(persistNode);
+}
+
+static int
+PersistHeaderKnown(const persistHeader * ph)
+/* a persistent cache of this format, whatever its size */
+{
+    return !memcmp(ph->szMagic, PERSIST_MAGIC, sizeof(PERSIST_MAGIC)) &&
+        ph->nVersion == PERSIST_VERSION && ph->nEntrySize == sizeof(persistNode);
+}
+
+static int
+PersistCacheValid(const persistCache * ppc)
+{
+    const persistHeader *ph = (const persistHeader *) ppc->pMap;
+
+    return PersistHeaderKnown(ph) && ph->size == ppc->size;
+}
+
+#if defined(WIN32)
+static int
+PersistFileOurs(const char *szFile)
+/* The file may be written: it is missing, empty or a persistent cache.
+ * Any other file is left alone, in case the name was mistyped */
+{
+    persistHeader ph;
+    size_t cb;
+    FILE *pf;
+
+    if ((pf = fopen(szFile, "rb")) == NULL)
+        return errno == ENOENT;
+
+    cb = fread(&ph, 1, sizeof(ph), pf);
+    fclose(pf);
+
+    return cb == 0 || (cb == sizeof(ph) && PersistHeaderKnown(&ph));
+}
+#endif
+
+extern int
+PersistCacheOpen(persistCache * ppc, const char *szFile, unsigned int s)
+{
+    unsigned int size = s;
+
+    ppc->entries = NULL;
+    ppc->pMap = NULL;
+    ppc->cAdds = 0;
+
+    if (s < 2 || s > 1u << 31)
+        return -1;
+
+    while ((s & (s - 1)) != 0)
+        s &= (s - 1);
+    ppc->size = (s < size) ? 2 * s : s;
+    ppc->hashMask = ppc->size - 1;
+    ppc->cbMap = PERSIST_HEADER + (size_t) ppc->size * sizeof(persistNode);
+
+#if !defined(WIN32)
+    {
+        struct stat st;
+        persistHeader ph;
+        int fNew;
+
+        if ((ppc->fd = open(szFile, O_RDWR | O_CREAT, 0666)) < 0)
+            return -1;
+
+        if (fstat(ppc->fd, &st)) {
+            close(ppc->fd);
+            return -1;
+        }
+
+        /* only a new or empty file, or a cache, may be resized and
+         * overwritten: anything else is left alone, in case the name
+         * was mistyped */
+        if (!S_ISREG(st.st_mode) || (st.st_size > 0
+                                     && (pread(ppc->fd, &ph, sizeof(ph), 0) != (ssize_t) sizeof(ph)
+                                         || !PersistHeaderKnown(&ph)))) {
+            close(ppc->fd);
+            return -2;
+        }
+
+        fNew = (size_t) st.st_size != ppc->cbMap;
+        if (fNew && ftruncate(ppc->fd, (off_t) ppc->cbMap)) {
+            close(ppc->fd);
+            return -1;
+        }
+
+        /* pages are read lazily as they are looked up */
+        ppc->pMap = mmap(NULL, ppc->cbMap, PROT_READ | PROT_WRITE, MAP_SHARED, ppc->fd, 0);
+        if (ppc->pMap == MAP_FAILED) {
+            ppc->pMap = NULL;
+            close(ppc->fd);
+            return -1;
+        }
+
+        if (fNew || !PersistCacheValid(ppc))
+            PersistCacheInit(ppc);
+    }
+#else
+    {
+        /* no shared mapping: read the file in memory, written back by PersistCacheSync() */
+        FILE *pf;
+
+        if (!PersistFileOurs(szFile))
+            return -2;
+
+        if ((ppc->pMap = malloc(ppc->cbMap)) == NULL)
+            return -1;
+
+        if ((pf = fopen(szFile, "rb")) != NULL) {
+            if (fread(ppc->pMap, 1, ppc->cbMap, pf) != ppc->cbMap || !PersistCacheValid(ppc))
+                PersistCacheInit(ppc);
+            fclose(pf);
+        } else
+            PersistCacheInit(ppc);
+        ppc->fd = -1;
+    }
+#endif
+
+    ppc->szFile = strdup(szFile);
+    ppc->entries = (persistNode *) ((char *) ppc->pMap + PERSIST_HEADER);
+
+    return 0;
+}
+
+extern void
+PersistCacheSync(persistCache * ppc)
+{
+    if (!ppc->entries)
+        return;
+
+#if !defined(WIN32)
+    msync(ppc->pMap, ppc->cbMap, MS_ASYNC);
+#else
+    {
+        FILE *pf;
+
+        /* the file may have been replaced since it was opened */
+        if (!PersistFileOurs(ppc->szFile))
+            return;
+
+        if ((pf = fopen(ppc->szFile, "wb")) != NULL) {
+            fwrite(ppc->pMap, 1, ppc->cbMap, pf);
+            fclose(pf);
+        }
+    }
+#endif
+}
+
+extern void
+PersistCacheClose(persistCache * ppc)
+{
+    if (!ppc->entries)
+        return;
+
+#if !defined(WIN32)
+    msync(ppc->pMap, ppc->cbMap, MS_SYNC);
+    munmap(ppc->pMap, ppc->cbMap);
+    close(ppc->fd);
+#else
+    PersistCacheSync(ppc);
+    free(ppc->pMap);
+#endif
+
+    free(ppc->szFile);
+    ppc->szFile = NULL;
+    ppc->entries = NULL;
+    ppc->pMap = NULL;
+}
+
+extern int
+PersistCacheLookup(const persistCache * ppc, const cacheNodeDetail * e, float *arOut)
+{
+    persistNode pn;
+
+    /* copy first: another thread may be writing the entry */
+    pn = ppc->entries[GetHashKey(ppc->hashMask, e)];
+
+    if (!EqualKeys(pn.nd.key, e->key) || pn.nd.nEvalContext != e->nEvalContext
+        || pn.nCheck != PersistCheck(ppc->nStamp, &pn.nd))
+        return 0;
+
+    memcpy(arOut, pn.nd.ar, sizeof(float) * 5 /*NUM_OUTPUTS */ );
+    return 1;
+}
+
+extern unsigned int
+PersistCacheAdd(persistCache * ppc, const cacheNodeDetail * e)
+{
+    persistNode pn;
+
+    pn.nd = *e;
+    pn.nCheck = PersistCheck(ppc->nStamp, e);
+    pn.nUnused = 0;
+    ppc->entries[GetHashKey(ppc->hashMask, e)] = pn;
+#if defined(USE_MULTITHREAD)
+    return (unsigned int) MT_SafeIncValue(&ppc->cAdds);
+#else
+    return (unsigned int) ++ppc->cAdds;
+#endif
+}
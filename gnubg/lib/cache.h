@@ -40,22 +40,38 @@ typedef struct {
     float ar[6];
 } cacheNodeDetail;
 
+/*
+ * The cache is set associative: a key maps to a set of CACHE_WAYS
+ * entries. The tags of a set (a 32 bit fingerprint of each entry, 0 if
+ * unused), its pseudo-LRU bits and its sequence count fill exactly one 64 byte
+ * aligned cache line, so that a miss only reads that line. The
+ * entries themselves are stored apart and only read when a tag matches.
+ */
+
+#define CACHE_WAYS 8
+#define CACHE_LINE 64
+
 typedef struct {
-    cacheNodeDetail nd_primary;
-    cacheNodeDetail nd_secondary;
+    uint32_t anTag[CACHE_WAYS];
+    uint32_t nLRU;              /* tree pseudo-LRU, CACHE_WAYS - 1 bits */
 #if defined(USE_MULTITHREAD)
-    int lock;
+    int nSeq;                   /* odd while the set is being updated */
+#else
+    int unused;
 #endif
-} cacheNode;
+    uint32_t anPad[(CACHE_LINE - (CACHE_WAYS + 2) * sizeof(uint32_t)) / sizeof(uint32_t)];
+} cacheTags;
 
 /* name used in eval.c */
 typedef cacheNodeDetail evalcache;
 
 typedef struct {
-    cacheNode *entries;
+    cacheTags *tags;            /* one per set, CACHE_LINE aligned */
+    cacheNodeDetail *entries;   /* CACHE_WAYS per set */
+    void *pAlloc;
 
     unsigned int size;
-    uint32_t hashMask;
+    uint32_t hashMask;          /* number of sets - 1 */
 
 #if CACHE_STATS
     unsigned int nAdds;
@@ -74,17 +90,10 @@ int CacheResize(evalCache * pc, unsigned int cNew);
 unsigned int CacheLookupWithLocking(evalCache * pc, const cacheNodeDetail * e, float *arOut, float *arCubeful);
 unsigned int CacheLookupNoLocking(evalCache * pc, const cacheNodeDetail * e, float *arOut, float *arCubeful);
 
+/* add e to set l, over an entry with the same key if there is one,
+ * else over the least recently used one */
 void CacheAddWithLocking(evalCache * pc, const cacheNodeDetail * e, uint32_t l);
-
-static inline void
-CacheAddNoLocking(evalCache * pc, const cacheNodeDetail * e, const uint32_t l)
-{
-    pc->entries[l].nd_secondary = pc->entries[l].nd_primary;
-    pc->entries[l].nd_primary = *e;
-#if CACHE_STATS
-    ++pc->nAdds;
-#endif
-}
+void CacheAddNoLocking(evalCache * pc, const cacheNodeDetail * e, uint32_t l);
 
 void CacheFlush(const evalCache * pc);
 void CacheDestroy(const evalCache * pc);
@@ -93,10 +102,54 @@ void CacheDestroy(const evalCache * pc);
 void CacheStats(const evalCache * pc, unsigned int *pcLookup, unsigned int *pcHit, unsigned int *pcUsed);
 #endif
 
+/* Index of the set of e, also the value returned by CacheLookup() on a miss */
 #if defined(HAVE_FUNC_ATTRIBUTE_PURE)
 uint32_t GetHashKey(uint32_t hashMask, const cacheNodeDetail * e) __attribute((pure));
 #else
 uint32_t GetHashKey(uint32_t hashMask, const cacheNodeDetail * e);
 #endif
 
+/*
+ * Persistent cache: a direct mapped table in a file mapped in memory,
+ * so that evaluations survive restarts.
+ * Each entry carries a check word computed from its contents and from
+ * a stamp identifying what the evaluations depend on (weights, match
+ * equity table...). Entries made with another stamp, or torn by
+ * concurrent writers, fail the check and are treated as misses, so no
+ * locking is needed.
+ */
+
+typedef struct {
+    cacheNodeDetail nd;
+    uint32_t nCheck;
+    uint32_t nUnused;           /* pad to 64 bytes, one cache line */
+} persistNode;
+
+typedef struct {
+    persistNode *entries;       /* NULL if no persistent cache is open */
+    void *pMap;
+    size_t cbMap;
+    int fd;
+    char *szFile;
+    unsigned int size;
+    uint32_t hashMask;
+    uint32_t nStamp;
+    int cAdds;                  /* updated atomically */
+} persistCache;
+
+/* Size will be adjusted to a power of 2. An existing cache of another
+ * size is reinitialised. Returns -2, leaving the file
+ * untouched, if it is neither empty nor a persistent cache */
+int PersistCacheOpen(persistCache * ppc, const char *szFile, unsigned int size);
+void PersistCacheSync(persistCache * ppc);
+void PersistCacheClose(persistCache * ppc);
+
+/* returns 1 and fills arOut (NUM_OUTPUTS) on a hit */
+int PersistCacheLookup(const persistCache * ppc, const cacheNodeDetail * e, float *arOut);
+/* Returns the number of adds since the cache was opened */
+unsigned int PersistCacheAdd(persistCache * ppc, const cacheNodeDetail * e);
+
+/* Accumulate data into a stamp */
+uint32_t CacheStamp(uint32_t nStamp, const void *p, size_t cb);
+
 #endif
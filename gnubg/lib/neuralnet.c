@@ -27,6 +27,7 @@
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
+#include <math.h>
 
 #include "neuralnet.h"
 #include "simd.h"
@@ -42,6 +43,8 @@ NeuralNetCreate(neuralnet * pnn, unsigned int cInput, unsigned int cHidden,
     pnn->rBetaHidden = rBetaHidden;
     pnn->rBetaOutput = rBetaOutput;
     pnn->nTrained = 0;
+    pnn->asHiddenWeightQ = NULL;
+    pnn->arHiddenScaleQ = NULL;
 
     if ((pnn->arHiddenWeight = sse_malloc(cHidden * cInput * sizeof(float))) == NULL)
         return -1;
@@ -78,6 +81,93 @@ NeuralNetDestroy(neuralnet * pnn)
     pnn->arHiddenThreshold = 0;
     sse_free(pnn->arOutputThreshold);
     pnn->arOutputThreshold = 0;
+    sse_free((float *) pnn->asHiddenWeightQ);
+    pnn->asHiddenWeightQ = 0;
+    sse_free(pnn->arHiddenScaleQ);
+    pnn->arHiddenScaleQ = 0;
+}
+
+/* Round the hidden weights to 16 bits for the quantized evaluation.
+ * asHiddenWeightQ holds, for each pair of inputs, the weights of both
+ * inputs for each hidden node in turn; arHiddenScaleQ is the value of
+ * one unit of the resulting sums for each hidden node. */
+
+static int
+NeuralNetQuantize(neuralnet * pnn)
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cPairs = NN_QUANT_PAIRS(pnn);
+    unsigned int i, j;
+
+    if ((pnn->asHiddenWeightQ = (int16_t *) sse_malloc(cPairs * cHidden * 2 * sizeof(int16_t))) == NULL)
+        return -1;
+
+    if ((pnn->arHiddenScaleQ = sse_malloc(cHidden * sizeof(float))) == NULL) {
+        sse_free((float *) pnn->asHiddenWeightQ);
+        pnn->asHiddenWeightQ = NULL;
+        return -1;
+    }
+
+    for (j = 0; j < cHidden; j++) {
+        float rMax = 0.0f, rScale;
+
+        for (i = 0; i < pnn->cInput; i++)
+            rMax = MAX(rMax, fabsf(pnn->arHiddenWeight[i * cHidden + j]));
+
+        rScale = rMax > 0.0f ? NN_QUANT_WEIGHT_MAX / rMax : 1.0f;
+        pnn->arHiddenScaleQ[j] = 1.0f / (rScale * NN_QUANT_INPUT_SCALE);
+
+        for (i = 0; i < 2 * cPairs; i++)
+            pnn->asHiddenWeightQ[((i >> 1) * cHidden + j) * 2 + (i & 1)] =
+                i < pnn->cInput ? (int16_t) lrintf(pnn->arHiddenWeight[i * cHidden + j] * rScale) : 0;
+    }
+
+    return 0;
+}
+
+/* The inputs scaled and rounded to 16 bits, two by two */
+
+extern void
+NeuralNetQuantizeInputs(const neuralnet * pnn, const float arInput[], int32_t aiInput[])
+{
+    unsigned int i;
+
+    for (i = 0; i < NN_QUANT_PAIRS(pnn); i++) {
+        long n0 = lrintf(arInput[2 * i] * NN_QUANT_INPUT_SCALE);
+        long n1 = 2 * i + 1 < pnn->cInput ? lrintf(arInput[2 * i + 1] * NN_QUANT_INPUT_SCALE) : 0;
+
+        n0 = CLAMP(n0, INT16_MIN, INT16_MAX);
+        n1 = CLAMP(n1, INT16_MIN, INT16_MAX);
+        aiInput[i] = (int32_t) ((uint32_t) (uint16_t) n0 | ((uint32_t) (uint16_t) n1 << 16));
+    }
+}
+
+/* Activity at the hidden nodes from the quantized inputs; the reference
+ * for the SIMD versions in neuralnetsse.c */
+
+extern void
+NeuralNetHiddenQuantized(const neuralnet * pnn, const int32_t aiInput[], float ar[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    int32_t *aiSum = (int32_t *) g_alloca(cHidden * sizeof(int32_t));
+    unsigned int i, j;
+
+    memset(aiSum, 0, cHidden * sizeof(int32_t));
+
+    for (i = 0; i < NN_QUANT_PAIRS(pnn); i++) {
+        const int16_t *ps = pnn->asHiddenWeightQ + i * cHidden * 2;
+        int32_t const n0 = (int16_t) (aiInput[i] & 0xffff);
+        int32_t const n1 = (int16_t) ((uint32_t) aiInput[i] >> 16);
+
+        if (!aiInput[i])
+            continue;
+
+        for (j = 0; j < cHidden; j++, ps += 2)
+            aiSum[j] += n0 * ps[0] + n1 * ps[1];
+    }
+
+    for (j = 0; j < cHidden; j++)
+        ar[j] = (float) aiSum[j] * pnn->arHiddenScaleQ[j] + pnn->arHiddenThreshold[j];
 }
 
 #if !defined(USE_SIMD_INSTRUCTIONS)
@@ -118,6 +208,29 @@ NNevalAction(NNState * pnState)
     return NNEVAL_NONE;         /* for the picky compiler */
 }
 
+static void
+EvaluateOutput(const neuralnet * pnn, float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    unsigned int i, j;
+    const float *prWeight;
+
+    for (i = 0; i < cHidden; i++)
+        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
+
+    /* Calculate activity at output nodes */
+    prWeight = pnn->arOutputWeight;
+
+    for (i = 0; i < pnn->cOutput; i++) {
+        float r = pnn->arOutputThreshold[i];
+
+        for (j = 0; j < cHidden; j++)
+            r += ar[j] * *prWeight++;
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * r);
+    }
+}
+
 static void
 Evaluate(const neuralnet * pnn, const float arInput[], float ar[], float arOutput[], float *saveAr)
 {
@@ -151,20 +264,7 @@ Evaluate(const neuralnet * pnn, const float arInput[], float ar[], float arOutpu
     if (saveAr)
         memcpy(saveAr, ar, cHidden * sizeof(*saveAr));
 
-    for (i = 0; i < cHidden; i++)
-        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
-
-    /* Calculate activity at output nodes */
-    prWeight = pnn->arOutputWeight;
-
-    for (i = 0; i < pnn->cOutput; i++) {
-        float r = pnn->arOutputThreshold[i];
-
-        for (j = 0; j < cHidden; j++)
-            r += ar[j] * *prWeight++;
-
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * r);
-    }
+    EvaluateOutput(pnn, ar, arOutput);
 }
 
 static void
@@ -199,20 +299,7 @@ EvaluateFromBase(const neuralnet * pnn, const float arInputDif[], float ar[], fl
         }
     }
 
-    for (i = 0; i < pnn->cHidden; i++)
-        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
-
-    /* Calculate activity at output nodes */
-    prWeight = pnn->arOutputWeight;
-
-    for (i = 0; i < pnn->cOutput; i++) {
-        float r = pnn->arOutputThreshold[i];
-
-        for (j = 0; j < pnn->cHidden; j++)
-            r += ar[j] * *prWeight++;
-
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * r);
-    }
+    EvaluateOutput(pnn, ar, arOutput);
 }
 
 extern int
@@ -259,6 +346,85 @@ NeuralNetEvaluate(const neuralnet * pnn, float arInput[], float arOutput[], NNSt
     }
     return 0;
 }
+
+/* Evaluate cPositions positions whose inputs are stored one after the
+ * other in arInput (cInput floats each). The outputs are stored the
+ * same way in arOutput (cOutput floats each).
+ *
+ * The hidden layer is computed for NN_BATCH_BLOCK positions at once,
+ * looping over the inputs in the outer loop, so that each row of
+ * hidden weights is read from memory once per block. */
+
+extern int
+NeuralNetEvaluateBatch(const neuralnet * pnn, unsigned int cPositions, const float arInput[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    float *ar = (float *) g_alloca(NN_BATCH_BLOCK * cHidden * sizeof(float));
+    unsigned int iFirst;
+
+    for (iFirst = 0; iFirst < cPositions; iFirst += NN_BATCH_BLOCK) {
+        const unsigned int cBlock = MIN(NN_BATCH_BLOCK, cPositions - iFirst);
+        const float *arBlockInput = arInput + iFirst * pnn->cInput;
+        const float *prWeight = pnn->arHiddenWeight;
+        unsigned int i, j, k;
+
+        /* Calculate activity at hidden nodes */
+        for (k = 0; k < cBlock; k++)
+            memcpy(ar + k * cHidden, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+        for (i = 0; i < pnn->cInput; i++, prWeight += cHidden) {
+            for (k = 0; k < cBlock; k++) {
+                float const ari = arBlockInput[k * pnn->cInput + i];
+                const float *prw = prWeight;
+                float *pr;
+
+                if (ari == 0.0f)
+                    continue;
+
+                pr = ar + k * cHidden;
+
+                if (ari == 1.0f)
+                    for (j = cHidden; j; j--)
+                        *pr++ += *prw++;
+                else
+                    for (j = cHidden; j; j--)
+                        *pr++ += *prw++ * ari;
+            }
+        }
+
+        for (k = 0; k < cBlock; k++)
+            EvaluateOutput(pnn, ar + k * cHidden, arOutput + (iFirst + k) * pnn->cOutput);
+    }
+
+    return 0;
+}
+
+/* Same as NeuralNetEvaluate() with the quantized hidden weights */
+
+extern int
+NeuralNetEvaluateQuantized(const neuralnet * pnn, const float arInput[], float arOutput[])
+{
+    float *ar = (float *) g_alloca(pnn->cHidden * sizeof(float));
+    int32_t *aiInput = (int32_t *) g_alloca(NN_QUANT_PAIRS(pnn) * sizeof(int32_t));
+
+    NeuralNetQuantizeInputs(pnn, arInput, aiInput);
+    NeuralNetHiddenQuantized(pnn, aiInput, ar);
+    EvaluateOutput(pnn, ar, arOutput);
+
+    return 0;
+}
+
+extern int
+NeuralNetEvaluateBatchQuantized(const neuralnet * pnn, unsigned int cPositions, const float arInput[],
+                                float arOutput[])
+{
+    unsigned int i;
+
+    for (i = 0; i < cPositions; i++)
+        NeuralNetEvaluateQuantized(pnn, arInput + i * pnn->cInput, arOutput + i * pnn->cOutput);
+
+    return 0;
+}
 #endif
 
 extern int
@@ -298,7 +464,7 @@ NeuralNetLoad(neuralnet * pnn, FILE * pf)
         if (fscanf(pf, "%f\n", pr++) < 1)
             return -1;
 
-    return 0;
+    return NeuralNetQuantize(pnn);
 }
 
 extern int
@@ -333,7 +499,7 @@ NeuralNetLoadBinary(neuralnet * pnn, FILE * pf)
     FREAD(pnn->arOutputThreshold, pnn->cOutput);
 #undef FREAD
 
-    return 0;
+    return NeuralNetQuantize(pnn);
 }
 
 extern int
@@ -367,6 +533,7 @@ NeuralNetSaveBinary(const neuralnet * pnn, FILE * pf)
 int
 SIMD_Supported(void)
 {
+    NeuralNetInitKernels();
     return 1;
 }
 
@@ -562,6 +729,8 @@ SIMD_Supported(void)
 #else
         state = -2;
 #endif
+        if (state == 1)
+            NeuralNetInitKernels();
     }
 
     return state;
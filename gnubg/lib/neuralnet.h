@@ -22,6 +22,7 @@
 #define NEURALNET_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "common.h"
 
 typedef struct {
@@ -35,8 +36,25 @@ typedef struct {
     float *arOutputWeight;
     float *arHiddenThreshold;
     float *arOutputThreshold;
+    int16_t *asHiddenWeightQ;   /* see NeuralNetQuantize() */
+    float *arHiddenScaleQ;
 } neuralnet;
 
+/*
+ * Quantized evaluation of the hidden layer, which has nearly all the
+ * multiplications: the inputs are scaled by NN_QUANT_INPUT_SCALE and the
+ * hidden weights of each hidden node by up to NN_QUANT_WEIGHT_MAX over
+ * its largest weight, both rounded to 16 bits and multiplied by pairs
+ * of inputs into 32 bit sums (pmaddwd). Inputs are in the 0-7 range and
+ * sum to less than 100 for any position, which keeps the sums below
+ * 2^31. The output layer is evaluated in floating point.
+ */
+#define NN_QUANT_INPUT_SCALE 1024.0f
+#define NN_QUANT_WEIGHT_MAX 16383.0f
+
+/* Pairs of 16 bit inputs, packed in 32 bits, of a net */
+#define NN_QUANT_PAIRS(pnn) (((pnn)->cInput + 1) >> 1)
+
 typedef enum {
     NNEVAL_NONE,
     NNEVAL_SAVE,
@@ -61,9 +79,49 @@ typedef struct {
 extern void NeuralNetDestroy(neuralnet * pnn);
 #if !defined(USE_SIMD_INSTRUCTIONS)
 extern int NeuralNetEvaluate(const neuralnet * pnn, float arInput[], float arOutput[], NNState * pnState);
+extern int NeuralNetEvaluateBatch(const neuralnet * pnn, unsigned int cPositions, const float arInput[],
+                                  float arOutput[]);
+extern int NeuralNetEvaluateQuantized(const neuralnet * pnn, const float arInput[], float arOutput[]);
+extern int NeuralNetEvaluateBatchQuantized(const neuralnet * pnn, unsigned int cPositions, const float arInput[],
+                                           float arOutput[]);
 #else
+
+/*
+ * On x86 the SIMD code is compiled for the lowest CPU supported by the
+ * build, with AVX2/FMA and AVX-512 kernels picked at run time when the
+ * CPU has them.
+ */
+#if defined(HAVE_SSE) && (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define NN_DISPATCH 1
+#if defined(__clang__) || __GNUC__ >= 8
+#define NN_DISPATCH_VNNI 1      /* for the quantized nets */
+#endif
+#endif
+
+typedef enum {
+    NN_KERNEL_DEFAULT,          /* the one selected at compile time */
+    NN_KERNEL_AVX2,
+    NN_KERNEL_AVX512
+} nnkernel;
+
+extern void NeuralNetInitKernels(void);
+extern const char *NeuralNetKernelName(void);
 extern int NeuralNetEvaluateSSE(const neuralnet * pnn, float arInput[], float arOutput[], NNState * pnState);
+extern int NeuralNetEvaluateBatchSSE(const neuralnet * pnn, unsigned int cPositions, const float arInput[],
+                                     float arOutput[]);
+extern int NeuralNetEvaluateQuantizedSSE(const neuralnet * pnn, const float arInput[], float arOutput[]);
+extern int NeuralNetEvaluateBatchQuantizedSSE(const neuralnet * pnn, unsigned int cPositions,
+                                              const float arInput[], float arOutput[]);
 #endif
+
+extern void NeuralNetQuantizeInputs(const neuralnet * pnn, const float arInput[], int32_t aiInput[]);
+extern void NeuralNetHiddenQuantized(const neuralnet * pnn, const int32_t aiInput[], float ar[]);
+
+/* Number of positions whose hidden layer activities are accumulated
+ * together by the batch evaluation functions. Each row of hidden
+ * weights is loaded once per block instead of once per position. */
+#define NN_BATCH_BLOCK 8
 extern int NeuralNetLoad(neuralnet * pnn, FILE * pf);
 extern int NeuralNetLoadBinary(neuralnet * pnn, FILE * pf);
 extern int NeuralNetSaveBinary(const neuralnet * pnn, FILE * pf);
@@ -39,6 +39,10 @@
 #include <xmmintrin.h>
 #endif
 
+#if defined(NN_DISPATCH) && !defined(USE_AVX)
+#include <immintrin.h>
+#endif
+
 #include <glib.h>
 #include "sigmoid.h"
 
@@ -325,6 +329,125 @@ for (j = (cHidden >> LOG2VEC_SIZE); j; j--, pr += VEC_SIZE, prWeight += VEC_SIZE
 }
 #endif
 
+static inline void
+EvaluateOutputSSE(const neuralnet * restrict pnn, float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    unsigned int i, j;
+    const float *prWeight;
+#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
+    float *par;
+#if defined(USE_FMA3)
+    float_vector vec0, vec1, scalevec, sum;
+#else
+    float_vector vec0, vec1, vec3, scalevec, sum;
+#endif
+#endif
+
+#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
+#if defined(USE_AVX)
+    scalevec = _mm256_set1_ps(pnn->rBetaHidden);
+#elif defined(HAVE_SSE)
+    scalevec = _mm_set1_ps(pnn->rBetaHidden);
+#else
+    scalevec = vdupq_n_f32(pnn->rBetaHidden);
+#endif
+
+    for (par = ar, i = (cHidden >> LOG2VEC_SIZE); i; i--, par += VEC_SIZE) {
+#if defined(USE_AVX)
+        float_vector vec = _mm256_load_ps(par);
+        vec = _mm256_mul_ps(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        _mm256_store_ps(par, vec);
+#elif defined(HAVE_SSE)
+        float_vector vec = _mm_load_ps(par);
+        vec = _mm_mul_ps(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        _mm_store_ps(par, vec);
+#else
+        float_vector vec = vld1q_f32(par);
+        vec = vmulq_f32(vec, scalevec);
+        vec = sigmoid_ps(vec);
+        vst1q_f32(par, vec);
+#endif
+    }
+#else
+    for (i = 0; i < cHidden; i++)
+        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
+#endif
+
+    /* Calculate activity at output nodes */
+    prWeight = pnn->arOutputWeight;
+
+    for (i = 0; i < pnn->cOutput; i++) {
+
+#if defined(USE_AVX)
+        SSE_ALIGN(float r[8]);
+#else
+        float r;
+#endif
+        float *pr = ar;
+#if defined(USE_AVX)
+        sum = _mm256_setzero_ps();
+#elif defined(HAVE_SSE)
+        sum = _mm_setzero_ps();
+#else
+        sum = vdupq_n_f32(0.0f);
+#endif
+        for (j = (cHidden >> LOG2VEC_SIZE); j; j--, prWeight += VEC_SIZE, pr += VEC_SIZE) {
+#if defined(USE_AVX)
+            vec0 = _mm256_load_ps(pr);  /* Eight floats into vec0 */
+            vec1 = _mm256_load_ps(prWeight);    /* Eight weights into vec1 */
+#if defined(USE_FMA3)
+            sum = _mm256_fmadd_ps(vec0, vec1, sum);
+#else
+            vec3 = _mm256_mul_ps(vec0, vec1);   /* Multiply */
+            sum = _mm256_add_ps(sum, vec3);     /* Add */
+#endif
+#elif defined(HAVE_SSE)
+            vec0 = _mm_load_ps(pr);     /* Four floats into vec0 */
+            vec1 = _mm_load_ps(prWeight);       /* Four weights into vec1 */
+            vec3 = _mm_mul_ps(vec0, vec1);      /* Multiply */
+            sum = _mm_add_ps(sum, vec3);        /* Add */
+#else
+            vec0 = vld1q_f32(pr);     /* Four floats into vec0 */
+            vec1 = vld1q_f32(prWeight);       /* Four weights into vec1 */
+            vec3 = vmulq_f32(vec0, vec1);      /* Multiply */
+            sum = vaddq_f32(sum, vec3);        /* Add */
+#endif
+        }
+
+#if defined(USE_AVX)
+        vec0 = _mm256_hadd_ps(sum, sum);
+        vec1 = _mm256_hadd_ps(vec0, vec0);
+        _mm256_store_ps(r, vec1);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r[0] + r[4] + pnn->arOutputThreshold[i]));
+#elif defined(HAVE_SSE)
+        vec0 = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
+        vec1 = _mm_add_ps(sum, vec0);
+        vec0 = _mm_shuffle_ps(vec1, vec1, _MM_SHUFFLE(1, 1, 3, 3));
+        sum = _mm_add_ps(vec1, vec0);
+        _mm_store_ss(&r, sum);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+
+#else
+       {
+       float32x2_t vec0_h, vec0_l, vec1;
+
+       vec0_h = vget_high_f32(sum);
+       vec0_l = vget_low_f32(sum);
+       vec1 = vpadd_f32(vec0_h, vec0_l);
+       vec1 = vpadd_f32(vec1, vec1);
+       vst1_lane_f32(&r, vec1, 0);
+
+       arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+       }
+#endif
+    }
+}
+
 static void
 EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], float arOutput[])
 {
@@ -332,7 +455,6 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
     unsigned int i, j;
     float *prWeight;
 #if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
-    float *par;
 #if defined(USE_FMA3)
     float_vector vec0, vec1, scalevec, sum;
 #else
@@ -458,127 +580,635 @@ EvaluateSSE(const neuralnet * restrict pnn, const float arInput[], float ar[], f
             }
         }
 
-#if defined(USE_SSE2) || defined(USE_AVX) || defined(USE_NEON)
+    EvaluateOutputSSE(pnn, ar, arOutput);
+
 #if defined(USE_AVX)
-    scalevec = _mm256_set1_ps(pnn->rBetaHidden);
-#elif defined(HAVE_SSE)
-    scalevec = _mm_set1_ps(pnn->rBetaHidden);
-#else
-    scalevec = vdupq_n_f32(pnn->rBetaHidden);
+    _mm256_zeroupper();
 #endif
+}
 
-    for (par = ar, i = (cHidden >> LOG2VEC_SIZE); i; i--, par += VEC_SIZE) {
-#if defined(USE_AVX)
-        float_vector vec = _mm256_load_ps(par);
-        vec = _mm256_mul_ps(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        _mm256_store_ps(par, vec);
-#elif defined(HAVE_SSE)
-        float_vector vec = _mm_load_ps(par);
-        vec = _mm_mul_ps(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        _mm_store_ps(par, vec);
+#if defined(NN_DISPATCH)
+
+/*
+ * Kernels for CPUs newer than the one the binary was compiled for,
+ * selected at run time by NeuralNetInitKernels(). They compute the same
+ * thing as EvaluateSSE() and EvaluateOutputSSE(), with FMA for the
+ * accumulations and a gather for the sigmoid table lookups. The weights
+ * are only guaranteed to be ALIGN_SIZE aligned, hence unaligned loads.
+ */
+
+static nnkernel nnKernel = NN_KERNEL_DEFAULT;
+#if defined(NN_DISPATCH_VNNI)
+static int fVNNI = FALSE;       /* AVX-512 VNNI, for the quantized nets */
+#endif
+
+static inline __attribute__ ((target("avx2,fma"))) __m256
+sigmoid_avx2(__m256 xin)
+{
+    __m256 const ones = _mm256_set1_ps(1.0f);
+    __m256 const tens = _mm256_set1_ps(10.0f);
+    __m256 const mask = _mm256_cmp_ps(xin, _mm256_setzero_ps(), _CMP_LT_OS);
+    __m256 x1 = _mm256_and_ps(xin, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF)));
+    __m256i i;
+    __m256 ex, c;
+
+    x1 = _mm256_mul_ps(_mm256_min_ps(x1, tens), tens);
+    i = _mm256_cvttps_epi32(x1);
+    ex = _mm256_i32gather_ps(e, i, sizeof(float));
+    x1 = _mm256_add_ps(_mm256_sub_ps(x1, _mm256_cvtepi32_ps(i)), tens);
+    x1 = _mm256_fmadd_ps(x1, ex, ones);
+#ifdef __FAST_MATH__
+    c = _mm256_rcp_ps(x1);
 #else
-        float_vector vec = vld1q_f32(par);
-        vec = vmulq_f32(vec, scalevec);
-        vec = sigmoid_ps(vec);
-        vst1q_f32(par, vec);
+    c = _mm256_div_ps(ones, x1);
 #endif
+    return _mm256_blendv_ps(_mm256_sub_ps(ones, c), c, mask);
+}
+
+static inline __attribute__ ((target("avx2,fma"))) void
+AccumulateAVX2(float *restrict ar, const float *restrict prWeight, float ari, unsigned int cHidden)
+{
+    __m256 const scalevec = _mm256_set1_ps(ari);
+    unsigned int j;
+
+    for (j = 0; j < cHidden; j += 8)
+        _mm256_storeu_ps(ar + j, _mm256_fmadd_ps(_mm256_loadu_ps(prWeight + j), scalevec, _mm256_loadu_ps(ar + j)));
+}
+
+static inline __attribute__ ((target("avx2,fma"))) void
+EvaluateOutputAVX2(const neuralnet * restrict pnn, float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    __m256 const scalevec = _mm256_set1_ps(pnn->rBetaHidden);
+    const float *prWeight = pnn->arOutputWeight;
+    unsigned int i, j;
+
+    for (j = 0; j < cHidden; j += 8)
+        _mm256_storeu_ps(ar + j, sigmoid_avx2(_mm256_mul_ps(_mm256_loadu_ps(ar + j), scalevec)));
+
+    /* Calculate activity at output nodes */
+    for (i = 0; i < pnn->cOutput; i++, prWeight += cHidden) {
+        __m256 sum = _mm256_setzero_ps();
+        __m128 r;
+
+        for (j = 0; j < cHidden; j += 8)
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(ar + j), _mm256_loadu_ps(prWeight + j), sum);
+
+        r = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        r = _mm_hadd_ps(r, r);
+        r = _mm_hadd_ps(r, r);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (_mm_cvtss_f32(r) + pnn->arOutputThreshold[i]));
     }
+}
+
+static __attribute__ ((target("avx2,fma"))) void
+EvaluateAVX2(const neuralnet * restrict pnn, const float arInput[], float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const float *prWeight = pnn->arHiddenWeight;
+    unsigned int i;
+
+    /* Calculate activity at hidden nodes */
+    memcpy(ar, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+    for (i = 0; i < pnn->cInput; i++, prWeight += cHidden)
+        if (arInput[i] != 0.0f)
+            AccumulateAVX2(ar, prWeight, arInput[i], cHidden);
+
+    EvaluateOutputAVX2(pnn, ar, arOutput);
+
+    _mm256_zeroupper();
+}
+
+static __attribute__ ((target("avx2,fma"))) void
+EvaluateBatchAVX2(const neuralnet * restrict pnn, const unsigned int cPositions, const float arInput[],
+                  float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cInput = pnn->cInput;
+    unsigned int iFirst;
+
+    for (iFirst = 0; iFirst < cPositions; iFirst += NN_BATCH_BLOCK) {
+        const unsigned int cBlock = MIN(NN_BATCH_BLOCK, cPositions - iFirst);
+        const float *arBlockInput = arInput + iFirst * cInput;
+        const float *prRow = pnn->arHiddenWeight;
+        unsigned int i, k;
+
+        for (k = 0; k < cBlock; k++)
+            memcpy(ar + k * cHidden, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+        for (i = 0; i < cInput; i++, prRow += cHidden)
+            for (k = 0; k < cBlock; k++)
+                if (arBlockInput[k * cInput + i] != 0.0f)
+                    AccumulateAVX2(ar + k * cHidden, prRow, arBlockInput[k * cInput + i], cHidden);
+
+        for (k = 0; k < cBlock; k++)
+            EvaluateOutputAVX2(pnn, ar + k * cHidden, arOutput + (iFirst + k) * pnn->cOutput);
+    }
+
+    _mm256_zeroupper();
+}
+
+static inline __attribute__ ((target("avx512f"))) __m512
+sigmoid_avx512(__m512 xin)
+{
+    __m512 const ones = _mm512_set1_ps(1.0f);
+    __m512 const tens = _mm512_set1_ps(10.0f);
+    __mmask16 const mask = _mm512_cmp_ps_mask(xin, _mm512_setzero_ps(), _CMP_LT_OS);
+    __m512 x1 = _mm512_castsi512_ps(_mm512_and_epi32(_mm512_castps_si512(xin), _mm512_set1_epi32(0x7FFFFFFF)));
+    __m512i i;
+    __m512 ex, c;
+
+    x1 = _mm512_mul_ps(_mm512_min_ps(x1, tens), tens);
+    i = _mm512_cvttps_epi32(x1);
+    ex = _mm512_i32gather_ps(i, e, sizeof(float));
+    x1 = _mm512_add_ps(_mm512_sub_ps(x1, _mm512_cvtepi32_ps(i)), tens);
+    x1 = _mm512_fmadd_ps(x1, ex, ones);
+#ifdef __FAST_MATH__
+    c = _mm512_rcp14_ps(x1);
 #else
-    for (i = 0; i < cHidden; i++)
-        ar[i] = sigmoid(-pnn->rBetaHidden * ar[i]);
+    c = _mm512_div_ps(ones, x1);
 #endif
+    return _mm512_mask_blend_ps(mask, _mm512_sub_ps(ones, c), c);
+}
+
+static inline __attribute__ ((target("avx512f"))) void
+AccumulateAVX512(float *restrict ar, const float *restrict prWeight, float ari, unsigned int cHidden)
+{
+    __m512 const scalevec = _mm512_set1_ps(ari);
+    unsigned int j;
+
+    for (j = 0; j < cHidden; j += 16)
+        _mm512_storeu_ps(ar + j, _mm512_fmadd_ps(_mm512_loadu_ps(prWeight + j), scalevec, _mm512_loadu_ps(ar + j)));
+}
+
+static inline __attribute__ ((target("avx512f"))) void
+EvaluateOutputAVX512(const neuralnet * restrict pnn, float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    __m512 const scalevec = _mm512_set1_ps(pnn->rBetaHidden);
+    const float *prWeight = pnn->arOutputWeight;
+    unsigned int i, j;
+
+    for (j = 0; j < cHidden; j += 16)
+        _mm512_storeu_ps(ar + j, sigmoid_avx512(_mm512_mul_ps(_mm512_loadu_ps(ar + j), scalevec)));
 
     /* Calculate activity at output nodes */
-    prWeight = pnn->arOutputWeight;
+    for (i = 0; i < pnn->cOutput; i++, prWeight += cHidden) {
+        __m512 sum = _mm512_setzero_ps();
+        __m256 r8;
+        __m128 r;
 
-    for (i = 0; i < pnn->cOutput; i++) {
+        for (j = 0; j < cHidden; j += 16)
+            sum = _mm512_fmadd_ps(_mm512_loadu_ps(ar + j), _mm512_loadu_ps(prWeight + j), sum);
 
-#if defined(USE_AVX)
-        SSE_ALIGN(float r[8]);
-#else
-        float r;
+        r8 = _mm256_add_ps(_mm512_castps512_ps256(sum),
+                           _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(sum), 1)));
+        r = _mm_add_ps(_mm256_castps256_ps128(r8), _mm256_extractf128_ps(r8, 1));
+        r = _mm_hadd_ps(r, r);
+        r = _mm_hadd_ps(r, r);
+
+        arOutput[i] = sigmoid(-pnn->rBetaOutput * (_mm_cvtss_f32(r) + pnn->arOutputThreshold[i]));
+    }
+}
+
+static __attribute__ ((target("avx512f"))) void
+EvaluateAVX512(const neuralnet * restrict pnn, const float arInput[], float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const float *prWeight = pnn->arHiddenWeight;
+    unsigned int i;
+
+    /* Calculate activity at hidden nodes */
+    memcpy(ar, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+    for (i = 0; i < pnn->cInput; i++, prWeight += cHidden)
+        if (arInput[i] != 0.0f)
+            AccumulateAVX512(ar, prWeight, arInput[i], cHidden);
+
+    EvaluateOutputAVX512(pnn, ar, arOutput);
+
+    _mm256_zeroupper();
+}
+
+static __attribute__ ((target("avx512f"))) void
+EvaluateBatchAVX512(const neuralnet * restrict pnn, const unsigned int cPositions, const float arInput[],
+                    float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cInput = pnn->cInput;
+    unsigned int iFirst;
+
+    for (iFirst = 0; iFirst < cPositions; iFirst += NN_BATCH_BLOCK) {
+        const unsigned int cBlock = MIN(NN_BATCH_BLOCK, cPositions - iFirst);
+        const float *arBlockInput = arInput + iFirst * cInput;
+        const float *prRow = pnn->arHiddenWeight;
+        unsigned int i, k;
+
+        for (k = 0; k < cBlock; k++)
+            memcpy(ar + k * cHidden, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+        for (i = 0; i < cInput; i++, prRow += cHidden)
+            for (k = 0; k < cBlock; k++)
+                if (arBlockInput[k * cInput + i] != 0.0f)
+                    AccumulateAVX512(ar + k * cHidden, prRow, arBlockInput[k * cInput + i], cHidden);
+
+        for (k = 0; k < cBlock; k++)
+            EvaluateOutputAVX512(pnn, ar + k * cHidden, arOutput + (iFirst + k) * pnn->cOutput);
+    }
+
+    _mm256_zeroupper();
+}
+
+/* The quantized evaluation of cBlock positions; see
+ * EvaluateQuantizedSSE2() */
+
+static __attribute__ ((target("avx2,fma"))) void
+EvaluateQuantizedAVX2(const neuralnet * restrict pnn, const unsigned int cBlock, const int32_t aiInput[],
+                      int32_t aiSum[], float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cPairs = NN_QUANT_PAIRS(pnn);
+    unsigned int i, j, k;
+
+    memset(aiSum, 0, cBlock * cHidden * sizeof(int32_t));
+
+    for (i = 0; i < cPairs; i++) {
+        const int16_t *psRow = pnn->asHiddenWeightQ + i * cHidden * 2;
+
+        for (k = 0; k < cBlock; k++) {
+            int32_t *pi = aiSum + k * cHidden;
+            __m256i vn;
+
+            if (!aiInput[k * cPairs + i])
+                continue;
+
+            vn = _mm256_set1_epi32(aiInput[k * cPairs + i]);
+            for (j = 0; j < cHidden; j += 8)
+                _mm256_storeu_si256((__m256i *) (pi + j),
+                                    _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (pi + j)),
+                                                     _mm256_madd_epi16(_mm256_loadu_si256
+                                                                       ((const __m256i *) (psRow + 2 * j)), vn)));
+        }
+    }
+
+    for (k = 0; k < cBlock; k++) {
+        for (j = 0; j < cHidden; j += 8)
+            _mm256_storeu_ps(ar + j,
+                             _mm256_fmadd_ps(_mm256_cvtepi32_ps
+                                             (_mm256_loadu_si256((const __m256i *) (aiSum + k * cHidden + j))),
+                                             _mm256_loadu_ps(pnn->arHiddenScaleQ + j),
+                                             _mm256_loadu_ps(pnn->arHiddenThreshold + j)));
+
+        EvaluateOutputAVX2(pnn, ar, arOutput + k * pnn->cOutput);
+    }
+
+    _mm256_zeroupper();
+}
+
+#if defined(NN_DISPATCH_VNNI)
+/* Same as EvaluateQuantizedAVX2() with vpdpwssd, which does the
+ * multiplications and both additions in one instruction */
+
+static __attribute__ ((target("avx512f,avx512vnni"))) void
+EvaluateQuantizedVNNI(const neuralnet * restrict pnn, const unsigned int cBlock, const int32_t aiInput[],
+                      int32_t aiSum[], float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cPairs = NN_QUANT_PAIRS(pnn);
+    unsigned int i, j, k;
+
+    memset(aiSum, 0, cBlock * cHidden * sizeof(int32_t));
+
+    for (i = 0; i < cPairs; i++) {
+        const int16_t *psRow = pnn->asHiddenWeightQ + i * cHidden * 2;
+
+        for (k = 0; k < cBlock; k++) {
+            int32_t *pi = aiSum + k * cHidden;
+            __m512i vn;
+
+            if (!aiInput[k * cPairs + i])
+                continue;
+
+            vn = _mm512_set1_epi32(aiInput[k * cPairs + i]);
+            for (j = 0; j < cHidden; j += 16)
+                _mm512_storeu_si512(pi + j, _mm512_dpwssd_epi32(_mm512_loadu_si512(pi + j), vn,
+                                                                _mm512_loadu_si512(psRow + 2 * j)));
+        }
+    }
+
+    for (k = 0; k < cBlock; k++) {
+        for (j = 0; j < cHidden; j += 16)
+            _mm512_storeu_ps(ar + j, _mm512_fmadd_ps(_mm512_cvtepi32_ps(_mm512_loadu_si512(aiSum + k * cHidden + j)),
+                                                     _mm512_loadu_ps(pnn->arHiddenScaleQ + j),
+                                                     _mm512_loadu_ps(pnn->arHiddenThreshold + j)));
+
+        EvaluateOutputAVX512(pnn, ar, arOutput + k * pnn->cOutput);
+    }
+
+    _mm256_zeroupper();
+}
+#endif
+
+/* The best kernel usable for a net: the wide kernels need whole vectors
+ * of hidden nodes */
+
+static inline nnkernel
+KernelForNet(const neuralnet * pnn)
+{
+    if (nnKernel == NN_KERNEL_AVX512 && !(pnn->cHidden & 15))
+        return NN_KERNEL_AVX512;
+    if (nnKernel >= NN_KERNEL_AVX2 && !(pnn->cHidden & 7))
+        return NN_KERNEL_AVX2;
+    return NN_KERNEL_DEFAULT;
+}
+
+#endif                          /* NN_DISPATCH */
+
+extern void
+NeuralNetInitKernels(void)
+{
+#if defined(NN_DISPATCH)
+    __builtin_cpu_init();
+
+    /* __builtin_cpu_supports() also checks that the OS saves the
+     * AVX/AVX-512 state */
+    if (__builtin_cpu_supports("avx512f"))
+        nnKernel = NN_KERNEL_AVX512;
+    else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        nnKernel = NN_KERNEL_AVX2;
+    else
+        nnKernel = NN_KERNEL_DEFAULT;
+#if defined(NN_DISPATCH_VNNI)
+    fVNNI = nnKernel == NN_KERNEL_AVX512 && __builtin_cpu_supports("avx512vnni");
+#endif
+#endif
+}
+
+extern const char *
+NeuralNetKernelName(void)
+{
+#if defined(NN_DISPATCH)
+    switch (nnKernel) {
+    case NN_KERNEL_AVX512:
+        return "AVX-512";
+    case NN_KERNEL_AVX2:
+        return "AVX2/FMA";
+    default:
+        break;
+    }
 #endif
-        float *pr = ar;
 #if defined(USE_AVX)
-        sum = _mm256_setzero_ps();
+    return "AVX";
 #elif defined(HAVE_SSE)
-        sum = _mm_setzero_ps();
+    return "SSE";
 #else
-        sum = vdupq_n_f32(0.0f);
+    return "NEON";
 #endif
-        for (j = (cHidden >> LOG2VEC_SIZE); j; j--, prWeight += VEC_SIZE, pr += VEC_SIZE) {
-#if defined(USE_AVX)
-            vec0 = _mm256_load_ps(pr);  /* Eight floats into vec0 */
-            vec1 = _mm256_load_ps(prWeight);    /* Eight weights into vec1 */
+}
+
+extern int
+NeuralNetEvaluateSSE(const neuralnet * restrict pnn, /*lint -e{818} */ float arInput[],
+                     float arOutput[], NNState * UNUSED(pnState))
+{
+    SSE_ALIGN(float ar[pnn->cHidden]);
+
+#if DEBUG_SSE
+    g_assert(sse_aligned(arOutput));
+    g_assert(sse_aligned(ar));
+    g_assert(sse_aligned(arInput));
+#endif
+
+#if defined(NN_DISPATCH)
+    switch (KernelForNet(pnn)) {
+    case NN_KERNEL_AVX512:
+        EvaluateAVX512(pnn, arInput, ar, arOutput);
+        return 0;
+    case NN_KERNEL_AVX2:
+        EvaluateAVX2(pnn, arInput, ar, arOutput);
+        return 0;
+    default:
+        break;
+    }
+#endif
+
+    EvaluateSSE(pnn, arInput, ar, arOutput);
+    return 0;
+}
+
+/* Same as NeuralNetEvaluateBatch() in neuralnet.c: the inputs and
+ * outputs of the cPositions positions are stored contiguously and the
+ * hidden layer of NN_BATCH_BLOCK positions is accumulated while each
+ * row of weights is hot in the L1 cache. */
+
+extern int
+NeuralNetEvaluateBatchSSE(const neuralnet * restrict pnn, const unsigned int cPositions,
+                          const float arInput[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cInput = pnn->cInput;
+    SSE_ALIGN(float ar[NN_BATCH_BLOCK * pnn->cHidden]);
+    unsigned int iFirst;
 #if defined(USE_FMA3)
-            sum = _mm256_fmadd_ps(vec0, vec1, sum);
+    float_vector vec0, vec1, scalevec, sum;
 #else
-            vec3 = _mm256_mul_ps(vec0, vec1);   /* Multiply */
-            sum = _mm256_add_ps(sum, vec3);     /* Add */
+    float_vector vec0, vec1, vec3, scalevec, sum;
 #endif
+
+#if defined(NN_DISPATCH)
+    switch (KernelForNet(pnn)) {
+    case NN_KERNEL_AVX512:
+        EvaluateBatchAVX512(pnn, cPositions, arInput, ar, arOutput);
+        return 0;
+    case NN_KERNEL_AVX2:
+        EvaluateBatchAVX2(pnn, cPositions, arInput, ar, arOutput);
+        return 0;
+    default:
+        break;
+    }
+#endif
+
+    for (iFirst = 0; iFirst < cPositions; iFirst += NN_BATCH_BLOCK) {
+        const unsigned int cBlock = MIN(NN_BATCH_BLOCK, cPositions - iFirst);
+        const float *arBlockInput = arInput + iFirst * cInput;
+        const float *prRow = pnn->arHiddenWeight;
+        unsigned int i, j, k;
+
+        /* Calculate activity at hidden nodes */
+        for (k = 0; k < cBlock; k++)
+            memcpy(ar + k * cHidden, pnn->arHiddenThreshold, cHidden * sizeof(float));
+
+        for (i = 0; i < cInput; i++, prRow += cHidden) {
+            for (k = 0; k < cBlock; k++) {
+                float const ari = arBlockInput[k * cInput + i];
+                const float *prWeight = prRow;
+                float *pr = ar + k * cHidden;
+
+                if (likely(ari == 0.0f))
+                    continue;
+
+                if (ari == 1.0f) {
+                    INPUT_ADD();
+                } else {
+#if defined(USE_AVX)
+                    scalevec = _mm256_set1_ps(ari);
 #elif defined(HAVE_SSE)
-            vec0 = _mm_load_ps(pr);     /* Four floats into vec0 */
-            vec1 = _mm_load_ps(prWeight);       /* Four weights into vec1 */
-            vec3 = _mm_mul_ps(vec0, vec1);      /* Multiply */
-            sum = _mm_add_ps(sum, vec3);        /* Add */
+                    scalevec = _mm_set1_ps(ari);
 #else
-            vec0 = vld1q_f32(pr);     /* Four floats into vec0 */
-            vec1 = vld1q_f32(prWeight);       /* Four weights into vec1 */
-            vec3 = vmulq_f32(vec0, vec1);      /* Multiply */
-            sum = vaddq_f32(sum, vec3);        /* Add */
+                    scalevec = vdupq_n_f32(ari);
 #endif
+                    INPUT_MULTADD();
+                }
+            }
         }
 
+        for (k = 0; k < cBlock; k++)
+            EvaluateOutputSSE(pnn, ar + k * cHidden, arOutput + (iFirst + k) * pnn->cOutput);
+    }
+
 #if defined(USE_AVX)
-        vec0 = _mm256_hadd_ps(sum, sum);
-        vec1 = _mm256_hadd_ps(vec0, vec0);
-        _mm256_store_ps(r, vec1);
+    _mm256_zeroupper();
+#endif
+    return 0;
+}
 
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r[0] + r[4] + pnn->arOutputThreshold[i]));
-#elif defined(HAVE_SSE)
-        vec0 = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(2, 3, 0, 1));
-        vec1 = _mm_add_ps(sum, vec0);
-        vec0 = _mm_shuffle_ps(vec1, vec1, _MM_SHUFFLE(1, 1, 3, 3));
-        sum = _mm_add_ps(vec1, vec0);
-        _mm_store_ss(&r, sum);
 
-        arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
+#if defined(USE_SSE2) || defined(USE_AVX)
+/*
+ * Quantized evaluation of cBlock positions (see NeuralNetQuantize() in
+ * neuralnet.c). aiInput holds the inputs of each position two by two,
+ * and each pmaddwd multiplies such a pair by the weights of 4 hidden
+ * nodes and adds the products. Pairs of zero inputs, the vast majority,
+ * are skipped.
+ */
 
-#else
-       {
-       float32x2_t vec0_h, vec0_l, vec1;
+static void
+EvaluateQuantizedSSE2(const neuralnet * restrict pnn, const unsigned int cBlock, const int32_t aiInput[],
+                      int32_t aiSum[], float ar[], float arOutput[])
+{
+    const unsigned int cHidden = pnn->cHidden;
+    const unsigned int cPairs = NN_QUANT_PAIRS(pnn);
+    unsigned int i, j, k;
 
-       vec0_h = vget_high_f32(sum);
-       vec0_l = vget_low_f32(sum);
-       vec1 = vpadd_f32(vec0_h, vec0_l);
-       vec1 = vpadd_f32(vec1, vec1);
-       vst1_lane_f32(&r, vec1, 0);
+    memset(aiSum, 0, cBlock * cHidden * sizeof(int32_t));
 
-       arOutput[i] = sigmoid(-pnn->rBetaOutput * (r + pnn->arOutputThreshold[i]));
-       }
-#endif
+    for (i = 0; i < cPairs; i++) {
+        const __m128i *pvRow = (const __m128i *) (pnn->asHiddenWeightQ + i * cHidden * 2);
+
+        for (k = 0; k < cBlock; k++) {
+            __m128i *pv = (__m128i *) (aiSum + k * cHidden);
+            __m128i vn;
+
+            if (likely(!aiInput[k * cPairs + i]))
+                continue;
+
+            vn = _mm_set1_epi32(aiInput[k * cPairs + i]);
+            for (j = 0; j < cHidden >> 2; j++)
+                _mm_store_si128(pv + j, _mm_add_epi32(_mm_load_si128(pv + j), _mm_madd_epi16(_mm_load_si128(pvRow + j), vn)));
+        }
     }
-#if defined(USE_AVX)
-    _mm256_zeroupper();
+
+    for (k = 0; k < cBlock; k++) {
+        for (j = 0; j < cHidden; j += 4) {
+            __m128 vec = _mm_cvtepi32_ps(_mm_load_si128((const __m128i *) (aiSum + k * cHidden + j)));
+
+            vec = _mm_mul_ps(vec, _mm_load_ps(pnn->arHiddenScaleQ + j));
+            _mm_store_ps(ar + j, _mm_add_ps(vec, _mm_load_ps(pnn->arHiddenThreshold + j)));
+        }
+
+        EvaluateOutputSSE(pnn, ar, arOutput + k * pnn->cOutput);
+    }
+}
 #endif
+
+#if defined(USE_SSE2) || defined(USE_AVX)
+/* Same as NeuralNetQuantizeInputs(): cvtps2dq rounds to nearest like
+ * lrintf() and packssdw saturates, leaving each pair of inputs in 32
+ * bits */
+
+static inline void
+QuantizeInputsSSE2(const neuralnet * restrict pnn, const float arInput[], int32_t aiInput[])
+{
+    __m128 const scale = _mm_set1_ps(NN_QUANT_INPUT_SCALE);
+    unsigned int i;
+
+    for (i = 0; i + 8 <= pnn->cInput; i += 8) {
+        __m128i const v0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(arInput + i), scale));
+        __m128i const v1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(arInput + i + 4), scale));
+
+        _mm_storeu_si128((__m128i *) (aiInput + (i >> 1)), _mm_packs_epi32(v0, v1));
+    }
+
+    for (; i < pnn->cInput; i += 2) {
+        int const n0 = _mm_cvtss_si32(_mm_set_ss(arInput[i] * NN_QUANT_INPUT_SCALE));
+        int const n1 = i + 1 < pnn->cInput ? _mm_cvtss_si32(_mm_set_ss(arInput[i + 1] * NN_QUANT_INPUT_SCALE)) : 0;
+
+        aiInput[i >> 1] = (int32_t) ((uint32_t) (uint16_t) CLAMP(n0, INT16_MIN, INT16_MAX)
+                                     | ((uint32_t) (uint16_t) CLAMP(n1, INT16_MIN, INT16_MAX) << 16));
+    }
 }
+#endif
 
+/* Same as NeuralNetEvaluateSSE() with the quantized hidden weights */
 
 extern int
-NeuralNetEvaluateSSE(const neuralnet * restrict pnn, /*lint -e{818} */ float arInput[],
-                     float arOutput[], NNState * UNUSED(pnState))
+NeuralNetEvaluateQuantizedSSE(const neuralnet * restrict pnn, const float arInput[], float arOutput[])
 {
+    return NeuralNetEvaluateBatchQuantizedSSE(pnn, 1, arInput, arOutput);
+}
+
+extern int
+NeuralNetEvaluateBatchQuantizedSSE(const neuralnet * restrict pnn, const unsigned int cPositions,
+                                   const float arInput[], float arOutput[])
+{
+    const unsigned int cPairs = NN_QUANT_PAIRS(pnn);
+    SSE_ALIGN(int32_t aiInput[NN_BATCH_BLOCK * cPairs]);
+    SSE_ALIGN(int32_t aiSum[NN_BATCH_BLOCK * pnn->cHidden]);
     SSE_ALIGN(float ar[pnn->cHidden]);
+    unsigned int iFirst, k;
+#if defined(NN_DISPATCH)
+    nnkernel const nk = KernelForNet(pnn);
+#endif
 
-#if DEBUG_SSE
-    g_assert(sse_aligned(arOutput));
-    g_assert(sse_aligned(ar));
-    g_assert(sse_aligned(arInput));
+    for (iFirst = 0; iFirst < cPositions; iFirst += NN_BATCH_BLOCK) {
+        const unsigned int cBlock = MIN(NN_BATCH_BLOCK, cPositions - iFirst);
+        float *arBlockOutput = arOutput + iFirst * pnn->cOutput;
+
+        for (k = 0; k < cBlock; k++)
+#if defined(USE_SSE2) || defined(USE_AVX)
+            QuantizeInputsSSE2(pnn, arInput + (iFirst + k) * pnn->cInput, aiInput + k * cPairs);
+#else
+            NeuralNetQuantizeInputs(pnn, arInput + (iFirst + k) * pnn->cInput, aiInput + k * cPairs);
 #endif
 
-    EvaluateSSE(pnn, arInput, ar, arOutput);
+#if defined(NN_DISPATCH)
+#if defined(NN_DISPATCH_VNNI)
+        if (nk == NN_KERNEL_AVX512 && fVNNI) {
+            EvaluateQuantizedVNNI(pnn, cBlock, aiInput, aiSum, ar, arBlockOutput);
+            continue;
+        }
+#endif
+        if (nk != NN_KERNEL_DEFAULT) {
+            EvaluateQuantizedAVX2(pnn, cBlock, aiInput, aiSum, ar, arBlockOutput);
+            continue;
+        }
+#endif
+
+#if defined(USE_SSE2) || defined(USE_AVX)
+        EvaluateQuantizedSSE2(pnn, cBlock, aiInput, aiSum, ar, arBlockOutput);
+#else
+        (void) aiSum;
+        for (k = 0; k < cBlock; k++) {
+            NeuralNetHiddenQuantized(pnn, aiInput + k * cPairs, ar);
+            EvaluateOutputSSE(pnn, ar, arBlockOutput + k * pnn->cOutput);
+        }
+#endif
+    }
+
+#if defined(USE_AVX)
+    _mm256_zeroupper();
+#endif
     return 0;
 }
 
@@ -57,6 +57,8 @@ MT_CreateThreadLocalData(int id)
 
     tld->aMoves = (move *) g_malloc(sizeof(move) * MAX_INCOMPLETE_MOVES);
     memset(tld->aMoves, 0, sizeof(move) * MAX_INCOMPLETE_MOVES);
+
+    tld->pMoveHash = (movehash *) g_malloc0(sizeof(movehash));
     return tld;
 }
 
@@ -109,6 +111,7 @@ InitManualEvent(ManualEvent * pME)
     pNewME->cond = g_cond_new();
 #endif
     pNewME->signalled = FALSE;
+    pNewME->nSet = 0;
     *pME = pNewME;
 }
 
@@ -123,9 +126,11 @@ FreeManualEvent(ManualEvent ME)
     g_free(ME);
 }
 
-extern void
-WaitForManualEvent(ManualEvent ME)
+extern int
+WaitForManualEventTimeout(ManualEvent ME, int msTimeout)
 {
+    int signalled;
+    unsigned int nSet;
 #if GLIB_CHECK_VERSION (2,32,0)
     gint64 end_time;
 #else
@@ -134,25 +139,29 @@ WaitForManualEvent(ManualEvent ME)
     multi_debug("wait for manual event asks lock (condMutex)");
 #if GLIB_CHECK_VERSION (2,32,0)
     g_mutex_lock(&condMutex);
-    end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_SECOND;
+    end_time = g_get_monotonic_time() + (gint64) msTimeout * G_TIME_SPAN_MILLISECOND;
 #else
     g_mutex_lock(condMutex);
+    g_get_current_time(&tv);
+    g_time_val_add(&tv, (glong) msTimeout * 1000);
 #endif
     multi_debug("wait for manual event gets lock (condMutex)");
-    while (!ME->signalled) {
+    /* Another thread may reset the event between the broadcast and our
+     * waking up; the set is not lost for all that */
+    nSet = ME->nSet;
+    while (!ME->signalled && ME->nSet == nSet) {
         multi_debug("waiting for manual event");
 #if GLIB_CHECK_VERSION (2,32,0)
         if (!g_cond_wait_until(&ME->cond, &condMutex, end_time))
 #else
-        g_get_current_time(&tv);
-        g_time_val_add(&tv, 10 * 1000 * 1000);
-        if (g_cond_timed_wait(ME->cond, condMutex, &tv))
+        if (!g_cond_timed_wait(ME->cond, condMutex, &tv))
 #endif
             break;
         else {
             multi_debug("still waiting for manual event");
         }
     }
+    signalled = ME->signalled || ME->nSet != nSet;
 
 #if GLIB_CHECK_VERSION (2,32,0)
     g_mutex_unlock(&condMutex);
@@ -160,6 +169,14 @@ WaitForManualEvent(ManualEvent ME)
     g_mutex_unlock(condMutex);
 #endif
     multi_debug("wait for manual event unlocks (condMutex)");
+
+    return signalled;
+}
+
+extern void
+WaitForManualEvent(ManualEvent ME)
+{
+    (void) WaitForManualEventTimeout(ME, 10000);
 }
 
 extern void
@@ -188,12 +205,14 @@ SetManualEvent(ManualEvent ME)
     g_mutex_lock(&condMutex);
     multi_debug("reset manual event gets lock (condMutex)");
     ME->signalled = TRUE;
+    ME->nSet++;
     g_cond_broadcast(&ME->cond);
     g_mutex_unlock(&condMutex);
 #else
     g_mutex_lock(condMutex);
     multi_debug("reset manual event gets lock (condMutex)");
     ME->signalled = TRUE;
+    ME->nSet++;
     g_cond_broadcast(ME->cond);
     g_mutex_unlock(condMutex);
 #endif
@@ -251,6 +270,8 @@ Mutex_Release(Mutex * mutex)
 extern void
 MT_InitThreads(void)
 {
+    unsigned int i;
+
 #if !GLIB_CHECK_VERSION (2,32,0)
     if (!g_thread_supported())
         g_thread_init(NULL);
@@ -260,7 +281,15 @@ MT_InitThreads(void)
     MT_SafeSet(&td.doneTasks, 0);
     td.addedTasks = 0;
     td.totalTasks = -1;
+    td.iNextQueue = 0;
+    td.queuedTasks = 0;
+    for (i = 0; i < MAX_NUMTHREADS; i++) {
+        InitMutex(&td.aQueue[i].lock);
+        td.aQueue[i].apTasks = NULL;
+        td.aQueue[i].iFirst = td.aQueue[i].cTasks = td.aQueue[i].cAlloc = 0;
+    }
     InitManualEvent(&td.activity);
+    InitManualEvent(&td.tasksDone);
     TLSCreate(&td.tlsItem);
     TLSSetValue(td.tlsItem, (size_t) MT_CreateThreadLocalData(-1));
 
@@ -289,6 +318,7 @@ CloseThread(void *UNUSED(unused))
     ThreadLocalData *pTLD = (ThreadLocalData *) TLSGet(td.tlsItem);
     if (pTLD->aMoves)
         free(pTLD->aMoves);
+    g_free(pTLD->pMoveHash);
 
     for (i = 0; i < 3; i++) {
         free(pnnState[i].savedBase);
@@ -302,9 +332,16 @@ CloseThread(void *UNUSED(unused))
 extern void
 MT_Close(void)
 {
+    unsigned int i;
+
     MT_CloseThreads();
 
+    for (i = 0; i < MAX_NUMTHREADS; i++) {
+        FreeMutex(&td.aQueue[i].lock);
+        g_free(td.aQueue[i].apTasks);
+    }
     FreeManualEvent(td.activity);
+    FreeManualEvent(td.tasksDone);
     FreeMutex(&td.multiLock);
     FreeMutex(&td.queueLock);
 
@@ -396,6 +433,7 @@ MT_Close(void)
         return;
 
     g_free(td.tld->aMoves);
+    g_free(td.tld->pMoveHash);
     pnnState = td.tld->pnnState;
     for (i = 0; i < 3; i++) {
         g_free(pnnState[i].savedBase);
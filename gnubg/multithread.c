@@ -59,10 +59,78 @@ MT_CloseThreads(void)
         g_thread_join(thread[i]);
 }
 
+/* Most tasks an idle thread moves from another queue to its own at once */
+#define MAX_STEAL 32
+
+/* A loop shared out by MT_ParallelFor(). Indices are handed out one at a
+ * time to the calling thread and to the helper tasks; the thread finishing
+ * the last call sets evDone, and the last of them to let go of the loop
+ * frees it */
+typedef struct {
+    ParallelFun fun;
+    void *data;
+    int n;
+    int iNext;
+    int cDone;
+    int cRef;
+    ManualEvent evDone;
+} ParallelLoop;
+
+static void
+ParallelLoopRun(ParallelLoop * ppl)
+{
+    int i;
+
+    while ((i = MT_SafeIncCheck(&ppl->iNext)) < ppl->n) {
+        ppl->fun(ppl->data, (unsigned int) i);
+        if (MT_SafeIncValue(&ppl->cDone) == ppl->n)
+            SetManualEvent(ppl->evDone);
+    }
+}
+
+static void
+ParallelLoopRelease(ParallelLoop * ppl)
+{
+    if (MT_SafeDecCheck(&ppl->cRef)) {
+        FreeManualEvent(ppl->evDone);
+        g_free(ppl);
+    }
+}
+
+static void
+ParallelLoopTask(void *data)
+{
+    ParallelLoopRun((ParallelLoop *) data);
+}
+
+/* Runs a task added with MT_AddDetachedTask(), and frees it */
+static void
+DetachedTaskRun(void *data)
+{
+    Task *pt = (Task *) data;
+
+    pt->fun(pt->data);
+    free(pt->pLinkedTask);
+    g_free(pt);
+}
+
 static void
 MT_TaskDone(Task * pt)
 {
-    MT_SafeInc(&td.doneTasks);
+    /* Helpers of a parallel loop and detached tasks are not part of the batch being waited for */
+    if (pt && pt->fun == ParallelLoopTask) {
+        ParallelLoopRelease((ParallelLoop *) pt->data);
+        g_free(pt);
+        return;
+    }
+    if (pt && pt->fun == DetachedTaskRun) {
+        g_free(pt);
+        return;
+    }
+
+    /* The thread finishing the last task of the batch wakes up MT_WaitForTasks() */
+    if (MT_SafeIncValue(&td.doneTasks) == MT_SafeGet(&td.totalTasks))
+        SetManualEvent(td.tasksDone);
 
     if (pt) {
         free(pt->pLinkedTask);
@@ -70,25 +138,156 @@ MT_TaskDone(Task * pt)
     }
 }
 
+/* Append cTasks tasks at the back of a queue. Caller must hold ptq->lock */
+static void
+QueuePush(TaskQueue * ptq, Task ** apt, unsigned int cTasks)
+{
+    unsigned int i;
+
+    if (ptq->cTasks + cTasks > ptq->cAlloc) {
+        unsigned int cAlloc = ptq->cAlloc ? ptq->cAlloc : 64;
+        Task **apTasks;
+
+        while (cAlloc < ptq->cTasks + cTasks)
+            cAlloc *= 2;
+
+        apTasks = (Task **) g_malloc(cAlloc * sizeof(Task *));
+        for (i = 0; i < ptq->cTasks; i++)
+            apTasks[i] = ptq->apTasks[(ptq->iFirst + i) % ptq->cAlloc];
+
+        g_free(ptq->apTasks);
+        ptq->apTasks = apTasks;
+        ptq->cAlloc = cAlloc;
+        ptq->iFirst = 0;
+    }
+
+    for (i = 0; i < cTasks; i++)
+        ptq->apTasks[(ptq->iFirst + ptq->cTasks + i) % ptq->cAlloc] = apt[i];
+
+    ptq->cTasks += cTasks;
+}
+
+/* Put tasks on the worker queues and wake up idle threads, without
+ * counting them in the batch. The tasks are queued and counted before
+ * the threads are woken up, so that none of them finds nothing to do and
+ * sleeps again. Called with td.queueLock held */
+static void
+MT_PushTasks(Task ** apt, unsigned int cTasks)
+{
+    unsigned int cQueues = td.numThreads ? td.numThreads : 1;
+    int id = MT_GetThreadID();
+
+    if (id >= 0 && (unsigned int) id < cQueues) {
+        /* a worker adding tasks keeps them, the others will steal them */
+        TaskQueue *ptq = &td.aQueue[id];
+
+        Mutex_Lock(&ptq->lock);
+        QueuePush(ptq, apt, cTasks);
+        Mutex_Release(&ptq->lock);
+    } else {
+        /* spread the batch over the queues in contiguous chunks, one lock each */
+        unsigned int cChunk = (cTasks + cQueues - 1) / cQueues;
+        unsigned int i;
+
+        for (i = 0; i < cTasks; i += cChunk) {
+            TaskQueue *ptq = &td.aQueue[td.iNextQueue % cQueues];
+
+            td.iNextQueue = (td.iNextQueue + 1) % cQueues;
+
+            Mutex_Lock(&ptq->lock);
+            QueuePush(ptq, apt + i, MIN(cChunk, cTasks - i));
+            Mutex_Release(&ptq->lock);
+        }
+    }
+
+    MT_SafeAdd(&td.queuedTasks, (int) cTasks);
+    SetManualEvent(td.activity);
+}
+
+/* Hand tasks to the worker queues and wake up idle threads.
+ * Called by task producers with td.queueLock held */
+static void
+MT_QueueTasks(Task ** apt, unsigned int cTasks)
+{
+    if (cTasks == 0)
+        return;
+
+    if (td.addedTasks == 0)
+        MT_SafeSet(&td.result, 0);      /* Reset result for new tasks */
+    td.addedTasks += (int) cTasks;
+
+    MT_PushTasks(apt, cTasks);
+}
+
+/* Take a task from the back of our own queue */
+static Task *
+QueuePop(TaskQueue * ptq)
+{
+    Task *task = NULL;
+
+    Mutex_Lock(&ptq->lock);
+    if (ptq->cTasks > 0) {
+        ptq->cTasks--;
+        task = ptq->apTasks[(ptq->iFirst + ptq->cTasks) % ptq->cAlloc];
+    }
+    Mutex_Release(&ptq->lock);
+
+    return task;
+}
+
+/* Take up to half of the tasks at the front of another queue, the end
+ * its owner does not pop from. The first one is returned, the others are
+ * moved to the queue of the thief. A thread without a queue (the main
+ * thread) takes only one, so that the order of the others is kept */
+static Task *
+QueueSteal(TaskQueue * ptqVictim, TaskQueue * ptqOwn)
+{
+    Task *apt[MAX_STEAL];
+    unsigned int i, cTasks;
+
+    Mutex_Lock(&ptqVictim->lock);
+    cTasks = ptqOwn ? MIN((ptqVictim->cTasks + 1) / 2, MAX_STEAL) : MIN(ptqVictim->cTasks, 1);
+    for (i = 0; i < cTasks; i++)
+        apt[i] = ptqVictim->apTasks[(ptqVictim->iFirst + i) % ptqVictim->cAlloc];
+    if (cTasks) {
+        ptqVictim->iFirst = (ptqVictim->iFirst + cTasks) % ptqVictim->cAlloc;
+        ptqVictim->cTasks -= cTasks;
+    }
+    Mutex_Release(&ptqVictim->lock);
+
+    if (cTasks > 1) {
+        Mutex_Lock(&ptqOwn->lock);
+        QueuePush(ptqOwn, apt + 1, cTasks - 1);
+        Mutex_Release(&ptqOwn->lock);
+    }
+
+    return cTasks ? apt[0] : NULL;
+}
+
 static Task *
 MT_GetTask(void)
 {
+    unsigned int cQueues = td.numThreads ? td.numThreads : 1;
+    int id = MT_GetThreadID();
+    TaskQueue *ptqOwn = (id >= 0 && (unsigned int) id < cQueues) ? &td.aQueue[id] : NULL;
+    unsigned int i;
     Task *task = NULL;
 
-    multi_debug("get task asks lock (queueLock)");
-    Mutex_Lock(&td.queueLock);
-    multi_debug("get task gets lock (queueLock)");
+    if (MT_SafeGet(&td.queuedTasks) == 0)
+        return NULL;
 
-    if (g_list_length(td.tasks) > 0) {
-        task = (Task *) g_list_first(td.tasks)->data;
-        td.tasks = g_list_delete_link(td.tasks, g_list_first(td.tasks));
-        if (g_list_length(td.tasks) == 0) {
-            ResetManualEvent(td.activity);
-        }
+    if (ptqOwn)
+        task = QueuePop(ptqOwn);
+
+    for (i = 1; !task && i <= cQueues; i++) {
+        unsigned int iVictim = (unsigned int) (id + (int) i) % cQueues;
+
+        if (&td.aQueue[iVictim] != ptqOwn)
+            task = QueueSteal(&td.aQueue[iVictim], ptqOwn);
     }
 
-    Mutex_Release(&td.queueLock);
-    multi_debug("get task unlocks (queueLock)");
+    if (task)
+        MT_SafeDec(&td.queuedTasks);
 
     return task;
 }
@@ -97,7 +296,7 @@ extern void
 MT_AbortTasks(void)
 {
     Task *task;
-    /* Remove tasks from list */
+    /* Remove tasks from the queues */
     while ((task = MT_GetTask()) != NULL)
         MT_TaskDone(task);
 
@@ -128,15 +327,28 @@ MT_WorkerThreadFunction(void *tld)
 
         MT_SafeInc(&td.result);
         MT_TaskDone(NULL);      /* Thread created */
-        do {
-            Task *task;
-            WaitForManualEvent(td.activity);
-            task = MT_GetTask();
-            if (task) {
-                task->fun(task->data);
-                MT_TaskDone(task);
+        for (;;) {
+            Task *task = MT_GetTask();
+
+            if (!task) {
+                /* Nothing left anywhere: go to sleep, unless tasks were
+                 * queued between our search and the reset */
+                ResetManualEvent(td.activity);
+                if (MT_SafeGet(&td.queuedTasks) == 0) {
+                    MT_SafeInc(&td.idleThreads);
+                    WaitForManualEvent(td.activity);
+                    MT_SafeDec(&td.idleThreads);
+                }
+                continue;
             }
-        } while (MT_SafeCompare(&td.closingThreads, FALSE));
+
+            task->fun(task->data);
+            MT_TaskDone(task);
+
+            /* After CloseThread() has run our thread local data is gone */
+            if (MT_SafeCompare(&td.closingThreads, TRUE))
+                break;
+        }
 
 #if 0
 #if __GNUC__ && defined(WIN32)
@@ -204,6 +416,7 @@ MT_SetNumThreads(unsigned int num)
             GeneralCubeDecisionE = GeneralCubeDecisionENoLocking;
             GeneralEvaluationE = GeneralEvaluationENoLocking;
             ScoreMove = ScoreMoveNoLocking;
+            ScoreRolls = ScoreRollsNoLocking;
             FindBestMove = FindBestMoveNoLocking;
             FindnSaveBestMoves = FindnSaveBestMovesNoLocking;
             BasicCubefulRollout = BasicCubefulRolloutNoLocking;
@@ -212,6 +425,7 @@ MT_SetNumThreads(unsigned int num)
             GeneralCubeDecisionE = GeneralCubeDecisionEWithLocking;
             GeneralEvaluationE = GeneralEvaluationEWithLocking;
             ScoreMove = ScoreMoveWithLocking;
+            ScoreRolls = ScoreRollsWithLocking;
             FindBestMove = FindBestMoveWithLocking;
             FindnSaveBestMoves = FindnSaveBestMovesWithLocking;
             BasicCubefulRollout = BasicCubefulRolloutWithLocking;
@@ -241,23 +455,44 @@ MT_AddTask(Task * pt, gboolean lock)
         Mutex_Lock(&td.queueLock);
         multi_debug("add task gets lock (queueLock)");
     }
-    if (td.addedTasks == 0)
-        MT_SafeSet(&td.result, 0);          /* Reset result for new tasks */
-    td.addedTasks++;
-    td.tasks = g_list_append(td.tasks, pt);
-    if (g_list_length(td.tasks) == 1) { /* New tasks */
-        SetManualEvent(td.activity);
-    }
+    MT_QueueTasks(&pt, 1);
     if (lock) {
         Mutex_Release(&td.queueLock);
         multi_debug("add task unlocks");
     }
 }
 
+/* Hand a task to the threads without adding it to the batch
+ * MT_WaitForTasks() waits for: the caller finds out by itself when it
+ * is done. It is freed once it has run. MT_AbortTasks() drops it
+ * without running it */
+extern void
+MT_AddDetachedTask(Task * pt)
+{
+    Task *ptDetached = (Task *) g_malloc(sizeof(Task));
+
+    ptDetached->fun = DetachedTaskRun;
+    ptDetached->data = pt;
+    ptDetached->pLinkedTask = NULL;
+
+    Mutex_Lock(&td.queueLock);
+    MT_PushTasks(&ptDetached, 1);
+    Mutex_Release(&td.queueLock);
+}
+
 extern void
 mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked)
 {
+    Task **apt = (Task **) g_malloc(num_tasks * sizeof(Task *));
     unsigned int i;
+
+    for (i = 0; i < num_tasks; i++) {
+        Task *pt = (Task *) g_malloc(sizeof(Task));
+        pt->fun = pFun;
+        pt->data = taskData;
+        pt->pLinkedTask = linked;
+        apt[i] = pt;
+    }
     {
 #if defined(DEBUG_MULTITHREADED)
         multi_debug("add %u task%s asks lock (queueLock)", num_tasks, (num_tasks > 1 ? "s" : ""));
@@ -267,30 +502,11 @@ mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer lin
         Mutex_Lock(&td.queueLock);
 #endif
     }
-    for (i = 0; i < num_tasks; i++) {
-        Task *pt = (Task *) g_malloc(sizeof(Task));
-        pt->fun = pFun;
-        pt->data = taskData;
-        pt->pLinkedTask = linked;
-        MT_AddTask(pt, FALSE);
-    }
+    MT_QueueTasks(apt, num_tasks);
     Mutex_Release(&td.queueLock);
     multi_debug("add tasks unlocks (queueLock)");
-}
-
-static gboolean
-WaitForAllTasks(int time)
-{
-    int j = 0;
 
-    while (!MT_SafeCompare(&td.doneTasks, td.totalTasks)) {
-        if (j == 10)
-            return FALSE;       /* Not done yet */
-
-        j++;
-        g_usleep(100 * time);
-    }
-    return TRUE;
+    g_free(apt);
 }
 
 int
@@ -302,7 +518,8 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
     guint as_source = 0;
 
     /* Set total tasks to wait for */
-    td.totalTasks = td.addedTasks;
+    ResetManualEvent(td.tasksDone);
+    MT_SafeSet(&td.totalTasks, td.addedTasks);
 #if defined(USE_GTK)
         // g_message("MT_WaitForTasks\n");
     GTKSuspendInput();
@@ -312,7 +529,8 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
     if (autosave)
         as_source = g_timeout_add(nAutoSaveTime * 60000, save_autosave, NULL);
     multi_debug("waiting for all tasks");
-    while (!WaitForAllTasks(polltime)) {
+    while (!MT_SafeCompare(&td.doneTasks, td.totalTasks)
+           && !WaitForManualEventTimeout(td.tasksDone, polltime)) {
         waits++;
         if (pCallback && waits >= callbackLoops) {
             waits = 0;
@@ -328,7 +546,7 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
 
     MT_SafeSet(&td.doneTasks, 0);
     td.addedTasks = 0;
-    td.totalTasks = -1;
+    MT_SafeSet(&td.totalTasks, -1);
 
 #if defined(USE_GTK)
     GTKResumeInput();
@@ -336,6 +554,61 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
     return MT_SafeGet(&td.result);
 }
 
+/* Call fun(data, i) for i = 0 ... n-1 and return when all calls are
+ * done. The calling thread works through the loop itself, with help from
+ * as many threads as are idle at the time, so the order of the calls is
+ * not defined and fun must only write results of its own index.
+ * Threads taking part use their own thread local data. */
+
+extern void
+MT_ParallelFor(unsigned int n, ParallelFun fun, void *data)
+{
+    int cIdle = MT_SafeGet(&td.idleThreads);
+    unsigned int cHelpers, i;
+    ParallelLoop *ppl;
+    Task **apt;
+
+    if (n < 2 || cIdle <= 0 || td.numThreads < 2 || MT_SafeCompare(&td.closingThreads, TRUE)) {
+        for (i = 0; i < n; i++)
+            fun(data, i);
+        return;
+    }
+
+    cHelpers = MIN((unsigned int) cIdle, n - 1);
+
+    ppl = (ParallelLoop *) g_malloc(sizeof(ParallelLoop));
+    ppl->fun = fun;
+    ppl->data = data;
+    ppl->n = (int) n;
+    ppl->iNext = 0;
+    ppl->cDone = 0;
+    ppl->cRef = (int) cHelpers + 1;
+    InitManualEvent(&ppl->evDone);
+
+    apt = (Task **) g_malloc(cHelpers * sizeof(Task *));
+    for (i = 0; i < cHelpers; i++) {
+        apt[i] = (Task *) g_malloc(sizeof(Task));
+        apt[i]->fun = ParallelLoopTask;
+        apt[i]->data = ppl;
+        apt[i]->pLinkedTask = NULL;
+    }
+
+    Mutex_Lock(&td.queueLock);
+    MT_PushTasks(apt, cHelpers);
+    Mutex_Release(&td.queueLock);
+    g_free(apt);
+
+    ParallelLoopRun(ppl);
+
+    /* All indices are handed out; the ones left are being worked on by
+     * other threads, and at n-ply one of them can take as long as the
+     * whole loop took so far */
+    while (MT_SafeGet(&ppl->cDone) < ppl->n)
+        WaitForManualEvent(ppl->evDone);
+
+    ParallelLoopRelease(ppl);
+}
+
 extern void
 MT_SetResultFailed(void)
 {
@@ -411,6 +684,14 @@ MT_AddTask(Task * pt, gboolean lock)
     td.tasks = g_list_append(td.tasks, pt);
 }
 
+extern void
+MT_AddDetachedTask(Task * pt)
+{
+    pt->fun(pt->data);
+    free(pt->pLinkedTask);
+    free(pt);
+}
+
 void
 mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked)
 {
@@ -471,6 +752,15 @@ MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave)
     return td.result;
 }
 
+extern void
+MT_ParallelFor(unsigned int n, ParallelFun fun, void *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        fun(data, i);
+}
+
 extern void
 MT_AbortTasks(void)
 {
@@ -51,6 +51,9 @@ typedef struct Task {
     struct Task *pLinkedTask;
 } Task;
 
+/* Body of a parallel loop, called once for each index */
+typedef void (*ParallelFun) (void *data, unsigned int i);
+
 typedef struct {
     Task task;
     moverecord *pmr;
@@ -62,6 +65,7 @@ typedef struct {
 typedef struct {
     int id;
     move *aMoves;
+    movehash *pMoveHash;
     NNState *pnnState;
 } ThreadLocalData;
 
@@ -72,6 +76,7 @@ typedef struct {
     GCond *cond;
 #endif
     int signalled;
+    unsigned int nSet;          /* times set, so that a waiting thread sees a set even if reset since */
 } * ManualEvent;	/* a ManualEvent is a pointer to this struct */
 
 typedef GPrivate *TLSItem;
@@ -82,6 +87,26 @@ typedef GMutex Mutex;
 typedef GMutex *Mutex;
 #endif
 
+#if !defined(MAX_NUMTHREADS)
+#if defined(USE_MULTITHREAD)
+#define MAX_NUMTHREADS 48
+#else
+#define MAX_NUMTHREADS 1
+#endif
+#endif
+
+#if defined(USE_MULTITHREAD)
+/* Double-ended task queue of one worker thread. The owner takes tasks
+ * from the back, idle threads steal them from the front */
+typedef struct {
+    Mutex lock;
+    Task **apTasks;
+    unsigned int iFirst;
+    unsigned int cTasks;
+    unsigned int cAlloc;
+} TaskQueue;
+#endif
+
 typedef struct {
     GList *tasks;
     int doneTasks;
@@ -90,16 +115,22 @@ typedef struct {
 
 #if defined(USE_MULTITHREAD)
     ManualEvent activity;
+    ManualEvent tasksDone;
     TLSItem tlsItem;
-    Mutex queueLock;
+    Mutex queueLock;            /* serialises task producers only */
     Mutex multiLock;
     ManualEvent syncStart;
     ManualEvent syncEnd;
 
+    TaskQueue aQueue[MAX_NUMTHREADS];
+    unsigned int iNextQueue;
+    int queuedTasks;
+
     int addedTasks;
     int totalTasks;
 
     int closingThreads;
+    int idleThreads;            /* workers asleep waiting for tasks */
     unsigned int numThreads;
 #endif
 } ThreadData;
@@ -107,8 +138,10 @@ typedef struct {
 extern int MT_GetDoneTasks(void);
 extern void MT_AbortTasks(void);
 extern void MT_AddTask(Task * pt, gboolean lock);
+extern void MT_AddDetachedTask(Task * pt);
 extern void mt_add_tasks(unsigned int num_tasks, AsyncFun pFun, void *taskData, gpointer linked);
 extern int MT_WaitForTasks(gboolean(*pCallback) (gpointer), int callbackTime, int autosave);
+extern void MT_ParallelFor(unsigned int n, ParallelFun fun, void *data);
 extern void MT_InitThreads(void);
 extern void MT_Close(void);
 extern void MT_CloseThreads(void);
@@ -123,6 +156,7 @@ extern void ResetManualEvent(ManualEvent ME);
 extern void Mutex_Lock(Mutex *mutex);
 extern void Mutex_Release(Mutex *mutex);
 extern void WaitForManualEvent(ManualEvent ME);
+extern int WaitForManualEventTimeout(ManualEvent ME, int msTimeout);
 extern void SetManualEvent(ManualEvent ME);
 extern void TLSSetValue(TLSItem pItem, size_t value);
 extern void InitManualEvent(ManualEvent * pME);
@@ -132,10 +166,6 @@ extern void FreeMutex(Mutex * mutex);
 
 #define TLSGet(item) *((size_t*)g_private_get(item))
 
-#if !defined(MAX_NUMTHREADS)
-#define MAX_NUMTHREADS 48
-#endif
-
 extern void MT_Release(void);
 extern void MT_Exclusive(void);
 extern void MT_StartThreads(void);
@@ -151,6 +181,7 @@ extern unsigned int MT_GetNumThreads(void);
 #define MT_GetThreadID() ((ThreadLocalData *)TLSGet(td.tlsItem))->id
 #define MT_Get_nnState() ((ThreadLocalData *)TLSGet(td.tlsItem))->pnnState
 #define MT_Get_aMoves() ((ThreadLocalData *)TLSGet(td.tlsItem))->aMoves
+#define MT_Get_MoveHash() ((ThreadLocalData *)TLSGet(td.tlsItem))->pMoveHash
 
 #if GLIB_CHECK_VERSION (2,30,0)
 #define MT_SafeIncValue(x) (g_atomic_int_add(x, 1) + 1)
@@ -172,9 +203,6 @@ extern unsigned int MT_GetNumThreads(void);
 #define MT_SafeCompare(x, y) g_atomic_int_compare_and_exchange(x, y, y)
 
 #else                           /*USE_MULTITHREAD */
-#if !defined(MAX_NUMTHREADS)
-#define MAX_NUMTHREADS 1
-#endif
 extern int asyncRet;
 #define MT_Exclusive() {}
 #define MT_Release() {}
@@ -192,6 +220,7 @@ extern int asyncRet;
 #define MT_GetThreadID() 0
 #define MT_Get_nnState() td.tld->pnnState
 #define MT_Get_aMoves() td.tld->aMoves
+#define MT_Get_MoveHash() td.tld->pMoveHash
 #define MT_GetTLD() td.tld
 
 #endif
@@ -38,6 +38,53 @@
 #include <glib/gstdio.h>
 #include <glib.h>
 
+static DBProvider *pdbBatch = NULL;     /* connection kept by RelationalBatchStart() */
+
+static void
+ReleaseDB(DBProvider * pdb)
+{
+    if (pdb != pdbBatch)
+        pdb->Disconnect();
+}
+
+extern int
+RelationalBatchStart(void)
+{
+    if (!pdbBatch)
+        pdbBatch = ConnectToDB(dbProviderType);
+
+    return (pdbBatch != NULL);
+}
+
+extern void
+RelationalBatchEnd(void)
+{
+    if (pdbBatch) {
+        pdbBatch->Disconnect();
+        pdbBatch = NULL;
+    }
+}
+
+static GPtrArray *
+NewArgs(void)
+{
+    return g_ptr_array_new_with_free_func(g_free);
+}
+
+static void
+AddIntArg(GPtrArray * args, int n)
+{
+    g_ptr_array_add(args, g_strdup_printf("%d", n));
+}
+
+static int
+UpdateWithArgs(DBProvider * pdb, const char *str, GPtrArray * args)
+{                               /* Run str with args bound to its '?', and free args */
+    int ret = pdb->UpdateCommandArgs(str, (int) args->len, (const char *const *) args->pdata);
+    g_ptr_array_free(args, TRUE);
+    return ret;
+}
+
 static int
 RelationalMatchExists(DBProvider * pdb)
 {
@@ -73,26 +120,27 @@ GameOver(void)
 }
 
 static int
-GetNextId(DBProvider * pdb, const char *table)
-{
+GetNextIds(DBProvider * pdb, const char *table, int n)
+{                               /* Reserve n consecutive ids, return the first one */
     int next_id;
-    /* fetch next_id from control table */
+    GPtrArray *args = NewArgs();
+    /* fetch last id used from control table */
     char *buf = g_strdup_printf("next_id FROM control WHERE tablename = '%s'", table);
     next_id = RunQueryValue(pdb, buf);
     g_free(buf);
 
-    if (next_id != -1) {        /* update control data with new next id */
+    if (next_id != -1) {        /* update control data with the last id reserved */
+        AddIntArg(args, next_id + n);
+        g_ptr_array_add(args, g_strdup(table));
         next_id++;
-        buf = g_strdup_printf("UPDATE control SET next_id = %d WHERE tablename = '%s'", next_id, table);
-        if (!pdb->UpdateCommand(buf))
+        if (!UpdateWithArgs(pdb, "UPDATE control SET next_id = ? WHERE tablename = ?", args))
             next_id = -1;
-        g_free(buf);
     } else {                    /* insert new id */
+        g_ptr_array_add(args, g_strdup(table));
+        AddIntArg(args, n);
         next_id = 1;
-        buf = g_strdup_printf("INSERT INTO control (tablename,next_id) VALUES ('%s',%d)", table, next_id);
-        if (!pdb->UpdateCommand(buf))
+        if (!UpdateWithArgs(pdb, "INSERT INTO control (tablename,next_id) VALUES (?, ?)", args))
             next_id = -1;
-        g_free(buf);
     }
     return next_id;
 }
@@ -111,12 +159,13 @@ AddPlayer(DBProvider * pdb, const char *name)
 {
     int id = GetPlayerId(pdb, name);
     if (id == -1) {             /* Add new player to database */
-        id = GetNextId(pdb, "player");
+        id = GetNextIds(pdb, "player", 1);
         if (id != -1) {
-            char *buf = g_strdup_printf("INSERT INTO player(player_id,name,notes) VALUES (%d, '%s', '')", id, name);
-            if (!pdb->UpdateCommand(buf))
+            GPtrArray *args = NewArgs();
+            AddIntArg(args, id);
+            g_ptr_array_add(args, g_strdup(name));
+            if (!UpdateWithArgs(pdb, "INSERT INTO player(player_id,name,notes) VALUES (?, ?, '')", args))
                 id = -1;
-            g_free(buf);
         }
     }
     return id;
@@ -147,17 +196,19 @@ Ratio(float a, int b)
 
 #define NS(x) (x == NULL) ? "NULL" : x
 #define APPENDF(x,y) {g_string_append_printf(column, "%s, ", x); \
-	g_string_append_printf(value, "'%s', ", g_ascii_dtostr(tmpf, G_ASCII_DTOSTR_BUF_SIZE, y));}
+	g_ptr_array_add(value, g_strdup(g_ascii_dtostr(tmpf, G_ASCII_DTOSTR_BUF_SIZE, y)));}
 #define APPENDI(x,y) {g_string_append_printf(column, "%s, ", x); \
-	g_string_append_printf(value, "'%i', ", y);}
+	g_ptr_array_add(value, g_strdup_printf("%i", y));}
 #define APPENDU(x,y) {g_string_append_printf(column, "%s, ", x); \
-        g_string_append_printf(value, "'%u', ", y);}
+        g_ptr_array_add(value, g_strdup_printf("%u", y));}
 
 static int
-AddStats(DBProvider * pdb, int gm_id, int player_id, int player, const char *table, int nMatchTo, statcontext * sc)
+AddStats(DBProvider * pdb, int gms_id, int gm_id, int player_id, int player, const char *table, int nMatchTo,
+         statcontext * sc)
 {
     gchar *buf;
-    GString *column, *value;
+    GString *column, *params;
+    GPtrArray *value;
     int totalmoves, unforced;
     float errorcost, errorskill;
     float aaaar[3][2][2][2];
@@ -165,10 +216,6 @@ AddStats(DBProvider * pdb, int gm_id, int player_id, int player, const char *tab
     int ret;
     char tmpf[G_ASCII_DTOSTR_BUF_SIZE];
 
-    int gms_id = GetNextId(pdb, table);
-    if (gms_id == -1)
-        return FALSE;
-
     totalmoves = sc->anTotalMoves[player];
     unforced = sc->anUnforcedMoves[player];
 
@@ -177,7 +224,7 @@ AddStats(DBProvider * pdb, int gm_id, int player_id, int player, const char *tab
     errorcost = aaaar[CUBEDECISION][PERMOVE][player][UNNORMALISED];
 
     column = g_string_new(NULL);
-    value = g_string_new(NULL);
+    value = NewArgs();
 
 
     if (strcmp("matchstat", table) == 0) {
@@ -288,13 +335,17 @@ AddStats(DBProvider * pdb, int gm_id, int player_id, int player, const char *tab
         APPENDF("luck_adjusted_advantage_ci", 1.95996f * sqrtf(scMatch.arVarianceLuckAdj[player] / (float) scMatch.nGames));
     }
 
+    params = g_string_new(NULL);
+    for (guint i = 0; i < value->len; i++)
+        g_string_append(params, "?, ");
+
     g_string_truncate(column, column->len - 2);
-    g_string_truncate(value, value->len - 2);
-    buf = g_strdup_printf("INSERT INTO %s (%s) VALUES(%s)", table, column->str, value->str);
-    ret = pdb->UpdateCommand(buf);
+    g_string_truncate(params, params->len - 2);
+    buf = g_strdup_printf("INSERT INTO %s (%s) VALUES(%s)", table, column->str, params->str);
+    ret = UpdateWithArgs(pdb, buf, value);
     g_free(buf);
     g_string_free(column, TRUE);
-    g_string_free(value, TRUE);
+    g_string_free(params, TRUE);
     return ret;
 }
 
@@ -375,17 +426,28 @@ ConnectToDB(DBProviderType dbType)
     return NULL;
 }
 
-static void
-AddGames(DBProvider * pdb, int session_id, int player_id0, int player_id1)
+static int
+CountGames(void)
 {
+    int n = 0;
+    const listOLD *pl;
+
+    for (pl = lMatch.plNext; pl->p; pl = pl->plNext)
+        n++;
+
+    return n;
+}
+
+static int
+AddGames(DBProvider * pdb, int session_id, int player_id0, int player_id1, int game_id, int gamestat_id)
+{                               /* Add the games with the ids reserved from game_id and gamestat_id */
     int gamenum = 0;
     listOLD *plg, *pl = lMatch.plNext;
     while ((plg = pl->p) != NULL) {
-        int game_id = GetNextId(pdb, "game");
         int result = 0;
         moverecord *pmr = plg->plNext->p;
         xmovegameinfo *pmgi = &pmr->g;
-        char *buf;
+        GPtrArray *args = NewArgs();
 
         switch(pmgi->fWinner) {
             case 0:
@@ -400,62 +462,70 @@ AddGames(DBProvider * pdb, int session_id, int player_id0, int player_id1)
                 g_assert_not_reached();
         }
 
-        buf = g_strdup_printf("INSERT INTO game(game_id, session_id, player_id0, player_id1, "
-                                    "score_0, score_1, result, added, game_number, crawford) "
-                                    "VALUES (%d, %d, %d, %d, %d, %d, %d, CURRENT_TIMESTAMP, %d, %d )",
-                                    game_id, session_id, player_id0, player_id1,
-                                    pmgi->anScore[0], pmgi->anScore[1], result, ++gamenum, pmr->g.fCrawfordGame);
-
-        if (pdb->UpdateCommand(buf)) {
-            AddStats(pdb, game_id, player_id0, 0, "gamestat", ms.nMatchTo, &(pmgi->sc));
-            AddStats(pdb, game_id, player_id1, 1, "gamestat", ms.nMatchTo, &(pmgi->sc));
-        }
-        g_free(buf);
+        AddIntArg(args, game_id);
+        AddIntArg(args, session_id);
+        AddIntArg(args, player_id0);
+        AddIntArg(args, player_id1);
+        AddIntArg(args, pmgi->anScore[0]);
+        AddIntArg(args, pmgi->anScore[1]);
+        AddIntArg(args, result);
+        AddIntArg(args, ++gamenum);
+        AddIntArg(args, pmr->g.fCrawfordGame);
+
+        if (!UpdateWithArgs(pdb, "INSERT INTO game(game_id, session_id, player_id0, player_id1, "
+                            "score_0, score_1, result, added, game_number, crawford) "
+                            "VALUES (?, ?, ?, ?, ?, ?, ?, CURRENT_TIMESTAMP, ?, ?)", args)
+            || !AddStats(pdb, gamestat_id, game_id, player_id0, 0, "gamestat", ms.nMatchTo, &(pmgi->sc))
+            || !AddStats(pdb, gamestat_id + 1, game_id, player_id1, 1, "gamestat", ms.nMatchTo, &(pmgi->sc)))
+            return FALSE;
+
+        game_id++;
+        gamestat_id += 2;
         pl = pl->plNext;
     }
+    return TRUE;
 }
 
-extern void
-CommandRelationalAddMatch(char *sz)
+extern int
+RelationalAddMatch(int fQuiet)
 {
     DBProvider *pdb;
     char *buf, *date;
     char warnings[1024] = "";
     int session_id, existing_id, player_id0, player_id1;
-    char *arg = NULL;
-    gboolean quiet = FALSE;
-
-    arg = NextToken(&sz);
-    if (arg)
-        quiet = !strcmp(arg, "quiet");
+    int matchstat_id, nGames, game_id = 0, gamestat_id = 0;
+    GPtrArray *args;
+    int ret = -1;
 
     if (ListEmpty(&lMatch)) {
         outputl(_("No match is being played."));
-        return;
+        return -1;
     }
 
     /* Warn if match is not finished or fully analysed */
-    if (!quiet && !GameOver())
+    if (!fQuiet && !GameOver())
         strcat(warnings, _("The match is not finished\n"));
-    if (!quiet && !MatchAnalysed())
+    if (!fQuiet && !MatchAnalysed())
         strcat(warnings, _("All of the match is not analysed\n"));
 
     if (*warnings) {
         strcat(warnings, _("\nAdd match anyway?"));
         if (!GetInputYN(warnings))
-            return;
+            return -1;
     }
 
-    if ((pdb = ConnectToDB(dbProviderType)) == NULL) {
+    if ((pdb = pdbBatch) == NULL && (pdb = ConnectToDB(dbProviderType)) == NULL) {
         outputerrf(_("Error opening database"));
-        return;
+        return -1;
     }
     existing_id = RelationalMatchExists(pdb);
     if (existing_id != -1) {
         char *buf2;
 
-        if (!quiet && !GetInputYN(_("Match exists, overwrite?")))
-            return;
+        if (!fQuiet && !GetInputYN(_("Match exists, overwrite?"))) {
+            ReleaseDB(pdb);
+            return -1;
+        }
 
         /* Remove any game stats and games */
         buf2 = g_strdup_printf("FROM game WHERE session_id = %d", existing_id);
@@ -476,12 +546,22 @@ CommandRelationalAddMatch(char *sz)
         g_free(buf);
     }
 
-    session_id = GetNextId(pdb, "session");
+    /* Reserve all the ids of the match at once */
+    nGames = storeGameStats ? CountGames() : 0;
+    session_id = GetNextIds(pdb, "session", 1);
+    matchstat_id = GetNextIds(pdb, "matchstat", 2);
+    if (nGames) {
+        game_id = GetNextIds(pdb, "game", nGames);
+        gamestat_id = GetNextIds(pdb, "gamestat", 2 * nGames);
+    }
     player_id0 = AddPlayer(pdb, ap[0].szName);
     player_id1 = AddPlayer(pdb, ap[1].szName);
-    if (session_id == -1 || player_id0 == -1 || player_id1 == -1) {
+    if (session_id == -1 || matchstat_id == -1 || game_id == -1 || gamestat_id == -1
+        || player_id0 == -1 || player_id1 == -1) {
         outputl(_("Error adding match."));
-        return;
+        pdb->Rollback();
+        ReleaseDB(pdb);
+        return -1;
     }
 
     if (mi.nYear)
@@ -489,27 +569,51 @@ CommandRelationalAddMatch(char *sz)
     else
         date = NULL;
 
-    buf = g_strdup_printf("INSERT INTO session(session_id, checksum, player_id0, player_id1, "
-                          "result, length, added, rating0, rating1, event, round, place, annotator, comment, date) "
-                          "VALUES (%d, '%s', %d, %d, %d, %d, CURRENT_TIMESTAMP, '%s', '%s', '%s', '%s', '%s', '%s', '%s', '%s')",
-                          session_id, GetMatchCheckSum(), player_id0, player_id1,
-                          MatchResult(ms.nMatchTo), ms.nMatchTo, NS(mi.pchRating[0]), NS(mi.pchRating[1]),
-                          NS(mi.pchEvent), NS(mi.pchRound), NS(mi.pchPlace), NS(mi.pchAnnotator), NS(mi.pchComment),
-                          NS(date));
+    args = NewArgs();
+    AddIntArg(args, session_id);
+    g_ptr_array_add(args, g_strdup(GetMatchCheckSum()));
+    AddIntArg(args, player_id0);
+    AddIntArg(args, player_id1);
+    AddIntArg(args, MatchResult(ms.nMatchTo));
+    AddIntArg(args, ms.nMatchTo);
+    g_ptr_array_add(args, g_strdup(NS(mi.pchRating[0])));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchRating[1])));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchEvent)));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchRound)));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchPlace)));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchAnnotator)));
+    g_ptr_array_add(args, g_strdup(NS(mi.pchComment)));
+    g_ptr_array_add(args, g_strdup(NS(date)));
 
     updateStatisticsMatch(&lMatch);
 
-    if (pdb->UpdateCommand(buf)) {
-        if (AddStats(pdb, session_id, player_id0, 0, "matchstat", ms.nMatchTo, &scMatch) &&
-            AddStats(pdb, session_id, player_id1, 1, "matchstat", ms.nMatchTo, &scMatch)) {
-            if (storeGameStats)
-                AddGames(pdb, session_id, player_id0, player_id1);
-            pdb->Commit();
-        }
+    /* The whole match is one transaction */
+    if (UpdateWithArgs(pdb, "INSERT INTO session(session_id, checksum, player_id0, player_id1, "
+                       "result, length, added, rating0, rating1, event, round, place, annotator, comment, date) "
+                       "VALUES (?, ?, ?, ?, ?, ?, CURRENT_TIMESTAMP, ?, ?, ?, ?, ?, ?, ?, ?)", args)
+        && AddStats(pdb, matchstat_id, session_id, player_id0, 0, "matchstat", ms.nMatchTo, &scMatch)
+        && AddStats(pdb, matchstat_id + 1, session_id, player_id1, 1, "matchstat", ms.nMatchTo, &scMatch)
+        && (!nGames || AddGames(pdb, session_id, player_id0, player_id1, game_id, gamestat_id))) {
+        if (pdb->Commit())
+            ret = 0;
+        else
+            outputl(_("Error adding match."));
+    } else {
+        outputl(_("Error adding match."));
+        pdb->Rollback();
     }
-    g_free(buf);
     g_free(date);
-    pdb->Disconnect();
+    ReleaseDB(pdb);
+
+    return ret;
+}
+
+extern void
+CommandRelationalAddMatch(char *sz)
+{
+    char *arg = NextToken(&sz);
+
+    RelationalAddMatch(arg && !strcmp(arg, "quiet"));
 }
 
 const char *
@@ -33,4 +33,12 @@ extern int RelationalUpdatePlayerDetails(const char *oldName, const char *newNam
 extern float Ratio(float a, int b);
 extern statcontext *relational_player_stats_get(const char *player0, const char *player1);
 
+/* Keep one connection for the matches added until RelationalBatchEnd() */
+extern int RelationalBatchStart(void);
+extern void RelationalBatchEnd(void);
+
+/* Adds the current match, without asking anything if fQuiet.
+ * Returns 0 once it is committed, -1 otherwise. */
+extern int RelationalAddMatch(int fQuiet);
+
 #endif                          /* RELATIONAL_H */
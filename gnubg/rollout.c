@@ -935,6 +935,20 @@ static int ro_NextTrial;
 static unsigned int *altGameCount;
 static int *altTrialCount;
 
+/* Results of the trials a thread has done since it last merged them
+ * into aarResult, aarVariance, aarMu and aarSigma.
+ * Mean and sum of squared deviations are updated with Welford's method. */
+typedef struct {
+    unsigned int n;
+    float arMean[NUM_ROLLOUT_OUTPUTS];
+    float arM2[NUM_ROLLOUT_OUTPUTS];
+} rolloutacc;
+
+/* A thread merges its results after that many trials or that many
+ * milliseconds, whichever comes first */
+#define RO_MERGE_TRIALS 16
+#define RO_MERGE_MS 250.0
+
 static void
 check_jsds(int *active)
 {
@@ -1116,20 +1130,91 @@ check_sds(int *active)
 
 }
 
+static void
+AccumulateTrial(rolloutacc * pacc, const float aar[NUM_ROLLOUT_OUTPUTS])
+{
+    unsigned int j;
+
+    pacc->n++;
+
+    for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
+        float rDelta = aar[j] - pacc->arMean[j];
+
+        pacc->arMean[j] += rDelta / (float) pacc->n;
+        pacc->arM2[j] += rDelta * (aar[j] - pacc->arMean[j]);
+    }
+}
+
+/* Merge the pending results of one thread into the shared ones
+ * (pairwise update of Chan et al.). Must be called with MT_Exclusive() held. */
+
+static void
+MergeTrials(rolloutacc * aacc)
+{
+    int alt;
+    unsigned int j;
+
+    for (alt = 0; alt < ro_alternatives; ++alt) {
+        rolloutacc *pacc = aacc + alt;
+        rolloutcontext *prc = &ro_apes[alt]->rc;
+        unsigned int nOld = altGameCount[alt];
+        unsigned int n;
+
+        if (pacc->n == 0)
+            continue;
+
+        n = altGameCount[alt] = nOld + pacc->n;
+
+        for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
+            float rMuOld = nOld ? aarResult[alt][j] / (float) nOld : 0.0f;
+            float rDelta = pacc->arMean[j] - rMuOld;
+            float rM2 = (nOld > 1 ? aarVariance[alt][j] * (float) (nOld - 1) : 0.0f) + pacc->arM2[j] +
+                rDelta * rDelta * (float) nOld * (float) pacc->n / (float) n;
+
+            /* aarVariance is the unbiased variance of the trials */
+            aarVariance[alt][j] = (n > 1) ? rM2 / (float) (n - 1) : 0.0f;
+            aarResult[alt][j] += pacc->arMean[j] * (float) pacc->n;
+            aarMu[alt][j] = aarResult[alt][j] / (float) n;
+
+            if (j < OUTPUT_EQUITY) {
+                if (aarMu[alt][j] < 0.0f)
+                    aarMu[alt][j] = 0.0f;
+                else if (aarMu[alt][j] > 1.0f)
+                    aarMu[alt][j] = 1.0f;
+            }
+
+            aarSigma[alt][j] = sqrtf(aarVariance[alt][j] / (float) n);
+        }
+
+        /* For normal alternatives nGamesDone and altGameCount will be equal. For cube decisions,
+         * however, the two may differ by the number of threads minus 1. So we cheat a little bit, but
+         * it would be better if the double and nodouble alternatives weren't linked */
+        if (prc->nGamesDone < altGameCount[alt])
+            prc->nGamesDone = altGameCount[alt];
+
+        memset(pacc, 0, sizeof(*pacc));
+    }
+}
+
 extern void
 RolloutLoopMT(void *UNUSED(unused))
 {
     TanBoard anBoardEval;
     float aar[NUM_ROLLOUT_OUTPUTS];
     int active_alternatives;
-    unsigned int j;
     int alt;
     FILE *logfp = NULL;
     rolloutcontext *prc = NULL;
     /* Each thread gets a copy of the rngctxRollout */
     rngcontext *rngctxMTRollout = CopyRNGContext(rngctxRollout);
     perArray dicePerms;
+    rolloutacc *aacc = g_alloca(ro_alternatives * sizeof(rolloutacc));
+    unsigned int nPending = 0;
+    double tLastMerge = get_time();
+    int fDone = FALSE;
+
     dicePerms.nPermutationSeed = -1;
+    memset(aacc, 0, ro_alternatives * sizeof(rolloutacc));
 
     /* ============ begin rollout loop ============= */
 
@@ -1177,48 +1262,10 @@ RolloutLoopMT(void *UNUSED(unused))
             if (fInterrupt)
                 break;
 
-            multi_debug("exclusive lock: update result for alternative");
-            MT_Exclusive();
-            altGameCount[alt]++;
-
             if (ro_fInvert)
                 InvertEvaluationR(aar, ro_apci[alt]);
 
-            /* apply the results */
-            for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++) {
-                float rMuNew;
-
-                aarResult[alt][j] += aar[j];
-                rMuNew = aarResult[alt][j] / (float) altGameCount[alt];
-
-                if (altGameCount[alt] > 1) {    /* for i == 0 aarVariance is not defined */
-                    float rDelta = rMuNew - aarMu[alt][j];
-
-                    aarVariance[alt][j] =
-                        aarVariance[alt][j] * (1.0f - 1.0f / (float) (altGameCount[alt] - 1)) +
-                        (float) (altGameCount[alt]) * rDelta * rDelta;
-                }
-
-                aarMu[alt][j] = rMuNew;
-
-                if (j < OUTPUT_EQUITY) {
-                    if (aarMu[alt][j] < 0.0f)
-                        aarMu[alt][j] = 0.0f;
-                    else if (aarMu[alt][j] > 1.0f)
-                        aarMu[alt][j] = 1.0f;
-                }
-
-                aarSigma[alt][j] = sqrtf(aarVariance[alt][j] / (float) altGameCount[alt]);
-            }                   /* for (j = 0; j < NUM_ROLLOUT_OUTPUTS; j++ ) */
-
-            /* For normal alternatives nGamesDone and altGameCount will be equal. For cube decisions,
-             * however, the two may differ by the number of threads minus 1. So we cheat a little bit, but
-             * it would be better if the double and nodouble alternatives weren't linked */
-            if (prc->nGamesDone < altGameCount[alt])
-                prc->nGamesDone = altGameCount[alt];
-
-            MT_Release();
-            multi_debug("exclusive release: update result for alternative");
+            AccumulateTrial(aacc + alt, aar);
 
         }                       /* for (alt = 0; alt < ro_alternatives; ++alt) */
 
@@ -1233,22 +1280,49 @@ RolloutLoopMT(void *UNUSED(unused))
         ProcessEvents();
 #endif
 
+        /* the shared results and the stopping rules are only updated
+         * when this thread merges its pending trials */
+        if (++nPending < RO_MERGE_TRIALS && get_time() - tLastMerge < RO_MERGE_MS)
+            continue;
+
         multi_debug("exclusive lock: rollout cycle update");
         MT_Exclusive();
+        MergeTrials(aacc);
         if (show_jsds) {
             check_jsds(&active_alternatives);
         }
         if (rcRollout.fStopOnSTD) {
             check_sds(&active_alternatives);
         }
-        if ((active_alternatives < 2 && rcRollout.fStopOnJsd) || active_alternatives < 1) {
-            multi_debug("exclusive release: rollout done early");
-            MT_Release();
+        fDone = (active_alternatives < 2 && rcRollout.fStopOnJsd) || active_alternatives < 1;
+        multi_debug("exclusive release: rollout cycle update");
+        MT_Release();
+
+        if (fDone)
             break;
+
+        nPending = 0;
+        tLastMerge = get_time();
+    }
+
+    if (!fDone) {
+        /* merge what is left when the trials are exhausted or the
+         * rollout is interrupted, and apply the stopping rules to the
+         * final counts as the unbatched loop did after every trial */
+        multi_debug("exclusive lock: final update");
+        MT_Exclusive();
+        MergeTrials(aacc);
+        active_alternatives = ro_alternatives;
+        if (show_jsds) {
+            check_jsds(&active_alternatives);
         }
-        multi_debug("exclusive release: rollout cycle update");
+        if (rcRollout.fStopOnSTD) {
+            check_sds(&active_alternatives);
+        }
+        multi_debug("exclusive release: final update");
         MT_Release();
     }
+
     g_free(rngctxMTRollout);
 }
 
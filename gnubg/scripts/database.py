@@ -19,10 +19,12 @@
 #
 
 connection = 0
+# placeholder style of the driver for PyUpdateCommandArgs
+paramstyle = 'qmark'
 
 
 def PyMySQLConnect(database, user, password, hostname):
-    global connection
+    global connection, paramstyle
 
     try:
         import MySQLdb
@@ -31,6 +33,8 @@ def PyMySQLConnect(database, user, password, hostname):
         # Windows
         import pymysql as MySQLdb
 
+    paramstyle = MySQLdb.paramstyle
+
     hostport = hostname.strip().split(':')
     try:
         mysql_host = hostport[0]
@@ -72,9 +76,11 @@ def PyMySQLConnect(database, user, password, hostname):
 
 
 def PyPostgreConnect(database, user, password, hostname):
-    global connection
+    global connection, paramstyle
     import pgdb
 
+    paramstyle = pgdb.paramstyle
+
     postgres_host = hostname.strip()
     try:
         connection = pgdb.connect(
@@ -106,9 +112,12 @@ def PyPostgreConnect(database, user, password, hostname):
 
 
 def PySQLiteConnect(dbfile):
-    global connection
+    global connection, paramstyle
     from sqlite3 import dbapi2 as sqlite
+    paramstyle = sqlite.paramstyle
     connection = sqlite.connect(dbfile)
+    connection.execute('PRAGMA journal_mode=WAL')
+    connection.execute('PRAGMA synchronous=NORMAL')
     return connection
 
 
@@ -143,6 +152,15 @@ def PyUpdateCommand(stmt):
     cursor.execute(stmt)
 
 
+def PyUpdateCommandArgs(stmt, args):
+    global connection
+    cursor = connection.cursor()
+    if paramstyle != 'qmark':
+        # MySQLdb and PyGreSQL take %s placeholders
+        stmt = stmt.replace('?', '%s')
+    cursor.execute(stmt, args)
+
+
 def PyUpdateCommandReturn(stmt):
     global connection
     cursor = connection.cursor()
@@ -153,3 +171,8 @@ def PyUpdateCommandReturn(stmt):
 def PyCommit():
     global connection
     connection.commit()
+
+
+def PyRollback():
+    global connection
+    connection.rollback()
@@ -672,6 +672,40 @@ CommandSetCache(char *sz)
         outputerr(_("Evaluation cache allocation failed"));
 }
 
+extern void
+CommandSetPersistentCache(char *sz)
+{
+    char *szFile = NextToken(&sz);
+    int n = 1 << 20;
+
+    if (!szFile || !*szFile) {
+        outputl(_("You must specify a file name, or `off'. See `help set persistentcache'."));
+        return;
+    }
+
+    if (!StrCaseCmp(szFile, "off")) {
+        EvalPersistentCacheClose();
+        outputl(_("The persistent evaluation cache is not used."));
+        return;
+    }
+
+    if (sz && *sz && (n = ParseNumber(&sz)) < 2) {
+        outputl(_("You must specify the number of persistent cache entries to use."));
+        return;
+    }
+
+    if ((n = EvalPersistentCacheOpen(szFile, (unsigned int) n)) == -2) {
+        outputerrf(_("%s is not a persistent evaluation cache and has not been changed"), szFile);
+        return;
+    } else if (n < 0) {
+        outputerrf(_("Could not open the persistent evaluation cache %s"), szFile);
+        return;
+    }
+
+    outputf(ngettext("The persistent evaluation cache %s holds %d entry.\n",
+                     "The persistent evaluation cache %s holds %d entries.\n", n), szFile, n);
+}
+
 #if defined(USE_MULTITHREAD)
 extern void
 CommandSetThreads(char *sz)
@@ -1062,6 +1096,23 @@ CommandSetEvalPrune(char *sz)
     g_free(asz0);
 }
 
+extern void
+CommandSetEvalQuantized(char *sz)
+{
+    gchar *asz0, *asz1, *szCommand;
+    int f = pecSet->fQuantized;
+
+    asz0 = g_strdup_printf(_("%s will use the quantized neural nets.\n"), szSet);
+    asz1 = g_strdup_printf(_("%s will use the floating point neural nets.\n"), szSet);
+    szCommand = g_strdup_printf("%s quantized", szSetCommand);
+    SetToggle(szCommand, &f, sz, asz0, asz1);
+    pecSet->fQuantized = f;
+
+    g_free(szCommand);
+    g_free(asz1);
+    g_free(asz0);
+}
+
 extern void
 CommandSetEvalDeterministic(char *sz)
 {
@@ -1102,6 +1153,27 @@ CommandSetEvalNoise(char *sz)
         outputf(_("%s will use noiseless evaluations.\n"), szSet);
 }
 
+extern void
+CommandSetEvalTime(char *sz)
+{
+
+    int n = ParseNumber(&sz);
+
+    if (n < 0 || n >= (1 << 24)) {
+        outputf(_("You must specify a time limit in milliseconds, or 0 for none " "(see `help set\n%s time').\n"),
+                szSetCommand);
+
+        return;
+    }
+
+    pecSet->nTimeLimit = (unsigned int) n;
+
+    if (pecSet->nTimeLimit)
+        outputf(_("%s will search deeper plies for at most %u ms.\n"), szSet, pecSet->nTimeLimit);
+    else
+        outputf(_("%s will have no time limit.\n"), szSet);
+}
+
 extern void
 CommandSetEvalPlies(char *sz)
 {
@@ -2692,6 +2764,14 @@ CommandSetTurn(char *sz)
     outputf(_("`%s' is now on roll.\n"), ap[i].szName);
 }
 
+extern void
+CommandSetIterativeMoveGen(char *sz)
+{
+    SetToggle("iterativemovegen", &fIterativeMoveGen, sz,
+              _("Legal moves will be generated without recursion."),
+              _("Legal moves will be generated recursively."));
+}
+
 extern void
 CommandSetJacoby(char *sz)
 {
@@ -120,6 +120,12 @@ ShowEvaluation(const evalcontext * pec)
             (pec->fUsePrune) ? _("Using pruning neural nets.") :
             _("Not using pruning neural nets."), pec->fCubeful ? _("Cubeful") : _("Cubeless"));
 
+    if (pec->fQuantized)
+        outputf("%s%s", "        ", _("Using quantized neural nets.\n"));
+
+    if (pec->nTimeLimit)
+        outputf("        %s %u ms.\n", _("Move search time limit"), pec->nTimeLimit);
+
     if (pec->rNoise > 0.0f) {
         outputf("%s%s %5.3f", ("        "), _("Noise standard deviation"), pec->rNoise);
         outputl(pec->fDeterministic ? _(" (deterministic noise).\n") : _(" (pseudo-random noise).\n"));
@@ -549,6 +555,10 @@ CommandShowCache(char *UNUSED(sz))
         outputc('.');
 
     outputc('\n');
+
+    if (cPersist.entries)
+        outputf(_("%10u persistent entries in %s, %u added this session.\n"), cPersist.size, cPersist.szFile,
+                (unsigned int) cPersist.cAdds);
 }
 #endif
 
@@ -983,6 +993,10 @@ CommandShowBuildInfo(char *UNUSED(sz))
     while ((pch = GetBuildInfoString()) != 0)
         outputl(gettext(pch));
 
+#if defined(USE_SIMD_INSTRUCTIONS)
+    outputf(_("Neural net kernel in use: %s.\n"), NeuralNetKernelName());
+#endif
+
     outputc('\n');
 }
 
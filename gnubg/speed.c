@@ -31,45 +31,76 @@
 #ifndef WIN32
 #include <stdlib.h>
 #endif
+#include <ctype.h>
+#include <math.h>
+#include <string.h>
 
 #include "lib/isaac.h"
 #include "lib/simd.h"
 
 #define EVALS_PER_ITERATION 1024
+#define MOVEGEN_POSITIONS 256
+#define CACHE_HOT_POSITIONS 64
+#define CACHE_MAX_THREADS 64
 
 static randctx rc;
 static double timeTaken;
+static TanBoard aanHot[CACHE_HOT_POSITIONS];
+
+static void
+RandomBoard(TanBoard anBoard)
+{
+    int j, k;
+
+    /* Generate a random board.  Don't allow chequers on the bar
+     * or borne off, so we can trivially guarantee the position
+     * is legal. */
+    for (j = 0; j < 25; j++)
+        anBoard[0][j] = anBoard[1][j] = 0;
+
+    for (j = 0; j < 15; j++) {
+        do {
+            k = irand(&rc) % 24;
+        } while (anBoard[1][23 - k]);
+        anBoard[0][k]++;
+
+        do {
+            k = irand(&rc) % 24;
+        } while (anBoard[0][23 - k]);
+        anBoard[1][k]++;
+    }
+}
+
+/* As RandomBoard(), but keep both sides in their own half of the board
+ * so that the position is a race */
+
+static void
+RandomRaceBoard(TanBoard anBoard)
+{
+    int j;
+
+    for (j = 0; j < 25; j++)
+        anBoard[0][j] = anBoard[1][j] = 0;
+
+    for (j = 0; j < 15; j++) {
+        anBoard[0][irand(&rc) % 12]++;
+        anBoard[1][irand(&rc) % 12]++;
+    }
+}
 
 static void
 RunEvals(void *UNUSED(notused))
 {
-    int aanBoard[EVALS_PER_ITERATION][2][25];
-    int i, j, k;
+    TanBoard aanBoard[EVALS_PER_ITERATION];
+    int i;
     double t;
     SSE_ALIGN(float ar[NUM_OUTPUTS]);
 
 #if defined(USE_MULTITHREAD)
     MT_Exclusive();
 #endif
-    for (i = 0; i < EVALS_PER_ITERATION; i++) {
-        /* Generate a random board.  Don't allow chequers on the bar
-         * or borne off, so we can trivially guarantee the position
-         * is legal. */
-        for (j = 0; j < 25; j++)
-            aanBoard[i][0][j] = aanBoard[i][1][j] = 0;
-
-        for (j = 0; j < 15; j++) {
-            do {
-                k = irand(&rc) % 24;
-            } while (aanBoard[i][1][23 - k]);
-            aanBoard[i][0][k]++;
-
-            do {
-                k = irand(&rc) % 24;
-            } while (aanBoard[i][0][23 - k]);
-            aanBoard[i][1][k]++;
-        }
-    }
+    for (i = 0; i < EVALS_PER_ITERATION; i++)
+        RandomBoard(aanBoard[i]);
 
 #if defined(USE_MULTITHREAD)
     MT_Release();
@@ -90,21 +121,231 @@ RunEvals(void *UNUSED(notused))
 #endif
 }
 
+/* Time the generation of all the legal moves of double rolls, the case
+ * with the most candidates, in the main thread */
+
+static void
+CalibrateMoves(int n)
+{
+    TanBoard aanBoard[MOVEGEN_POSITIONS];
+    movelist ml;
+    unsigned int cRolls = 0, cMoves = 0;
+    int iIter, i, d;
+    double t, tTotal = 0.0;
+
+    for (iIter = 0; n < 0 || iIter < n; iIter++) {
+        if (fInterrupt)
+            break;
+
+        for (i = 0; i < MOVEGEN_POSITIONS; i++)
+            RandomBoard(aanBoard[i]);
+
+        t = get_time();
+        for (i = 0; i < MOVEGEN_POSITIONS; i++)
+            for (d = 1; d <= 6; d++)
+                cMoves += (unsigned int) GenerateMoves(&ml, (ConstTanBoard) aanBoard[i], d, d, FALSE);
+        tTotal += get_time() - t;
+        cRolls += MOVEGEN_POSITIONS * 6;
+
+        if (fShowProgress && tTotal > 0.0) {
+            outputf("        \r");
+            outputf(_("Calibrating: "));
+            outputf(_("%.0f move generations/second"), cRolls * 1000.0 / tTotal);
+            fflush(stdout);
+        }
+    }
+
+    outputf("\r");
+    if (tTotal > 0.0) {
+        outputf(_("Calibration result: "));
+        outputf(_("%.0f move generations/second for double rolls (%.1f legal moves per roll, %s generator)"),
+                cRolls * 1000.0 / tTotal, (double) cMoves / cRolls,
+                fIterativeMoveGen ? _("iterative") : _("recursive"));
+        outputf(".\n");
+    } else
+        outputl(_("Calibration incomplete."));
+}
+
+/* Evaluate the same few positions in every thread, so that all the
+ * evaluations are cache hits on a handful of sets */
+
+static void
+RunCacheLookups(void *UNUSED(notused))
+{
+    int i;
+    double t;
+    SSE_ALIGN(float ar[NUM_OUTPUTS]);
+
+#if defined(USE_MULTITHREAD)
+    MT_SyncStart();
+#else
+    t = get_time();
+#endif
+
+    for (i = 0; i < EVALS_PER_ITERATION; i++)
+        (void) EvaluatePosition(NULL, (ConstTanBoard) aanHot[i % CACHE_HOT_POSITIONS], ar, &ciCubeless, NULL);
+
+#if defined(USE_MULTITHREAD)
+    if ((t = MT_SyncEnd()) > 0)
+        timeTaken += t;
+#else
+    timeTaken += (get_time() - t);
+#endif
+}
+
+/* Measure the lookup rate of the evaluation cache with 1, 2, 4... threads
+ * hammering the same entries */
+
+static void
+CalibrateCache(int n)
+{
+    unsigned int nThreads, i;
+    double rSingle = 0.0;
+    SSE_ALIGN(float ar[NUM_OUTPUTS]);
+#if defined(USE_MULTITHREAD)
+    unsigned int const nThreadsOrig = MT_GetNumThreads();
+    unsigned int const nMax = MIN(CACHE_MAX_THREADS, MAX_NUMTHREADS);
+#else
+    unsigned int const nMax = 1;
+#endif
+
+    if (!GetEvalCacheEntries()) {
+        outputl(_("The evaluation cache is disabled."));
+        return;
+    }
+
+    if (n < 0)
+        n = 16;
+
+    for (i = 0; i < CACHE_HOT_POSITIONS; i++) {
+        RandomBoard(aanHot[i]);
+        (void) EvaluatePosition(NULL, (ConstTanBoard) aanHot[i], ar, &ciCubeless, NULL);
+    }
+
+    for (nThreads = 1; nThreads <= nMax && !fInterrupt; nThreads = (nThreads < nMax && 2 * nThreads > nMax) ? nMax : 2 * nThreads) {
+        int iIter;
+        double spd;
+
+#if defined(USE_MULTITHREAD)
+        MT_SetNumThreads(nThreads);
+        MT_SyncInit();
+#endif
+        timeTaken = 0.0;
+        for (iIter = 0; iIter < n && !fInterrupt; iIter++) {
+#if defined(USE_MULTITHREAD)
+            mt_add_tasks(nThreads, RunCacheLookups, NULL, NULL);
+            (void) MT_WaitForTasks(NULL, 0, FALSE);
+#else
+            RunCacheLookups(NULL);
+#endif
+        }
+
+        if (timeTaken <= 0.0)
+            continue;
+
+        spd = (double) iIter * nThreads * EVALS_PER_ITERATION * 1000.0 / timeTaken;
+        if (nThreads == 1)
+            rSingle = spd;
+
+        outputf(_("%2u thread(s): %.0f cache lookups/second"), nThreads, spd);
+        if (rSingle > 0.0)
+            outputf(_(" (x%.2f)"), spd / rSingle);
+        outputf("\n");
+    }
+
+#if defined(USE_MULTITHREAD)
+    MT_SetNumThreads(nThreadsOrig);
+#endif
+}
+
+/* Compare the quantized nets with the float ones on the same random
+ * contact and race positions, for both accuracy and speed */
+
+static void
+CalibrateQuantized(int n)
+{
+    static const char *aszClass[2] = { N_("Contact"), N_("Race") };
+    TanBoard aanBoard[EVALS_PER_ITERATION];
+    float aarFloat[EVALS_PER_ITERATION][NUM_OUTPUTS];
+    float aarQuant[EVALS_PER_ITERATION][NUM_OUTPUTS];
+    evalcontext ecQuant = ecBasic;
+    unsigned int const iCacheSize = GetEvalCacheEntries();
+    unsigned int iClass;
+
+    if (n < 0)
+        n = 16;
+
+    ecQuant.fQuantized = TRUE;
+    EvalCacheResize(0);
+
+    for (iClass = 0; iClass < 2 && !fInterrupt; iClass++) {
+        double tFloat = 0.0, tQuant = 0.0, rSum = 0.0, rMax = 0.0;
+        unsigned int c = 0;
+        int iIter, i;
+
+        for (iIter = 0; iIter < n && !fInterrupt; iIter++) {
+            double t;
+
+            for (i = 0; i < EVALS_PER_ITERATION; i++)
+                if (iClass)
+                    RandomRaceBoard(aanBoard[i]);
+                else
+                    RandomBoard(aanBoard[i]);
+
+            t = get_time();
+            for (i = 0; i < EVALS_PER_ITERATION; i++)
+                (void) EvaluatePosition(NULL, (ConstTanBoard) aanBoard[i], aarFloat[i], &ciCubeless, &ecBasic);
+            tFloat += get_time() - t;
+
+            t = get_time();
+            for (i = 0; i < EVALS_PER_ITERATION; i++)
+                (void) EvaluatePosition(NULL, (ConstTanBoard) aanBoard[i], aarQuant[i], &ciCubeless, &ecQuant);
+            tQuant += get_time() - t;
+
+            for (i = 0; i < EVALS_PER_ITERATION; i++) {
+                double r = fabs(Utility(aarFloat[i], &ciCubeless) - Utility(aarQuant[i], &ciCubeless));
+
+                rSum += r;
+                if (r > rMax)
+                    rMax = r;
+            }
+            c += EVALS_PER_ITERATION;
+        }
+
+        if (!c || tFloat <= 0.0 || tQuant <= 0.0)
+            continue;
+
+        outputf(_("%-8s mean error %.5f, max error %.5f; %.0f float, %.0f quantized evaluations/second\n"),
+                gettext(aszClass[iClass]), rSum / c, rMax, c * 1000.0 / tFloat, c * 1000.0 / tQuant);
+    }
+
+    EvalCacheResize(iCacheSize);
+}
+
 extern void
 CommandCalibrate(char *sz)
 {
     int n = -1;
+    int fMoves = FALSE, fCache = FALSE, fQuantized = FALSE;
     unsigned int i, iIter, iCacheSize;
 #if defined(USE_GTK)
     void *pcc = NULL;
 #endif
 
-    iCacheSize = GetEvalCacheEntries();
-    EvalCacheResize(0);
+    if (sz && *sz && !isdigit(*sz) && *sz != '-') {
+        char *pch = NextToken(&sz);
 
-#if defined(USE_MULTITHREAD)
-    MT_SyncInit();
-#endif
+        if (!StrNCaseCmp(pch, "moves", strlen(pch)))
+            fMoves = TRUE;
+        else if (!StrNCaseCmp(pch, "cache", strlen(pch)))
+            fCache = TRUE;
+        else if (!StrNCaseCmp(pch, "quantized", strlen(pch)))
+            fQuantized = TRUE;
+        else {
+            outputf(_("Unknown keyword `%s' -- try `help calibrate'.\n"), pch);
+            return;
+        }
+    }
 
     if (sz && *sz) {
         n = ParseNumber(&sz);
@@ -125,6 +366,28 @@ CommandCalibrate(char *sz)
         rc.randrsl[i] = rc.randrsl[0];
     irandinit(&rc, TRUE);
 
+    if (fMoves) {
+        CalibrateMoves(n);
+        return;
+    }
+
+    if (fCache) {
+        CalibrateCache(n);
+        return;
+    }
+
+    if (fQuantized) {
+        CalibrateQuantized(n);
+        return;
+    }
+
+    iCacheSize = GetEvalCacheEntries();
+    EvalCacheResize(0);
+
+#if defined(USE_MULTITHREAD)
+    MT_SyncInit();
+#endif
+
 #if defined(USE_GTK)
     if (fX)
         pcc = GTKCalibrationStart();